@@ -0,0 +1,123 @@
+#ifndef __ABUFFER__
+#define __ABUFFER__
+
+#include <vector>
+#include <stdint.h>
+
+#include "common/ex.h"
+#include "common/helper.h"
+#include "Color.h"
+
+// A single translucent fragment. Fragments of a pixel are chained
+// through "next", which indexes into the arena of the ABuffer.
+struct Fragment {
+    int32_t depth;
+    Color color;
+    uint32_t next;
+};
+
+// The ABuffer stores the translucent fragments of a frame as per-pixel
+// linked lists. Fragments are allocated from an arena of fixed capacity
+// which is reset every frame, so the memory used stays bounded no
+// matter how many translucent surfaces the scene holds. Fragments that
+// do not fit are dropped and counted.
+class ABuffer {
+
+    private:
+    // Marks the end of a fragment list
+    const static uint32_t none = 0xffffffff;
+
+    unsigned m_width, m_height;
+
+    // Head of the fragment list of every pixel
+    std::vector<uint32_t> m_head;
+    // Pixels which have at least one fragment in this frame
+    std::vector<uint32_t> m_touched;
+
+    // The per-frame fragment arena
+    std::vector<Fragment> m_arena;
+    unsigned m_used;
+    unsigned m_dropped;
+
+    public:
+    // Maximum number of fragments blended per pixel, the nearest ones
+    // are kept when a pixel has more
+    const static unsigned maxLayers = 16;
+
+    // Dimensions and the total number of fragments the arena can hold
+    ABuffer(unsigned w, unsigned h, unsigned capacity);
+
+    // Discard the fragments of the previous frame
+    void reset();
+
+    // Resize to new dimensions, discarding all fragments
+    void readjust(unsigned w, unsigned h);
+
+    // Change the number of fragments the arena can hold,
+    // discarding all fragments
+    void setCapacity(unsigned capacity);
+
+    // Add a fragment to the list of pixel (x,y)
+    // Returns false if the arena is exhausted
+    bool insert(unsigned x, unsigned y, int32_t depth, Color cl);
+
+    // Blend the fragments of the index'th touched pixel over
+    // the opaque color "base", farthest fragment first
+    Color blend(unsigned index, Color base) const;
+
+    // Pixel co-ordinates of the index'th touched pixel
+    unsigned touchedX(unsigned index) const {
+        return m_touched[index] % m_width;
+    }
+    unsigned touchedY(unsigned index) const {
+        return m_touched[index] / m_width;
+    }
+
+    // Number of pixels having translucent fragments
+    unsigned touchedCount() const {
+        return m_touched.size();
+    }
+
+    // Number of fragments stored in this frame
+    unsigned fragmentCount() const {
+        return m_used;
+    }
+
+    // Number of fragments dropped because the arena was full
+    unsigned droppedCount() const {
+        return m_dropped;
+    }
+
+    // Maximum number of fragments the arena can hold
+    unsigned capacity() const {
+        return m_arena.size();
+    }
+
+    // Memory held by the buffer in bytes
+    size_t memoryUsage() const {
+        return m_arena.capacity()*sizeof(Fragment)
+            + (m_head.capacity()+m_touched.capacity())*sizeof(uint32_t);
+    }
+};
+
+inline bool ABuffer::insert(unsigned x, unsigned y, int32_t depth,
+        Color cl) {
+    if (x >= m_width || y >= m_height)
+        return true;
+    if (m_used >= m_arena.size()) {
+        m_dropped++;
+        return false;
+    }
+    uint32_t pixel = y*m_width+x;
+    if (m_head[pixel] == none)
+        m_touched.push_back(pixel);
+
+    Fragment& frag = m_arena[m_used];
+    frag.depth = depth;
+    frag.color = cl;
+    frag.next = m_head[pixel];
+    m_head[pixel] = m_used++;
+    return true;
+}
+
+#endif
@@ -0,0 +1,227 @@
+#ifndef __BVH__
+#define __BVH__
+
+#include <vector>
+#include <stdint.h>
+
+#include "common/helper.h"
+#include "mathematics/Vector.h"
+#include "Frustum.h"
+
+// An axis aligned box
+struct Box {
+    float min[3], max[3];
+
+    // An empty box, including anything makes it that thing
+    Box() {
+        for (int a=0; a<3; a++) {
+            min[a] = 1e30f;
+            max[a] = -1e30f;
+        }
+    }
+
+    void include(float x, float y, float z) {
+        float p[] = {x,y,z};
+        for (int a=0; a<3; a++) {
+            min[a] = Math::min(min[a],p[a]);
+            max[a] = Math::max(max[a],p[a]);
+        }
+    }
+
+    void include(const Box& b) {
+        for (int a=0; a<3; a++) {
+            min[a] = Math::min(min[a],b.min[a]);
+            max[a] = Math::max(max[a],b.max[a]);
+        }
+    }
+
+    bool empty() const {
+        return min[0] > max[0];
+    }
+
+    // Half the surface area, enough for comparing costs
+    float area() const {
+        if (empty())
+            return 0;
+        float d[] = {max[0]-min[0], max[1]-min[1], max[2]-min[2]};
+        return d[0]*d[1] + d[1]*d[2] + d[2]*d[0];
+    }
+
+    float center(int axis) const {
+        return (min[axis]+max[axis])/2;
+    }
+
+    Vector lower() const {
+        return Vector(min[0],min[1],min[2],1);
+    }
+
+    Vector upper() const {
+        return Vector(max[0],max[1],max[2],1);
+    }
+
+    // Distance along a ray to where it enters the box, or a negative
+    // value if it misses it before "tmax". "inv" holds the reciprocal
+    // of the ray's direction.
+    float enter(const float origin[3], const float inv[3],
+            float tmax) const;
+};
+
+// A node of the hierarchy. Leaves hold "count" items starting at
+// "first" in the item order, inner nodes have count 0 and their
+// children at "first" and "first+1".
+struct BVHNode {
+    Box box;
+    uint32_t first, count;
+};
+
+// A bounding volume hierarchy over items given as boxes. It is built
+// top down with the surface area heuristic over binned centroids,
+// large subtrees are built on other threads. When the items move but
+// stay the same items, refit() updates the boxes without rebuilding.
+class BVH {
+
+    std::vector<BVHNode> m_nodes;
+    // Items ordered so that every leaf's items are contiguous
+    std::vector<uint32_t> m_items;
+    // Leaves hold at most this many items
+    unsigned m_leafSize;
+
+    // Build the subtree over items [begin,end) into "nodes", its root
+    // being nodes[root]
+    void split(const std::vector<Box>& boxes,
+            std::vector<BVHNode>& nodes, unsigned root,
+            unsigned begin, unsigned end, int depth);
+
+    public:
+    BVH(unsigned leafSize=1) : m_leafSize(leafSize) {
+    }
+
+    // Build anew over "boxes", item i being boxes[i]
+    void build(const std::vector<Box>& boxes);
+
+    // Recompute the boxes of the nodes when the items moved. The
+    // number of items must be the same as when built.
+    void refit(const std::vector<Box>& boxes);
+
+    bool empty() const {
+        return m_nodes.empty();
+    }
+
+    unsigned nodeCount() const {
+        return m_nodes.size();
+    }
+
+    const BVHNode& node(unsigned i) const {
+        return m_nodes[i];
+    }
+
+    // The i'th item in leaf order
+    unsigned item(unsigned i) const {
+        return m_items[i];
+    }
+
+    // Call visit(first, count, inside) for every leaf that may be
+    // seen. "inside" tells that the whole leaf is in the frustum.
+    template <typename F>
+    void cull(const Frustum& frustum, F visit) const;
+
+    // Call visit(item, tmax) for the items of every leaf the ray from
+    // "origin" along "dir" passes through before "tmax", nearest
+    // leaves first. visit returns the new tmax, to stop looking
+    // farther than a hit.
+    template <typename F>
+    void trace(const Vector& origin, const Vector& dir, float tmax,
+            F visit) const;
+};
+
+inline float Box::enter(const float origin[3], const float inv[3],
+        float tmax) const {
+    float tmin = 0;
+    for (int a=0; a<3; a++) {
+        float t0 = (min[a]-origin[a])*inv[a];
+        float t1 = (max[a]-origin[a])*inv[a];
+        if (t0 > t1)
+            swap(t0,t1);
+        // Written so that a NaN, from a ray lying in a face of the
+        // box, is ignored
+        if (t0 > tmin)
+            tmin = t0;
+        if (t1 < tmax)
+            tmax = t1;
+        if (tmin > tmax)
+            return -1;
+    }
+    return tmin;
+}
+
+template <typename F>
+void BVH::cull(const Frustum& frustum, F visit) const {
+    if (m_nodes.empty())
+        return;
+    // The nodes of a subtree wholly inside need no more tests
+    uint32_t stack[64];
+    bool inside[64];
+    int top = 0;
+    stack[top] = 0; inside[top++] = false;
+    while (top) {
+        top--;
+        const BVHNode& n = m_nodes[stack[top]];
+        bool in = inside[top];
+        if (!in) {
+            Vector lo = n.box.lower(), hi = n.box.upper();
+            if (!frustum.sees(lo,hi))
+                continue;
+            in = frustum.contains(lo,hi);
+        }
+        if (n.count) {
+            visit(n.first,n.count,in);
+            continue;
+        }
+        stack[top] = n.first; inside[top++] = in;
+        stack[top] = n.first+1; inside[top++] = in;
+    }
+}
+
+template <typename F>
+void BVH::trace(const Vector& origin, const Vector& dir, float tmax,
+        F visit) const {
+    if (m_nodes.empty())
+        return;
+    float o[] = {origin.x,origin.y,origin.z};
+    float inv[] = {1/dir.x,1/dir.y,1/dir.z};
+    uint32_t stack[64];
+    float entry[64];
+    int top = 0;
+    float t = m_nodes[0].box.enter(o,inv,tmax);
+    if (t < 0)
+        return;
+    stack[top] = 0; entry[top++] = t;
+    while (top) {
+        top--;
+        // A hit found since this node was pushed may be nearer
+        if (entry[top] > tmax)
+            continue;
+        const BVHNode& n = m_nodes[stack[top]];
+        if (n.count) {
+            for (unsigned i=n.first; i<n.first+n.count; i++)
+                tmax = visit(m_items[i],tmax);
+            continue;
+        }
+        // Push the farther child first so the nearer is taken first
+        float ta = m_nodes[n.first].box.enter(o,inv,tmax);
+        float tb = m_nodes[n.first+1].box.enter(o,inv,tmax);
+        uint32_t a = n.first, b = n.first+1;
+        if (ta > tb) {
+            swap(ta,tb);
+            swap(a,b);
+        }
+        if (tb >= 0) {
+            stack[top] = b; entry[top++] = tb;
+        }
+        if (ta >= 0) {
+            stack[top] = a; entry[top++] = ta;
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,108 @@
+#ifndef __CELLGRAPH__
+#define __CELLGRAPH__
+
+#include <vector>
+#include "mathematics/Matrix.h"
+#include "mathematics/Vector.h"
+#include "Frustum.h"
+
+// A CellGraph divides a scene, the inside of a building say, into
+// cells joined by portals: rooms and the doors and windows between
+// them. Objects are put in cells by their index in the Shader. Each
+// frame the cells seen from the camera's cell are found by walking
+// through the portals in view, the view narrowing to every portal
+// passed, and objects in other cells aren't drawn at all.
+//
+// Cells are axis aligned boxes, only used to find the camera's cell.
+// Portals are convex polygons and lead both ways. With the camera in
+// no cell every cell is taken as seen.
+class CellGraph {
+
+    struct Portal {
+        std::vector<Vector> points;
+        unsigned cells[2];
+    };
+
+    struct Cell {
+        Vector min, max;
+        std::vector<unsigned> portals;
+        // Whether the cell was reached in the last update(), the part
+        // of the screen, in normalized co-ordinates, it was seen
+        // through and the frustum of that part
+        bool visible;
+        float x0, y0, x1, y1;
+        unsigned frustum;
+    };
+
+    std::vector<Cell> m_cells;
+    std::vector<Portal> m_portals;
+    // The cell of every object, -1 for none
+    std::vector<int> m_objectCell;
+    std::vector<Frustum> m_frustums;
+    unsigned m_visible;
+    // Incremented whenever a cell, portal or object is added or moved
+    unsigned m_version;
+
+    // Mark "cell" seen through the part x0,y0 to x1,y1 of the view of
+    // "clip", and walk on through its portals. Cells on "path" are
+    // those walked through to get there.
+    void traverse(unsigned cell, const Matrix<float>& clip, float x0,
+            float y0, float x1, float y1, std::vector<bool>& path);
+
+    public:
+    CellGraph() : m_visible(0), m_version(0) {
+    }
+
+    // Add a cell spanning the box "min" to "max", returns its index
+    unsigned addCell(const Vector& min, const Vector& max);
+
+    // Join cells a and b by the convex polygon "points", returns the
+    // index of the portal
+    unsigned addPortal(unsigned a, unsigned b,
+            const std::vector<Vector>& points);
+
+    // Put object k of the Shader in "cell"
+    void assign(unsigned k, unsigned cell);
+
+    // Take object k out of its cell, it is then always drawn
+    void unassign(unsigned k);
+
+    // The cell holding point p, -1 for none
+    int cellAt(const Vector& p) const;
+
+    // The cell of object k, -1 for none
+    int cellOf(unsigned k) const {
+        return k<m_objectCell.size() ? m_objectCell[k] : -1;
+    }
+
+    // Find the cells seen from "eye" through "clip", which takes the
+    // world to homogeneous co-ordinates
+    void update(const Matrix<float>& clip, const Vector& eye);
+
+    // Whether object k, whose box is "min" to "max", may be seen after
+    // the last update()
+    bool visible(unsigned k, const Vector& min, const Vector& max) const;
+
+    bool cellVisible(unsigned cell) const {
+        return m_cells[cell].visible;
+    }
+
+    // Cells seen in the last update()
+    unsigned visibleCount() const {
+        return m_visible;
+    }
+
+    unsigned cellCount() const {
+        return m_cells.size();
+    }
+
+    unsigned portalCount() const {
+        return m_portals.size();
+    }
+
+    unsigned version() const {
+        return m_version;
+    }
+};
+
+#endif
@@ -0,0 +1,112 @@
+#ifndef __COMMANDBUFFER__
+#define __COMMANDBUFFER__
+
+#include <vector>
+#include <stddef.h>
+#include "Object.h"
+#include "Drawer.h"
+#include "Rect.h"
+
+class Shader;
+
+// A CommandBuffer holds the triangles of a frame as the rasterizer
+// takes them: resolved screen points, lit colors and state flags. It
+// is split into segments, one for every object, each recorded on its
+// own so that they can be recorded in parallel and kept while their
+// object doesn't change. Segments are cleared without giving back
+// their memory, so recording a frame allocates nothing once the
+// buffer has grown.
+//
+// Screen points are kept unrounded with the size they were recorded
+// at, executing on a render target of another size scales them.
+class CommandBuffer {
+
+    public:
+    struct Command {
+        // Device co-ordinates and depth of the corners
+        float x[3], y[3];
+        int32_t d[3];
+        Color color[3];
+        // World co-ordinates of the corners, for shadow lookups
+        float real[3][3];
+        // Gouraud interpolation, and overwriting equal depths
+        bool gouraud;
+        bool overwrite;
+        // What the surface samples, a NULL texture for none
+        TextureCorners texture;
+    };
+
+    private:
+    struct Segment {
+        std::vector<Command> commands;
+        // Screen area covered, at the recorded size
+        Rect area;
+        float opacity;
+    };
+
+    std::vector<Segment> m_segments;
+    unsigned m_width, m_height;
+
+    public:
+    CommandBuffer() : m_width(0), m_height(0) {
+    }
+
+    // Keep "count" segments, new ones are empty
+    void resize(unsigned count) {
+        m_segments.resize(count);
+    }
+
+    unsigned size() const {
+        return m_segments.size();
+    }
+
+    // Size of the render target the commands are recorded for
+    void setTarget(unsigned width, unsigned height) {
+        m_width = width;
+        m_height = height;
+    }
+
+    // Empty segment s, keeping its memory
+    void clear(unsigned s) {
+        m_segments[s].commands.clear();
+        m_segments[s].area = Rect();
+        m_segments[s].opacity = 1;
+    }
+
+    // Append the surfaces the Shader prepared of an object to
+    // segment s. "area" is the screen area they cover.
+    void record(unsigned s, Object* obj, const Rect& area);
+
+    // Append one triangle to segment s
+    void record(unsigned s, const Command& command, const Rect& area) {
+        m_segments[s].commands.push_back(command);
+        m_segments[s].area = m_segments[s].area.unite(area);
+    }
+
+    // Rasterize segment s onto the drawer
+    void execute(unsigned s, Drawer* drawer, Shader* sh) const;
+
+    // Rasterize one triangle, its points scaled by sx and sy
+    static void draw(const Command& c, Drawer* drawer, Shader* sh,
+            float sx=1, float sy=1);
+
+    const Rect& area(unsigned s) const {
+        return m_segments[s].area;
+    }
+
+    float opacity(unsigned s) const {
+        return m_segments[s].opacity;
+    }
+
+    void setOpacity(unsigned s, float opacity) {
+        m_segments[s].opacity = opacity;
+    }
+
+    // Commands held in all segments
+    unsigned commandCount() const;
+
+    // Memory held, including what cleared segments keep
+    size_t memoryUsage() const;
+};
+
+#endif
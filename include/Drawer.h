@@ -6,7 +6,10 @@
 #include "mathematics/LinspaceF.h"
 
 #include "ScreenPoint.h"
+#include "ProjectedVertices.h"
 #include "Lincolor.h"
+#include "Texture.h"
+#include "ABuffer.h"
 
 #define Plotter_ SDLPlotter
 #include SSTR(Plotter_.h)
@@ -25,7 +28,78 @@ class Drawer {
     // A depth buffer, a matrix of uint32_t
     Matrix<uint32_t> depth;
 
+    // Fragment lists of translucent surfaces
+    ABuffer m_abuffer;
+
+    // Alpha of the surfaces being filled, 0xff for opaque ones
+    uint8_t m_alpha;
+
+    // Only pixels inside this rectangle are drawn
+    Rect m_clip;
+
+    // A saved copy of the color and depth buffers
+    std::vector<uint32_t> m_layerColor;
+    std::vector<uint32_t> m_layerDepth;
+
+    // Pixels flagged non-zero in the mask are left untouched
+    const uint8_t* m_mask;
+
+    // Opaque fragments that passed the depth test and were shaded
+    unsigned m_shaded;
+
+    // Triangles of no area, triangles between the pixel centres and
+    // triangles taken by the small triangle path, since
+    // resetTriangleCounts()
+    unsigned m_degenerate, m_micro, m_small;
+
+    // Whether the pixel is masked out
+    inline bool masked(int x, int y) const {
+        return m_mask && m_mask[y*getWidth()+x];
+    }
+
+    // Write a fragment that passed the depth test
+    inline void write(int x, int y, int de, Color cl);
+
+    // u/w, v/w and 1/w of a textured triangle as planes over the
+    // screen, each held as its value at (x0,y0) and its steps in x
+    // and y. "depthScale" is 0 unless the texels' depths are used.
+    struct TexturePlanes {
+        const Texture* texture;
+        int x0, y0;
+        float u[3], v[3], q[3];
+        float depthScale;
+    };
+
+    // Fill a triangle whose corners 0, 1 and 2 are read through
+    // "corners", as fillD()
+    template<class Corners>
+    void fillCorners(const Corners& corners, bool interpolate,
+            Shader* sh, bool overwrite, const TextureCorners* texture);
+
+    // Fill a triangle at most smallTriangle pixels across, the
+    // corners sorted by y are s, m and e
+    template<class Corners>
+    void fillSmall(const Corners& corners, int s, int m, int e,
+            bool interpolate, Shader* sh, bool overwrite,
+            const TexturePlanes* planes);
+
+    // Pixels of a span on the screen, its ends already projected
+    // into the shadow buffer. Textured when "planes" isn't NULL.
+    void span(int y, int xStart, int dStart, int xEnd, int dEnd,
+            Color cStart, Color cEnd, bool interpolate, Vector sstart,
+            Vector send, Shader* sh, bool overwrite,
+            const TexturePlanes* planes=NULL);
+
+    // Texels of "count" pixels of row y from x on, at most
+    // Texture::lanes, and their depths if asked
+    void texels(const TexturePlanes& planes, int x, int y,
+            unsigned count, Color* out, float* depth=NULL) const;
+
     public:
+    // Triangles with a bounding box under this many pixels each way
+    // skip most of the setup of the scan conversion
+    const static int smallTriangle = 4;
+
     static void initAscending(ScreenPoint& start, ScreenPoint& mid,
             ScreenPoint& end, const ScreenPoint& pt1,
             const ScreenPoint& pt2, const ScreenPoint& pt3);
@@ -47,6 +121,79 @@ class Drawer {
         plotter->clear(clearColor);
         // Also clear the depth-buffer
         depth.clear();
+        // And the translucent fragments
+        m_abuffer.reset();
+    }
+
+    // Clear a rectangle of the screen and the depth-buffer
+    void clear(Color clearColor, const Rect& rect);
+
+    // Update only a rectangle of the screen
+    inline void update(const Rect& rect) {
+        plotter->update(rect);
+    }
+
+    // Save the color and depth buffers as they are now
+    void saveLayer();
+
+    // Copy a rectangle of the saved layer back, in place of clear()
+    void restoreLayer(const Rect& rect);
+
+    // Restrict drawing to a rectangle of the screen
+    inline void setClip(const Rect& rect) {
+        m_clip = rect.intersect(screenRect());
+    }
+
+    // Draw to the whole screen again
+    inline void resetClip() {
+        m_clip = screenRect();
+    }
+
+    // Leave the pixels flagged non-zero in "mask", one byte per
+    // pixel row by row, untouched. NULL draws everything.
+    inline void setMask(const uint8_t* mask) {
+        m_mask = mask;
+    }
+
+    // The color buffer of the render target, rows are
+    // getColorPitch() pixels apart
+    inline uint32_t* getColorBuffer() {
+        return plotter->pixels();
+    }
+
+    inline unsigned getColorPitch() const {
+        return plotter->pitch();
+    }
+
+    // The depth-buffer, stored column by column
+    inline uint32_t* getDepthBuffer() {
+        return &depth(0,0);
+    }
+
+    // The rectangle covering the whole screen
+    inline Rect screenRect() const {
+        return Rect(0,0,getWidth()-1,getHeight()-1);
+    }
+
+    // Set the opacity of the surfaces to be filled. Translucent
+    // fragments are collected instead of being plotted and are
+    // blended by resolve().
+    inline void setOpacity(float opacity) {
+        m_alpha = Math::max(0.0f,Math::min(opacity,1.0f))*0xff;
+    }
+
+    // Blend the collected translucent fragments over the
+    // opaque surfaces
+    void resolve();
+
+    // Limit the number of translucent fragments held per frame
+    void setFragmentBudget(unsigned count) {
+        m_abuffer.setCapacity(count);
+    }
+
+    // Get the translucent fragment buffer
+    const ABuffer& abuffer() const {
+        return m_abuffer;
     }
 
     void pixel(const ScreenPoint& point);
@@ -71,9 +218,57 @@ class Drawer {
     // Fill the triangle bounded by pt1, pt2 and pt3
     // considering depth buffer and color gradient
     // overwrite when true will enable overwrite to same depth
+    // "texture", when given, is sampled perspective correctly and
+    // multiplies the colors. Its empty texels aren't drawn, and its
+    // depths, if it has them, are added to the triangle's.
     void fillD(ScreenPoint pt1, ScreenPoint pt2, ScreenPoint pt3,
             bool interpolate=true,Shader* sh=NULL,
-            bool overwrite=true);
+            bool overwrite=true, const TextureCorners* texture=NULL);
+
+    // The same with the unrounded device co-ordinates of the corners,
+    // "x" and "y", which the micro triangle test takes
+    void fillD(ScreenPoint pt1, ScreenPoint pt2, ScreenPoint pt3,
+            const float x[3], const float y[3], bool interpolate,
+            Shader* sh, bool overwrite, const TextureCorners* texture);
+
+    // Fill the triangle of vertices a, b and c of a vertex array,
+    // "colors" holds one color for every corner when interpolating
+    // and one for the triangle otherwise
+    void fillD(const ProjectedVertices& v, unsigned a, unsigned b,
+            unsigned c, const Color* colors, bool interpolate=true,
+            Shader* sh=NULL, bool overwrite=true,
+            const TextureCorners* texture=NULL);
+
+    // Opaque fragments shaded since resetShadedCount(), more than
+    // the pixels drawn by the overdraw
+    unsigned shadedCount() const {
+        return m_shaded;
+    }
+
+    void resetShadedCount() {
+        m_shaded = 0;
+    }
+
+    // Triangles dropped at setup for having no area, or for lying
+    // between the pixel centres, and those filled by the small
+    // triangle path
+    unsigned degenerateCount() const {
+        return m_degenerate;
+    }
+
+    unsigned microCount() const {
+        return m_micro;
+    }
+
+    unsigned smallCount() const {
+        return m_small;
+    }
+
+    void resetTriangleCounts() {
+        m_degenerate = 0;
+        m_micro = 0;
+        m_small = 0;
+    }
 
     // Get the screen width
     int getWidth() const {
@@ -85,10 +280,35 @@ class Drawer {
         return plotter->height();
     }
 
+    // Render at w x h pixels, scaled up to the window on update()
+    void setRenderSize(unsigned w, unsigned h);
+
+    // Get the window width
+    int getWindowWidth() const {
+        return plotter->windowWidth();
+    }
+
+    // Get the window height
+    int getWindowHeight() const {
+        return plotter->windowHeight();
+    }
+
     // Get the aspect ration of the screen
     float getAspectRatio() const {
         return plotter->aspectRatio();
     }
 };
 
+inline void Drawer::write(int x, int y, int de, Color cl) {
+    if (m_alpha != 0xff) {
+        // Translucent fragments don't occlude anything
+        cl.alpha = m_alpha;
+        m_abuffer.insert(x,y,de,cl);
+    } else {
+        plotter->plot(x,y,cl,false);
+        depth(x,y)=de;
+        m_shaded++;
+    }
+}
+
 #endif
@@ -0,0 +1,37 @@
+#ifndef __FACINGSURFACES__
+#define __FACINGSURFACES__
+
+#include <vector>
+#include <stdint.h>
+#include "ProjectedVertices.h"
+
+struct Surface;
+
+// FacingSurfaces holds which surfaces of a projected object face the
+// camera, one bit per surface, and the list of surfaces left for the
+// rasterizer. The facing test is the sign of the signed area of the
+// projected triangle, taken a batch of triangles at a time.
+struct FacingSurfaces {
+    // Surfaces per batch of the facing test. Fewer and the compiler
+    // unrolls the loops over a batch instead of vectorizing them.
+    const static unsigned batch = 64;
+
+    // Bit i set when surface i faces the camera
+    std::vector<uint32_t> bits;
+    // The surfaces to rasterize, in the order they were given
+    std::vector<unsigned> list;
+
+    bool facing(unsigned i) const {
+        return bits[i>>5]>>(i&31) & 1;
+    }
+
+    // Test the listed surfaces, all of them without a list. All are
+    // taken as facing when "test" is false, and all are kept in the
+    // list with "keepBack".
+    void cull(const ProjectedVertices& v,
+            const std::vector<Surface>& surfaces,
+            const std::vector<unsigned>* subset, bool test,
+            bool keepBack);
+};
+
+#endif
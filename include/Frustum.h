@@ -0,0 +1,107 @@
+#ifndef __FRUSTUM__
+#define __FRUSTUM__
+
+#include <cmath>
+#include "mathematics/Matrix.h"
+#include "mathematics/Vector.h"
+
+// The six planes bounding what a camera sees, taken from the
+// projection*camera matrix. A point p is inside when
+// a*p.x + b*p.y + c*p.z + d >= 0 for every plane.
+class Frustum {
+
+    // a, b, c, d of the left, right, bottom, top, near and far planes,
+    // (a, b, c) is of unit length
+    float m_plane[6][4];
+
+    void normalize(int p) {
+        float len = std::sqrt(m_plane[p][0]*m_plane[p][0] +
+                m_plane[p][1]*m_plane[p][1] +
+                m_plane[p][2]*m_plane[p][2]);
+        if (len > 0)
+            for (int c=0; c<4; c++)
+                m_plane[p][c] /= len;
+    }
+
+    public:
+    // "clip" takes world co-ordinates to homogeneous co-ordinates
+    // which are visible for -w/2 <= x, y <= w/2 and -w <= z <= w, the
+    // part TfMatrix::toDevice puts on the screen
+    Frustum(const Matrix<float>& clip) {
+        for (int p=0; p<6; p++) {
+            // Plane p is half of row 3, row 3 for near and far, plus or
+            // minus row p/2
+            float sign = (p&1) ? -1 : 1;
+            float w = p<4 ? 0.5f : 1.0f;
+            for (int c=0; c<4; c++)
+                m_plane[p][c] = w*clip(3,c) + sign*clip(p/2,c);
+            normalize(p);
+        }
+    }
+
+    // The same planes in the co-ordinates "model" takes to the world,
+    // distances are then in their units
+    Frustum toModel(const Matrix<float>& model) const {
+        Frustum f(*this);
+        for (int p=0; p<6; p++) {
+            for (int c=0; c<4; c++) {
+                f.m_plane[p][c] = 0;
+                for (int r=0; r<4; r++)
+                    f.m_plane[p][c] += m_plane[p][r]*model(r,c);
+            }
+            f.normalize(p);
+        }
+        return f;
+    }
+
+    // Whether a sphere may be seen
+    bool sees(const Vector& center, float radius) const {
+        for (int p=0; p<6; p++)
+            if (distance(p,center.x,center.y,center.z) < -radius)
+                return false;
+        return true;
+    }
+
+    // Whether an axis aligned box may be seen. The corner farthest
+    // along a plane's normal is tested against it.
+    bool sees(const Vector& min, const Vector& max) const {
+        for (int p=0; p<6; p++) {
+            const float* pl = m_plane[p];
+            if (distance(p, pl[0]>=0 ? max.x : min.x,
+                        pl[1]>=0 ? max.y : min.y,
+                        pl[2]>=0 ? max.z : min.z) < 0)
+                return false;
+        }
+        return true;
+    }
+
+    // Whether an axis aligned box is wholly inside. The corner
+    // nearest along every plane's normal is tested against it.
+    bool contains(const Vector& min, const Vector& max) const {
+        for (int p=0; p<6; p++) {
+            const float* pl = m_plane[p];
+            if (distance(p, pl[0]>=0 ? min.x : max.x,
+                        pl[1]>=0 ? min.y : max.y,
+                        pl[2]>=0 ? min.z : max.z) < 0)
+                return false;
+        }
+        return true;
+    }
+
+    // Whether an axis aligned box lies wholly beyond the near plane,
+    // so that all of it projects in front of the camera
+    bool inFront(const Vector& min, const Vector& max) const {
+        const float* pl = m_plane[4];
+        return distance(4, pl[0]>=0 ? min.x : max.x,
+                pl[1]>=0 ? min.y : max.y,
+                pl[2]>=0 ? min.z : max.z) > 0;
+    }
+
+    // Signed distance of a point from plane p
+    float distance(int p, float x, float y, float z) const {
+        return m_plane[p][0]*x + m_plane[p][1]*y + m_plane[p][2]*z +
+            m_plane[p][3];
+    }
+};
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef __IMPOSTOR__
+#define __IMPOSTOR__
+
+#include <vector>
+#include <memory>
+#include "Object.h"
+#include "Texture.h"
+#include "InstanceSet.h"
+#include "CommandBuffer.h"
+
+// An Impostor stands in for the instances of a mesh too small on the
+// screen to be worth its triangles. The mesh is pictured from a fixed
+// set of directions around it: "azimuths" of them about its y axis at
+// each of "elevations" heights spread from below to above. A picture
+// is a sprite of "size" x "size" texels holding the lit colors and
+// the depths of the mesh's front, which is drawn on a quad through
+// the centre of the mesh facing the direction nearest the camera,
+// cut down to the part of the picture the mesh covers.
+//
+// Pictures are taken lazily, the first time their direction is
+// needed, by the Shader: it lights the mesh placed at the instance
+// being drawn with captureTransform() as the transformation, and
+// calls capture(). invalidate() drops them all, the Shader does so
+// whenever the lights change.
+class Impostor {
+
+    Object* mp_mesh;
+    unsigned m_size;
+    unsigned m_azimuths, m_elevations;
+    // Bounding sphere of the mesh in model co-ordinates
+    Vector m_center;
+    float m_radius;
+    // Half the side of the square a picture covers, larger than the
+    // radius by an empty border
+    float m_extent;
+
+    // The picture from every direction, NULL until taken, and the
+    // texels it covers, from x0,y0 up to x1,y1
+    struct View {
+        std::unique_ptr<Texture> picture;
+        unsigned x0, y0, x1, y1;
+    };
+    std::vector<View> m_views;
+
+    // Unit vectors toward the viewer of view v and along the right and
+    // the top of its picture, in model co-ordinates
+    void axes(unsigned v, Vector& toViewer, Vector& right,
+            Vector& up) const;
+
+    public:
+    Impostor(Object* mesh, unsigned size=64, unsigned azimuths=24,
+            unsigned elevations=13);
+
+    Impostor(const Impostor&) = delete;
+    Impostor& operator=(const Impostor&) = delete;
+
+    // The view nearest the direction "instance" is seen in from "eye"
+    unsigned view(const Instance& instance, const Vector& eye) const;
+
+    // Transformation from the world, the mesh placed by "model", to
+    // the texels of view v: x and y across the picture and z the
+    // depth in front of its centre, from -1 to 1
+    Matrix<float> captureTransform(unsigned v,
+            const Matrix<float>& model) const;
+
+    // Take the picture of view v from the mesh as the Shader left it
+    void capture(unsigned v);
+
+    bool captured(unsigned v) const {
+        return m_views[v].picture != NULL;
+    }
+
+    // Drop every picture
+    void invalidate();
+
+    // The two triangles of the quad of view v at "instance", tinted by
+    // it, through "transformation". False when a corner is behind the
+    // camera.
+    bool quad(unsigned v, const Instance& instance,
+            const Matrix<float>& transformation,
+            CommandBuffer::Command triangles[2]) const;
+
+    Object* mesh() const {
+        return mp_mesh;
+    }
+
+    unsigned viewCount() const {
+        return m_views.size();
+    }
+};
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef __INSTANCESET__
+#define __INSTANCESET__
+
+#include <vector>
+#include "Object.h"
+#include "SceneNode.h"
+#include "Color.h"
+
+// One placement of an instanced mesh, 52 bytes
+struct Instance {
+    // The top three rows of the model matrix, the last is 0 0 0 1
+    float transform[12];
+    // Multiplies the lit colors
+    Color tint;
+};
+
+// An InstanceSet draws one mesh at many places. The vertices, normals
+// and surfaces are stored once in the mesh; each instance adds its
+// transformation and a tint. The Shader shades the instances one after
+// another through the mesh, placing it with place() at each.
+//
+// The mesh must not be added to the Shader on its own, nor have a
+// node: the set attaches one of its own for good. Changing its
+// vertices needs a new set.
+class InstanceSet {
+
+    Object* mp_mesh;
+    std::vector<Instance> m_instances;
+    // Bounds of the mesh in model co-ordinates
+    Bounds m_bounds;
+    // Places the mesh at the instance being drawn
+    SceneNode m_node;
+
+    // Incremented whenever an instance is added or changed
+    unsigned m_version;
+
+    public:
+    InstanceSet(Object* mesh);
+
+    InstanceSet(const InstanceSet&) = delete;
+    InstanceSet& operator=(const InstanceSet&) = delete;
+
+    // Add an instance placed by the affine "transform", returns its
+    // index
+    unsigned add(const Matrix<float>& transform, Color tint=white);
+
+    void set(unsigned i, const Matrix<float>& transform);
+    void setTint(unsigned i, Color tint);
+
+    // The model matrix of instance i
+    Matrix<float> transform(unsigned i) const;
+
+    // World box of the mesh's box placed at instance i
+    void box(unsigned i, Vector& min, Vector& max) const;
+
+    // Place the mesh at instance i, its vertices read in the world
+    // are then those of the instance
+    void place(unsigned i);
+
+    Object* mesh() const {
+        return mp_mesh;
+    }
+
+    const Instance& instance(unsigned i) const {
+        if (i>=m_instances.size())
+            throw ex::OutOfBounds();
+        return m_instances[i];
+    }
+
+    unsigned size() const {
+        return m_instances.size();
+    }
+
+    unsigned version() const {
+        return m_version;
+    }
+};
+
+#endif
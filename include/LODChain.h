@@ -0,0 +1,84 @@
+#ifndef __LODCHAIN__
+#define __LODCHAIN__
+
+#include <vector>
+#include "Object.h"
+
+// LODChain holds an object and versions of it simplified at load
+// time, each having about half the surfaces of the one before. One of
+// them is picked by the size the object covers on the screen, about
+// one surface for every pixelsPerSurface pixels. Moving to another
+// level waits until the size is past the boundary by the hysteresis
+// ratio, so an object near a boundary doesn't flicker between two.
+//
+// The vertices of the simplified versions are vertices of the base
+// object, when they change they are copied over again. The levels
+// share the base's node, so moving it copies nothing. Changing the
+// base's surfaces needs a new chain.
+class LODChain {
+
+    // m_levels[0] is the base object, the others are owned
+    std::vector<Object*> m_levels;
+    // Base vertex of every vertex of every level
+    std::vector<std::vector<unsigned> > m_vertexOf;
+    // Model version of the base the levels were last copied from
+    unsigned m_baseVersion;
+
+    unsigned m_current;
+    float m_pixelsPerSurface;
+    float m_hysteresis;
+
+    // The finest level fitting an object "size" pixels across
+    unsigned levelFor(float size) const;
+
+    public:
+    // Simplify "base" into at most "levels" more levels, stopping
+    // before one would have less than minSurfaces surfaces
+    LODChain(Object* base, unsigned levels=5, unsigned minSurfaces=16);
+    ~LODChain();
+
+    LODChain(const LODChain&) = delete;
+    LODChain& operator=(const LODChain&) = delete;
+
+    // Copy the base's vertices and render state to the levels if the
+    // base changed
+    void sync();
+
+    // Whether the base itself changed since the levels were last
+    // copied, a move of its node aside
+    bool changed() const {
+        return m_levels[0]->modelVersion()!=m_baseVersion;
+    }
+
+    // The level to draw for an object "size" pixels across
+    Object* select(float size);
+
+    Object* base() const {
+        return m_levels[0];
+    }
+
+    unsigned levelCount() const {
+        return m_levels.size();
+    }
+
+    Object* level(unsigned i) const {
+        if (i>=m_levels.size())
+            throw ex::OutOfBounds();
+        return m_levels[i];
+    }
+
+    // The level picked last
+    unsigned current() const {
+        return m_current;
+    }
+
+    void setPixelsPerSurface(float pixels) {
+        m_pixelsPerSurface = pixels;
+    }
+
+    void setHysteresis(float ratio) {
+        m_hysteresis = ratio;
+    }
+};
+
+#endif
@@ -1,6 +1,8 @@
 #ifndef __MATERIAL__
 #define __MATERIAL__
+#include <memory>
 #include "Coeffecient.h"
+#include "Texture.h"
 
 struct Material {
     // ambient-reflection coefficient
@@ -11,20 +13,39 @@ struct Material {
     Coeffecient ks;
     // specular-reflection parameter (smaller values for dull surfaces)
     float ns;
+    // opacity, 1 for opaque surfaces and 0 for invisible ones
+    float opacity;
+    // multiplies the lit color of textured surfaces, may be NULL
+    std::shared_ptr<const Texture> texture;
 
-    Material(const Coeffecient& a, const Coeffecient& d, const Coeffecient& s,float n):
+    Material(const Coeffecient& a, const Coeffecient& d, const Coeffecient& s,float n,
+            float o=1):
         ka(a),
         kd(d),
         ks(s),
-        ns(n)
+        ns(n),
+        opacity(o)
     {
     }
 
+    bool operator==(const Material& m) const {
+        return ka.b==m.ka.b && ka.g==m.ka.g && ka.r==m.ka.r &&
+            kd.b==m.kd.b && kd.g==m.kd.g && kd.r==m.kd.r &&
+            ks.b==m.ks.b && ks.g==m.ks.g && ks.r==m.ks.r &&
+            ns==m.ns && opacity==m.opacity && texture==m.texture;
+    }
+
+    // Whether surfaces of this material let light through
+    bool translucent() const {
+        return opacity < 1;
+    }
+
     void print(){
         ka.print();
         kd.print();
         ks.print();
         std::cout << ns << std::endl;
+        std::cout << opacity << std::endl;
     }
 
 };
@@ -0,0 +1,75 @@
+#ifndef __MESHOPTIMIZER__
+#define __MESHOPTIMIZER__
+
+#include <vector>
+#include "Object.h"
+
+// MeshOptimizer rearranges a loaded object for the caches of the
+// vertex and raster stages, in place:
+//  - equal vertices, vertex normals and texture co-ordinates are
+//    welded into one,
+//  - surfaces with two corners on one vertex, or of no area, are
+//    dropped,
+//  - the surfaces are reordered so that consecutive ones share
+//    vertices (Forsyth's linear-speed vertex cache optimisation),
+//    each material's surfaces staying together,
+//  - the vertices, normals and texture co-ordinates are renumbered
+//    in the order the surfaces first use them, those used by nothing
+//    are dropped.
+// It changes vertex numbers, so it is run right after loading, before
+// anything that refers to them (LODChain, Meshlets, StaticBatch) is
+// built from the object.
+class MeshOptimizer {
+
+    unsigned m_welded, m_weldedNormals;
+    unsigned m_degenerate, m_unused;
+    float m_acmrBefore, m_acmrAfter;
+
+    // Map every vertex of "m" to the first one equal to it, returns
+    // the number that were equal to an earlier one
+    static unsigned weld(const Matrix<float>& m,
+            std::vector<unsigned>& remap);
+
+    // The order to draw "surfaces" in
+    static std::vector<unsigned> order(
+            const std::vector<Surface>& surfaces, unsigned vertices);
+
+    public:
+    // Entries of the vertex cache the surfaces are ordered for
+    const static unsigned cacheSize = 32;
+
+    MeshOptimizer(Object* obj);
+
+    // Vertices missing from a FIFO cache of "cache" entries per
+    // surface drawn, 3 being the worst and 0.5 the best possible
+    static float acmr(const std::vector<Surface>& surfaces,
+            unsigned vertices, unsigned cache=16);
+
+    unsigned weldedCount() const {
+        return m_welded;
+    }
+
+    unsigned weldedNormalCount() const {
+        return m_weldedNormals;
+    }
+
+    // Surfaces dropped
+    unsigned degenerateCount() const {
+        return m_degenerate;
+    }
+
+    // Vertices dropped for being used by no surface or edge
+    unsigned unusedCount() const {
+        return m_unused;
+    }
+
+    // acmr() of the surfaces as loaded and as reordered
+    float acmrBefore() const {
+        return m_acmrBefore;
+    }
+    float acmrAfter() const {
+        return m_acmrAfter;
+    }
+};
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef __MESHLETS__
+#define __MESHLETS__
+
+#include <vector>
+#include "Object.h"
+#include "Frustum.h"
+
+// Meshlets splits the surfaces of an object at load time into
+// clusters of neighbouring surfaces facing about the same way. Every
+// cluster has a bounding sphere and a cone holding the normals of its
+// surfaces, so a cluster out of view or turned away from the eye is
+// dropped with one test, before its vertices are transformed.
+//
+// Clusters are in model co-ordinates and follow the object's node.
+// The cones assume the node doesn't scale unevenly. Changing the
+// object's surfaces needs new meshlets.
+class Meshlets {
+
+    public:
+    struct Cluster {
+        // Ranges of m_surfaces and m_vertices
+        unsigned firstSurface, surfaceCount;
+        unsigned firstVertex, vertexCount;
+        // Bounding sphere
+        Vector center;
+        float radius;
+        // The surfaces all face away from an eye at e when
+        // (center-e)%axis >= cutoff*|center-e| + radius, a cutoff
+        // over 1 never culls
+        Vector axis;
+        float cutoff;
+    };
+
+    private:
+    Object* mp_object;
+    std::vector<Cluster> m_clusters;
+    // Surfaces and vertices used, cluster by cluster
+    std::vector<unsigned> m_surfaces;
+    std::vector<unsigned> m_vertices;
+
+    // Fill in the sphere and the cone of cluster c
+    void bound(Cluster& c, const std::vector<Vector>& normals);
+
+    public:
+    // Clusters have at most maxSurfaces surfaces, a surface joins a
+    // cluster while its normal is within maxAngle degrees of the
+    // cluster's first surface
+    Meshlets(Object* obj, unsigned maxSurfaces=96, float maxAngle=45);
+
+    Object* object() const {
+        return mp_object;
+    }
+
+    unsigned size() const {
+        return m_clusters.size();
+    }
+
+    const Cluster& cluster(unsigned c) const {
+        return m_clusters[c];
+    }
+
+    // Whether the object's surfaces are still the ones split
+    bool valid() const {
+        return m_surfaces.size()==mp_object->surfaceCount();
+    }
+
+    // The surfaces, in the object's order, and the vertices of the
+    // clusters inside the frustum and, when "backface", facing "eye".
+    // Returns the clusters culled.
+    unsigned cull(const Frustum& frustum, const Vector& eye,
+            bool backface, std::vector<unsigned>& surfaces,
+            std::vector<unsigned>& vertices) const;
+};
+
+#endif
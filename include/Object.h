@@ -2,6 +2,7 @@
 #define __SURFACE__
 
 #include <vector>
+#include <map>
 #include <fstream>
 #include <sstream>
 #include <iostream>
@@ -9,6 +10,9 @@
 #include "ScreenPoint.h"
 #include "PointLight.h"
 #include "Material.h"
+#include "SceneNode.h"
+#include "ProjectedVertices.h"
+#include "FacingSurfaces.h"
 #include "mathematics/Matrix.h"
 #include "mathematics/Vector.h"
 
@@ -26,29 +30,41 @@ struct Edge :public Pair<unsigned> {
 
 // A surface contains 3 index points
 struct Surface : public Triplet<unsigned> {
-    // For backface detection
-    bool visible;
     // If it contains vertex normals
     bool vertexNormals;
 
     // These are vertex normal indices
     unsigned nx,ny,nz;
 
+    // Index of the surface's material in its object
+    unsigned material;
+
+    // If it has texture co-ordinates, and their indices
+    bool textured;
+    unsigned tx,ty,tz;
+
     // Constructor
     Surface(unsigned xx, unsigned yy, unsigned zz)
-        : Triplet<unsigned>(xx,yy,zz),
-        visible(true), vertexNormals(false)
+        : Triplet<unsigned>(xx,yy,zz), vertexNormals(false),
+        material(0), textured(false)
     {}
 
     // Constructor with vertex normal indices
     Surface(unsigned xx, unsigned yy, unsigned zz, unsigned nxx,
             unsigned nyy, unsigned nzz)
-        : Triplet<unsigned>(xx,yy,zz), nx(nxx), ny(nyy), nz(nzz),
-        visible(true), vertexNormals(true) {}
+        : Triplet<unsigned>(xx,yy,zz), vertexNormals(true), nx(nxx),
+        ny(nyy), nz(nzz), material(0), textured(false) {}
 
     // like color, luminosity, texture
 };
 
+// A box and a sphere bounding the vertices of an object
+struct Bounds {
+    Vector min, max;
+    Vector center;
+    float radius;
+};
+
 // Work on progress
 // An Object is collection of Vertices, Edges and Surfaces
 class Object {
@@ -62,6 +78,9 @@ class Object {
         Matrix<float> m_copy_vertex;
         // TODO no idea what to do here
         Matrix<float> m_vertex_normal;
+        // Texture co-ordinates, u and v in the two rows, v from the
+        // top of the image down
+        Matrix<float> m_texcoord;
 
         // A vector of pair of indexes to represent edges
         std::vector<Edge> m_edge;
@@ -69,8 +88,10 @@ class Object {
         // surfaces (triangles)
         std::vector<Surface> m_surface;
 
-        // Defines the color and surface properties
-        Material m_material;
+        // Defines the color and surface properties, every surface
+        // names one of them. The first is the object's own, it also
+        // decides whether the object is drawn as translucent.
+        std::vector<Material> m_materials;
 
         // The type of shading
         Shading m_shading;
@@ -81,21 +102,60 @@ class Object {
         // Whether the object's surfaces need to be shaded both sides
         bool m_bothsides;
 
+        // Whether the object never moves, renderers may cache it
+        bool m_static;
+
+        // Places the model co-ordinates of the vertices in the
+        // world, NULL when they are world co-ordinates already
+        SceneNode* mp_node;
+
+        // Vertices and vertex normals drawn in place of the object's
+        // own, in model co-ordinates, NULL for none
+        const Matrix<float>* mp_deformed;
+        const Matrix<float>* mp_deformedNormals;
+
+        // The vertices as the Shader last projected them
+        ProjectedVertices m_projected;
+        // The surfaces facing the camera in that projection
+        FacingSurfaces m_facing;
+
         // Store color information for lighting
         Color* m_colors;
 
         int m_colors_count;
 
+        // Incremented on every change to the geometry, material or
+        // render state so that renderers can tell what changed
+        unsigned m_version;
+
+        // Bounds of the vertices in model co-ordinates, and the
+        // version of the object itself they were taken at
+        mutable Bounds m_modelBounds;
+        mutable unsigned m_modelBoundsVersion;
+        // The same placed in the world by the node, and the version
+        // they were placed at
+        mutable Bounds m_bounds;
+        mutable unsigned m_boundsVersion;
+
+        // Recompute the model bounds from the vertices
+        void computeBounds() const;
+        // Take the model bounds to the world
+        void placeBounds() const;
+
         // Reset and initialize the value of copy_vertex
         void resetCopy();
 
         // TODO load normals not calculate
         // void initNormal();
 
-        // Tesselate a polygon to triangles
-        std::vector<Pair<Triplet<unsigned> > > tesselate(
-                std::vector<unsigned> faceV, std::vector<unsigned>
-                faceVn = std::vector<unsigned>());
+        // Append the materials of an .mtl file, by name. A missing
+        // file only gives a warning.
+        void loadMaterials(const std::string& filename,
+                std::map<std::string,unsigned>& ids);
+
+        // Tesselate a polygon of "corners" corners to triangles, as
+        // positions among its corners
+        std::vector<Triplet<unsigned> > tesselate(unsigned corners);
 
     public:
 
@@ -131,38 +191,127 @@ class Object {
 
         // Return the material of the object
         const Material& material() const;
+        void setMaterial(const Material& m);
+
+        // Materials of the surfaces, 0 being the object's
+        const Material& material(unsigned id) const;
+        unsigned materialCount() const;
+        const std::vector<Material>& materials() const;
+        void setMaterials(const std::vector<Material>& m);
+        // Returns the id of the material added
+        unsigned addMaterial(const Material& m);
+
+        // Order the surfaces by material, keeping the order within
+        // each, so that the Shader meets every material in one run
+        void sortByMaterial();
+
+        // Changes whenever the object is modified
+        unsigned version() const;
+        // Changes whenever the object itself is modified, but not
+        // when its node moves
+        unsigned modelVersion() const {
+            return m_version;
+        }
+
+        // Bounds of the vertices, up to date with the last change.
+        // Moving the node only takes the model bounds to the world.
+        const Bounds& bounds() const;
+        // The same in model co-ordinates
+        const Bounds& modelBounds() const;
+
+        // Attach the object to a node of the scene graph, NULL for
+        // none
+        void setNode(SceneNode* node);
+        SceneNode* node() const;
+
+        // From model to world co-ordinates
+        const Matrix<float>& model() const;
+
+        // The vertices drawn, in model co-ordinates
+        const Matrix<float>& modelVertices() const {
+            return mp_deformed ? *mp_deformed : m_vertex;
+        }
+
+        // Draw "vertices", and "normals" when not NULL, in place of
+        // the object's own, which stay as they are. Both are in model
+        // co-ordinates with a column for every vertex. Call again
+        // whenever they change, NULL to draw the object's own again.
+        void setDeformation(const Matrix<float>* vertices,
+                const Matrix<float>* normals=NULL);
+        bool deformed() const {
+            return mp_deformed!=NULL;
+        }
+
+        // The object's own vertices and vertex normals, in model
+        // co-ordinates, deformed or not
+        const Matrix<float>& baseVertices() const {
+            return m_vertex;
+        }
+        const Matrix<float>& baseNormals() const {
+            return m_vertex_normal;
+        }
 
-        // Retuns matrix
+        // Output of the Shader's vertex stage
+        ProjectedVertices& projected() {
+            return m_projected;
+        }
+        const ProjectedVertices& projected() const {
+            return m_projected;
+        }
+        FacingSurfaces& facing() {
+            return m_facing;
+        }
+        const FacingSurfaces& facing() const {
+            return m_facing;
+        }
+
+        // Retuns matrix, vertices are in model co-ordinates
         Matrix<float>& vmatrix() ;
         Matrix<float>& vcmatrix() ;
         Matrix<float>& vnmatrix() ;
+        Matrix<float>& vtmatrix() ;
 
         // Get total counts
         unsigned vertexCount() const ;
         unsigned vertexNormalCount() const;
+        unsigned texcoordCount() const;
         unsigned edgeCount() const ;
         unsigned surfaceCount() const ;
 
         // setVertex overwrites, others append
         void setVertex(unsigned point,const Vector& p);
         void setVertexNormal(unsigned point,const Vector& p);
+        void setTexcoord(unsigned point, float u, float v);
         void setEdge(const Pair<unsigned>& p) ;
         //void setSurface(const Triplet<unsigned>& p) ;
         void setSurface(const Surface& p) ;
+        // Replace all the surfaces
+        void setSurfaces(const std::vector<Surface>& surfaces);
 
         // Get Edge
         Edge& getEdge(unsigned point) ;
 
         // Get Surface
         Surface& getSurface(unsigned point) ;
+        const std::vector<Surface>& surfaces() const {
+            return m_surface;
+        }
 
-        // Get Vertex
+        // Get Vertex, in world co-ordinates
         Vector getVertex(unsigned point) const ;
+        // Get Vertex, in model co-ordinates, as set rather than as
+        // deformed
+        Vector getModelVertex(unsigned point) const ;
         Vector getCopyVertex(unsigned point) const ;
         Vector getDistortedVertex(unsigned point) const ;
 
-        // Get Normal
+        // Get Normal, vertex normals are in model co-ordinates
         Vector getVertexNormal(unsigned i) const ;
+        Pair<float> getTexcoord(unsigned i) const ;
+
+        // What surface i samples as last projected, false when it
+        // has no texture
+        bool textureCorners(unsigned i, TextureCorners& corners) const;
         Vector getSurfaceNormal(unsigned point) ;
         Vector getDistortedSurfaceNormal(unsigned point);
 
@@ -177,6 +326,8 @@ class Object {
         void backface(bool bf);
         bool bothsides() const;
         void bothsides(bool bs);
+        bool isStatic() const;
+        void setStatic(bool st);
 
         // TODO load normals not calculate
         void initNormal();
@@ -188,7 +339,79 @@ inline Object::~Object(){
 }
 
 inline const Material& Object::material() const {
-    return m_material;
+    return m_materials[0];
+}
+
+inline void Object::setMaterial(const Material& m) {
+    m_materials[0] = m;
+    m_version++;
+}
+
+inline const Material& Object::material(unsigned id) const {
+    if (id >= m_materials.size())
+        throw ex::OutOfBounds();
+    return m_materials[id];
+}
+
+inline unsigned Object::materialCount() const {
+    return m_materials.size();
+}
+
+inline const std::vector<Material>& Object::materials() const {
+    return m_materials;
+}
+
+inline void Object::setMaterials(const std::vector<Material>& m) {
+    if (m.empty())
+        throw ex::OutOfBounds();
+    m_materials = m;
+    m_version++;
+}
+
+inline unsigned Object::addMaterial(const Material& m) {
+    m_materials.push_back(m);
+    m_version++;
+    return m_materials.size()-1;
+}
+
+inline unsigned Object::version() const {
+    return mp_node ? m_version+mp_node->version() : m_version;
+}
+
+inline const Bounds& Object::modelBounds() const {
+    // vmatrix() hands out the vertices for modification, the bounds
+    // are taken again on the next call after it
+    if (m_modelBoundsVersion != m_version)
+        computeBounds();
+    return m_modelBounds;
+}
+
+inline const Bounds& Object::bounds() const {
+    if (!mp_node)
+        return modelBounds();
+    modelBounds();
+    if (m_boundsVersion != version())
+        placeBounds();
+    return m_bounds;
+}
+
+inline void Object::setNode(SceneNode* node) {
+    if (node == mp_node)
+        return;
+    // Keep version() from repeating a value it had with the old node
+    if (mp_node)
+        m_version += mp_node->version();
+    m_version++;
+    mp_node = node;
+}
+
+inline SceneNode* Object::node() const {
+    return mp_node;
+}
+
+inline const Matrix<float>& Object::model() const {
+    static const Matrix<float> identity = TfMatrix::identity();
+    return mp_node ? mp_node->world() : identity;
 }
 
 inline unsigned Object::vertexCount() const {
@@ -199,6 +422,10 @@ inline unsigned Object::vertexNormalCount() const {
     return m_vertex_normal.col();
 }
 
+inline unsigned Object::texcoordCount() const {
+    return m_texcoord.col();
+}
+
 inline unsigned Object::edgeCount() const {
     return m_edge.size();
 }
@@ -208,6 +435,8 @@ inline unsigned Object::surfaceCount() const {
 }
 
 inline Matrix<float>& Object::vmatrix() {
+    // The caller may modify the vertices through the reference
+    m_version++;
     return m_vertex;
 }
 
@@ -215,6 +444,10 @@ inline Matrix<float>& Object::vnmatrix() {
     return m_vertex_normal;
 }
 
+inline Matrix<float>& Object::vtmatrix() {
+    return m_texcoord;
+}
+
 inline Matrix<float>& Object::vcmatrix() {
     // Don't call this function time and again
     // instead use a reference to store it
@@ -223,7 +456,17 @@ inline Matrix<float>& Object::vcmatrix() {
 }
 
 inline void Object::resetCopy() {
-    m_copy_vertex = m_vertex;
+    m_copy_vertex = modelVertices();
+}
+
+inline void Object::setDeformation(const Matrix<float>* vertices,
+        const Matrix<float>* normals) {
+    if ((vertices && vertices->col()!=vertexCount()) ||
+            (normals && normals->col()!=vertexNormalCount()))
+        throw ex::DimensionMismatch();
+    mp_deformed = vertices;
+    mp_deformedNormals = vertices ? normals : NULL;
+    m_version++;
 }
 
 void inline Object::setVertex(unsigned point,const Vector& p){
@@ -233,6 +476,7 @@ void inline Object::setVertex(unsigned point,const Vector& p){
     m_vertex(1,point) = p.y;
     m_vertex(2,point) = p.z;
     m_vertex(3,point) = p.w;
+    m_version++;
 }
 
 void inline Object::setVertexNormal(unsigned point,const Vector& p){
@@ -246,6 +490,13 @@ void inline Object::setVertexNormal(unsigned point,const Vector& p){
     m_vertex_normal(3,point) = p.w;
 }
 
+void inline Object::setTexcoord(unsigned point, float u, float v) {
+    if(point >= texcoordCount())
+        throw ex::OutOfBounds();
+    m_texcoord(0,point) = u;
+    m_texcoord(1,point) = v;
+}
+
 inline void Object::setEdge(const Pair<unsigned>& p) {
     if(p.x >= vertexCount() || p.y >= vertexCount())
         throw ex::OutOfBounds();
@@ -254,13 +505,48 @@ inline void Object::setEdge(const Pair<unsigned>& p) {
 }
 
 inline void Object::setSurface(const Surface& p) {
-    if(p.x>=vertexCount()||p.y>=vertexCount()||p.z>=vertexCount())
+    if(p.x>=vertexCount()||p.y>=vertexCount()||p.z>=vertexCount()||
+            p.material>=materialCount())
+        throw ex::OutOfBounds();
+    if(p.textured && (p.tx>=texcoordCount()||p.ty>=texcoordCount()||
+                p.tz>=texcoordCount()))
         throw ex::OutOfBounds();
 
     m_surface.push_back(p);
+    m_version++;
+}
+
+inline void Object::setSurfaces(const std::vector<Surface>& surfaces) {
+    for (unsigned i=0; i<surfaces.size(); i++) {
+        const Surface& p = surfaces[i];
+        if(p.x>=vertexCount()||p.y>=vertexCount()||p.z>=vertexCount()||
+                p.material>=materialCount())
+            throw ex::OutOfBounds();
+        if(p.textured && (p.tx>=texcoordCount()||
+                    p.ty>=texcoordCount()||p.tz>=texcoordCount()))
+            throw ex::OutOfBounds();
+    }
+    m_surface = surfaces;
+    m_version++;
 }
 
 inline Vector Object::getVertex(unsigned point) const {
+    if(point >= vertexCount())
+        throw ex::OutOfBounds();
+    const Matrix<float>& v = modelVertices();
+    if (!mp_node)
+        return Vector(v(0,point),v(1,point),v(2,point),v(3,point));
+    // The vertex alone is placed, moving the node costs nothing until
+    // the vertices are asked for
+    const Matrix<float>& m = mp_node->world();
+    float p[4];
+    for (int r=0; r<4; r++)
+        p[r] = m(r,0)*v(0,point) + m(r,1)*v(1,point) +
+            m(r,2)*v(2,point) + m(r,3)*v(3,point);
+    return Vector(p[0],p[1],p[2],p[3]);
+}
+
+inline Vector Object::getModelVertex(unsigned point) const {
     if(point >= vertexCount())
         throw ex::OutOfBounds();
     return Vector(m_vertex(0,point),
@@ -302,10 +588,32 @@ inline Surface& Object::getSurface(unsigned point) {
 inline Vector Object::getVertexNormal(unsigned i) const {
     if(i >= vertexNormalCount())
         throw ex::OutOfBounds();
-    return Vector(m_vertex_normal(0,i),
-            m_vertex_normal(1,i),
-            m_vertex_normal(2,i),
-            m_vertex_normal(3,i));
+    const Matrix<float>& n = mp_deformedNormals ? *mp_deformedNormals :
+        m_vertex_normal;
+    return Vector(n(0,i), n(1,i), n(2,i), n(3,i));
+}
+
+inline Pair<float> Object::getTexcoord(unsigned i) const {
+    if(i >= texcoordCount())
+        throw ex::OutOfBounds();
+    return Pair<float>(m_texcoord(0,i),m_texcoord(1,i));
+}
+
+inline bool Object::textureCorners(unsigned i,
+        TextureCorners& corners) const {
+    const Surface& s = m_surface[i];
+    corners.texture = m_materials[s.material].texture.get();
+    corners.depthScale = 0;
+    if (!s.textured || !corners.texture)
+        return false;
+    unsigned v[] = {s.x,s.y,s.z};
+    unsigned t[] = {s.tx,s.ty,s.tz};
+    for (int c=0; c<3; c++) {
+        corners.u[c] = m_texcoord(0,t[c]);
+        corners.v[c] = m_texcoord(1,t[c]);
+        corners.q[c] = m_projected.q[v[c]];
+    }
+    return true;
 }
 
 inline Vector Object::getSurfaceNormal(unsigned point) {
@@ -346,6 +654,7 @@ inline Shading Object::getShading() const {
 
 inline void Object::setShading(Shading sh) {
     m_shading = sh;
+    m_version++;
 }
 
 inline bool Object::backface() const {
@@ -354,6 +663,7 @@ inline bool Object::backface() const {
 
 inline void Object::backface(bool bf) {
     m_backface = bf;
+    m_version++;
 }
 
 inline bool Object::bothsides() const {
@@ -362,6 +672,16 @@ inline bool Object::bothsides() const {
 
 inline void Object::bothsides(bool bs) {
     m_bothsides = bs;
+    m_version++;
+}
+
+inline bool Object::isStatic() const {
+    return m_static;
+}
+
+inline void Object::setStatic(bool st) {
+    m_static = st;
+    m_version++;
 }
 
 #endif
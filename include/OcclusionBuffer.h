@@ -0,0 +1,51 @@
+#ifndef __OCCLUSIONBUFFER__
+#define __OCCLUSIONBUFFER__
+
+#include <vector>
+#include "common/helper.h"
+
+// A small depth buffer the large occluders of a frame are drawn into,
+// against which the boxes of other objects are tested before they are
+// shaded. As in the Drawer a larger depth is nearer, 0 is empty.
+//
+// Depths are kept conservative: a pixel holds the farthest depth its
+// triangle reaches within it, and a box is hidden only if every pixel
+// it touches is nearer than the box's nearest point. The loops run
+// along rows of floats so that the compiler vectorizes them.
+class OcclusionBuffer {
+
+    unsigned m_width, m_height;
+    std::vector<float> m_depth;
+
+    public:
+    OcclusionBuffer(unsigned w=256, unsigned h=128) :
+        m_width(w), m_height(h), m_depth(w*h,0) {
+    }
+
+    void clear() {
+        std::fill(m_depth.begin(),m_depth.end(),0.0f);
+    }
+
+    // Draw a triangle, vertices being (x, y, depth) in pixels of the
+    // buffer
+    void rasterize(const float a[3], const float b[3], const float c[3]);
+
+    // Whether the pixels from (x0,y0) to (x1,y1) are all covered by
+    // something nearer than "depth"
+    bool occluded(float x0, float y0, float x1, float y1,
+            float depth) const;
+
+    unsigned width() const {
+        return m_width;
+    }
+
+    unsigned height() const {
+        return m_height;
+    }
+
+    float depth(unsigned x, unsigned y) const {
+        return m_depth[y*m_width+x];
+    }
+};
+
+#endif
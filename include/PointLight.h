@@ -11,6 +11,7 @@
 #include "TfMatrix.h"
 
 class Shader;
+class Object;
 
 struct PointLight {
 
@@ -20,10 +21,13 @@ public:
     double* shadow_buffer;
     Pair<unsigned> dim;
     Matrix<float> shadow_xForm;
+    // The light's camera and projection, without the device transform
+    Matrix<float> shadow_clip;
     double magic;
 
     PointLight(Camera c, Coeffecient in) : cam(c), intensity(in),
-        dim({0,0}), shadow_buffer(NULL), shadow_xForm({1,1})
+        dim({0,0}), shadow_buffer(NULL), shadow_xForm({1,1}),
+        shadow_clip({1,1})
     {}
 
     Coeffecient intensityAt(const Vector& pos) {
@@ -69,6 +73,9 @@ public:
 
     void initShadowBuffer(Pair<unsigned> dim);
     void updateShadowBuffer(Shader* sh, Plotter_* fb);
+    // Draw the surfaces of an object facing the light into the
+    // shadow buffer
+    void shadowObject(Object& obj);
     void shFill(ScreenPoint a, ScreenPoint b, ScreenPoint c);
     void hLineD(int y, int xStart, int dStart, int xEnd, int dEnd);
     int depthAt(int x, int y);
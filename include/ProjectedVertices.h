@@ -0,0 +1,39 @@
+#ifndef __PROJECTEDVERTICES__
+#define __PROJECTEDVERTICES__
+
+#include <vector>
+#include <stdint.h>
+
+// ProjectedVertices holds the vertices of an object after the vertex
+// stage, one array for every component. Each vertex is transformed,
+// divided and rounded once, triangles refer to their corners by index.
+struct ProjectedVertices {
+    // Device co-ordinates and depth as projected
+    std::vector<float> sx, sy, sz;
+    // 1/w before the divide, for perspective correct interpolation
+    std::vector<float> q;
+    // The same rounded, as the rasterizer takes them
+    std::vector<int32_t> x, y, d;
+    // World co-ordinates, for lighting and shadow lookups
+    std::vector<float> wx, wy, wz;
+
+    unsigned size() const {
+        return x.size();
+    }
+
+    // Keeps the memory when shrinking
+    void resize(unsigned count) {
+        sx.resize(count);
+        sy.resize(count);
+        sz.resize(count);
+        q.resize(count);
+        x.resize(count);
+        y.resize(count);
+        d.resize(count);
+        wx.resize(count);
+        wy.resize(count);
+        wz.resize(count);
+    }
+};
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef __RECT__
+#define __RECT__
+
+#include "common/helper.h"
+
+// An axis aligned rectangle of pixels, both corners inclusive.
+// A rectangle with x1<x0 or y1<y0 is empty.
+struct Rect {
+    int x0, y0, x1, y1;
+
+    Rect() : x0(0), y0(0), x1(-1), y1(-1) {
+    }
+
+    Rect(int xa, int ya, int xb, int yb)
+        : x0(xa), y0(ya), x1(xb), y1(yb) {
+    }
+
+    bool empty() const {
+        return x1 < x0 || y1 < y0;
+    }
+
+    int width() const {
+        return empty() ? 0 : x1-x0+1;
+    }
+
+    int height() const {
+        return empty() ? 0 : y1-y0+1;
+    }
+
+    int area() const {
+        return width()*height();
+    }
+
+    // Grow to contain the point (x,y)
+    void include(int x, int y) {
+        if (empty()) {
+            x0 = x1 = x;
+            y0 = y1 = y;
+            return;
+        }
+        x0 = Math::min(x0,x); x1 = Math::max(x1,x);
+        y0 = Math::min(y0,y); y1 = Math::max(y1,y);
+    }
+
+    // Smallest rectangle containing both
+    Rect unite(const Rect& r) const {
+        if (empty()) return r;
+        if (r.empty()) return *this;
+        return Rect(Math::min(x0,r.x0),Math::min(y0,r.y0),
+                Math::max(x1,r.x1),Math::max(y1,r.y1));
+    }
+
+    // Common part of both
+    Rect intersect(const Rect& r) const {
+        return Rect(Math::max(x0,r.x0),Math::max(y0,r.y0),
+                Math::min(x1,r.x1),Math::min(y1,r.y1));
+    }
+
+    bool overlaps(const Rect& r) const {
+        return !intersect(r).empty();
+    }
+};
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef __REPROJECTOR__
+#define __REPROJECTOR__
+
+#include <vector>
+#include <stdint.h>
+
+#include "mathematics/Matrix.h"
+#include "Color.h"
+
+class Drawer;
+
+// The Reprojector reuses the last frame when only the camera moved.
+// Every pixel of the last frame is carried with its depth from the
+// old view to the new one; the pixels nothing landed on are left for
+// the rasterizer to shade. To bound the error of reused pixels (view
+// dependent lighting, resampling) a rotating subset of rows is shaded
+// anew every frame, and after a number of reprojected frames in a row
+// a complete frame is drawn.
+class Reprojector {
+
+    private:
+    // Copy of the last frame
+    std::vector<uint32_t> m_color;
+    std::vector<uint32_t> m_depth;
+    // One byte per pixel, non-zero where the pixel was reused
+    std::vector<uint8_t> m_mask;
+
+    // Frames reprojected in a row
+    unsigned m_reused;
+    // Counts frames for the rotating refresh
+    unsigned m_frame;
+
+    // Shade every refreshPeriod'th row anew, 0 disables
+    unsigned m_refreshPeriod;
+    // Reproject at most this many frames in a row
+    unsigned m_maxReuse;
+
+    public:
+    Reprojector(unsigned refreshPeriod=8, unsigned maxReuse=30);
+
+    // Whether the next frame may be reprojected
+    bool available() const {
+        return m_reused < m_maxReuse;
+    }
+
+    // Note that a complete frame was drawn
+    void invalidate() {
+        m_reused = 0;
+    }
+
+    // Carry the frame on the drawer, drawn with the transformation
+    // "previous", over to "current". Afterwards the drawer holds the
+    // reused pixels and mask() flags them. Returns their count.
+    unsigned reproject(Drawer* drawer, const Matrix<float>& previous,
+            const Matrix<float>& current, Color clearColor);
+
+    // Flags of the reused pixels, row by row
+    const uint8_t* mask() const {
+        return &m_mask[0];
+    }
+
+    unsigned refreshPeriod() const {
+        return m_refreshPeriod;
+    }
+    void refreshPeriod(unsigned period) {
+        m_refreshPeriod = period;
+    }
+    unsigned maxReuse() const {
+        return m_maxReuse;
+    }
+    void maxReuse(unsigned count) {
+        m_maxReuse = count;
+    }
+};
+
+#endif
@@ -3,10 +3,12 @@
 
 #include <SDL2/SDL.h>
 #include <cstring>
+#include <vector>
 
 #include "common/ex.h"
 #include "common/helper.h"
 #include "ScreenPoint.h"
+#include "Rect.h"
 
 // Class SDLPlotter is a plotting and windowing interface used
 // by the rest of the system. It implements a uniform interface
@@ -17,11 +19,27 @@ class SDLPlotter {
     private:
     SDL_Window* window;
     SDL_Surface* screen;
-    unsigned m_width, m_height;     // Screen dimensions
+    unsigned m_width, m_height;     // Render target dimensions
+
+    // The render target. It is the window surface itself unless
+    // rendering at a size different from the window, in which case
+    // it is m_target and update() scales it up to the window.
+    Uint32* m_pixels;
+    unsigned m_pitch;               // Render target pitch in pixels
+    std::vector<Uint32> m_target;
+
+    // Column lookup of the upscale: source column and
+    // 8-bit weight of the next column for every window column
+    std::vector<unsigned> m_colIndex;
+    std::vector<Uint32> m_colWeight;
+
+    // Scale the part of the render target covering the window
+    // pixels x0..x1, y0..y1 up to the window surface
+    void upscale(unsigned x0, unsigned y0, unsigned x1, unsigned y1);
 
     // Get memory location of a particular x,y position in framebuffer
     inline Uint8* getLocation(unsigned x, unsigned y) {
-        return (Uint8*)screen->pixels + y*screen->pitch + x*4;
+        return (Uint8*)(m_pixels + y*m_pitch + x);
     }
 
     public:
@@ -34,7 +52,7 @@ class SDLPlotter {
     inline void plot(unsigned x, unsigned y, Color pt, bool
             composite=false) {
         // Return if values out of range
-        if (!(x<screen->w && y<screen->h))
+        if (!(x<m_width && y<m_height))
             return;
         // If alpha compositing is to be done, calculate
         // new color value.
@@ -46,8 +64,7 @@ class SDLPlotter {
             pt.alpha = 0xff;
         }
         // Write pixel to memory
-        *((Uint32 *)screen->pixels + y*screen->pitch/4 + x) =
-            RGBA(pt);
+        *(m_pixels + y*m_pitch + x) = RGBA(pt);
     }
 
     // Plot a ScreenPoint
@@ -58,11 +75,11 @@ class SDLPlotter {
     // get the Pixel value at the specified x,y position
     // TODO storage format may be machine-dependent
     inline Color getPixel(unsigned x, unsigned y) {
-        Uint32 val = *((Uint32*)screen->pixels+y*screen->pitch/4+x);
+        Uint32 val = *(m_pixels+y*m_pitch+x);
         Color c;
-        c.red = (Uint8)(val&0xff);
+        c.blue = (Uint8)(val&0xff);
         c.green = (Uint8)((val>>8)&0xff);
-        c.blue = (Uint8)((val>>16)&0xff);
+        c.red = (Uint8)((val>>16)&0xff);
         c.alpha = (Uint8)((val>>24)&0xff);
         return c;
     }
@@ -74,28 +91,75 @@ class SDLPlotter {
     }
     // Update the screen
     inline void update() {
+        if (scaled())
+            upscale(0,0,screen->w-1,screen->h-1);
         SDL_UpdateWindowSurface(window);
     }
 
+    // Update only the given rectangle of the render target
+    void update(const Rect& rect);
+
     // Clear scren with black
     inline void clear(Color clearColor = {255,0,255}) {
-        SDL_FillRect(screen, NULL, RGBA(clearColor));
+        if (scaled())
+            std::fill(m_target.begin(),m_target.end(),
+                    RGBA(clearColor));
+        else
+            SDL_FillRect(screen, NULL, RGBA(clearColor));
         //memset(screen->pixels,0xff,m_height*screen->pitch);
     }
 
-    // return screen width
+    // Clear a rectangle of the render target
+    inline void clear(Color clearColor, const Rect& rect) {
+        Rect r = rect.intersect(Rect(0,0,m_width-1,m_height-1));
+        for (int y=r.y0; y<=r.y1; y++)
+            std::fill(m_pixels+y*m_pitch+r.x0,m_pixels+y*m_pitch+r.x1+1,
+                    RGBA(clearColor));
+    }
+
+    // Render at w x h pixels, the result is scaled to the window
+    // on update()
+    void setRenderSize(unsigned w, unsigned h);
+
+    // The pixels of the render target, rows are pitch() apart
+    inline Uint32* pixels() {
+        return m_pixels;
+    }
+
+    // Render target pitch in pixels
+    inline unsigned pitch() const {
+        return m_pitch;
+    }
+
+    // Whether the render target differs from the window surface
+    inline bool scaled() const {
+        return m_pixels != (Uint32*)screen->pixels;
+    }
+
+    // return render target width
     inline unsigned width() const {
         return m_width;
     }
 
-    // return screen height
+    // return render target height
     inline unsigned height() const {
         return m_height;
     }
 
+    // return window width
+    inline unsigned windowWidth() const {
+        return screen->w;
+    }
+
+    // return window height
+    inline unsigned windowHeight() const {
+        return screen->h;
+    }
+
     // return aspect ratio of screen
+    // The window's is used so a scaled target keeps the same view
     inline float aspectRatio() const {
-        return (float)m_width / m_height;
+        return (float)screen->w / screen->h;
     }
 
     bool checkTerm();
@@ -107,14 +171,12 @@ class SDLPlotter {
     void writeCols(Uint32* cBuffer, bool* mask, unsigned y,
             unsigned xStart, unsigned size, bool contiguous) {
         if (contiguous) {
-            uint8_t *addr = ((uint8_t*)screen->pixels)+
-                screen->pitch+xStart*4;
+            uint8_t *addr = getLocation(xStart,y);
             memcpy(addr,(void*)cBuffer,size*4);
         }
         for (int x=0; x<size; x++)
             if (mask[x])
-            *((Uint32 *)screen->pixels+y*screen->pitch/4+x+xStart) =
-                cBuffer[x];
+            *(m_pixels+y*m_pitch+x+xStart) = cBuffer[x];
     }
 };
 
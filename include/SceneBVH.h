@@ -0,0 +1,123 @@
+#ifndef __SCENEBVH__
+#define __SCENEBVH__
+
+#include <vector>
+#include <stdint.h>
+
+#include "BVH.h"
+#include "Frustum.h"
+#include "Object.h"
+
+// Where a ray meets the scene
+struct Hit {
+    // Index of the object and of its surface
+    unsigned object;
+    unsigned surface;
+    // Distance along the ray, in lengths of its direction
+    float t;
+    Vector point;
+};
+
+// SceneBVH keeps a hierarchy over the boxes of the objects of a scene
+// and, for large objects, one over clusters of their triangles. It is
+// brought up to date with update(), which rebuilds what is new and
+// refits what moved.
+class SceneBVH {
+
+    // Objects with more surfaces than this get a hierarchy over
+    // clusters of at most clusterSize triangles
+    const static unsigned clusterThreshold = 512;
+    const static unsigned clusterSize = 64;
+
+    struct Entry {
+        // The object, its version when its box was last taken, and
+        // its model version and surface count when its triangles were
+        Object* object;
+        unsigned version;
+        unsigned modelVersion;
+        unsigned surfaces;
+        // Over the triangles in model co-ordinates, so that moving
+        // the object's node leaves it as it is. Empty for small
+        // objects.
+        BVH triangles;
+        std::vector<Box> boxes;
+
+        Entry() : object(NULL), version(~0u), modelVersion(~0u),
+            surfaces(0), triangles(clusterSize) {
+        }
+    };
+
+    std::vector<Object*> m_objects;
+    std::vector<Entry> m_entries;
+    // Boxes of the objects and the hierarchy over them
+    std::vector<Box> m_boxes;
+    BVH m_top;
+    // Area of the root when the top was built; refitting moving
+    // objects grows it, and past twice that it is built again
+    float m_builtArea;
+
+    // Time the last build and refit took, in micro seconds
+    uintmax_t m_buildTime, m_refitTime;
+
+    // Bring the entry of object k up to date, returns whether it had
+    // to be built rather than refitted
+    bool updateEntry(unsigned k);
+
+    // Nearest hit with surface i of object k of a ray in the object's
+    // model co-ordinates
+    bool traceSurface(unsigned k, unsigned i, const Vector& origin,
+            const Vector& dir, Hit& hit) const;
+
+    public:
+    SceneBVH() : m_builtArea(0), m_buildTime(0), m_refitTime(0) {
+    }
+
+    // Catch up with changes to the objects, cheap when there are none
+    void update(const std::vector<Object*>& objects);
+
+    // Call visit(k) for every object that may be seen
+    template <typename F>
+    void cull(const Frustum& frustum, F visit) const;
+
+    // Whether object k has a hierarchy over its triangles
+    bool clustered(unsigned k) const {
+        return !m_entries[k].triangles.empty();
+    }
+
+    // The surfaces of a clustered object k that may be seen
+    void cullSurfaces(unsigned k, const Frustum& frustum,
+            std::vector<unsigned>& surfaces) const;
+
+    // The same surfaces ordered cluster by cluster, the clusters
+    // nearest to "eye" along the unit direction "dir" first
+    void sortSurfaces(unsigned k, const Frustum& frustum,
+            const Vector& eye, const Vector& dir,
+            std::vector<unsigned>& surfaces) const;
+
+    // Nearest hit along a ray from "origin" in direction "dir"
+    bool trace(const Vector& origin, const Vector& dir, Hit& hit) const;
+
+    uintmax_t buildTime() const {
+        return m_buildTime;
+    }
+
+    uintmax_t refitTime() const {
+        return m_refitTime;
+    }
+};
+
+template <typename F>
+void SceneBVH::cull(const Frustum& frustum, F visit) const {
+    m_top.cull(frustum,[&](unsigned first, unsigned count, bool inside) {
+        for (unsigned i=first; i<first+count; i++) {
+            unsigned k = m_top.item(i);
+            const Bounds& b = m_objects[k]->bounds();
+            // A leaf's box may hold more than this object
+            if (inside || (frustum.sees(b.center,b.radius) &&
+                        frustum.sees(b.min,b.max)))
+                visit(k);
+        }
+    });
+}
+
+#endif
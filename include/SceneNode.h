@@ -0,0 +1,65 @@
+#ifndef __SCENENODE__
+#define __SCENENODE__
+
+#include <vector>
+#include "TfMatrix.h"
+
+// A SceneNode places the objects attached to it in the world. Its
+// local transformation is relative to its parent's. The world
+// transformation is taken again only after it or an ancestor changed,
+// so moving a node costs a 4x4 multiply rather than one over every
+// vertex, and the objects keep their vertices in model co-ordinates.
+class SceneNode {
+
+    SceneNode* mp_parent;
+    std::vector<SceneNode*> m_children;
+
+    Matrix<float> m_local;
+    // Parent's world times local, valid unless dirty
+    mutable Matrix<float> m_world;
+    mutable bool m_dirty;
+
+    // Incremented whenever the world transformation changes
+    unsigned m_version;
+
+    // Mark this node and its descendants as moved
+    void invalidate();
+
+    public:
+    SceneNode(const Matrix<float>& local=TfMatrix::identity());
+    // Children are left at the root, in their local place
+    ~SceneNode();
+
+    SceneNode(const SceneNode&) = delete;
+    SceneNode& operator=(const SceneNode&) = delete;
+
+    // Make "child" a child of this node, moving it from its parent
+    void attach(SceneNode* child);
+
+    // Make this node a root
+    void detach();
+
+    SceneNode* parent() const {
+        return mp_parent;
+    }
+
+    const Matrix<float>& local() const {
+        return m_local;
+    }
+
+    void setLocal(const Matrix<float>& local);
+
+    // Apply "m" after the local transformation, as vmatrix() /= m
+    // does to vertices
+    void transform(const Matrix<float>& m);
+
+    // From model to world co-ordinates
+    const Matrix<float>& world() const;
+
+    // Changes whenever the world transformation does
+    unsigned version() const {
+        return m_version;
+    }
+};
+
+#endif
@@ -7,6 +7,18 @@
 #include "Drawer.h"
 #include "Camera.h"
 #include "Object.h"
+#include "Reprojector.h"
+#include "SceneBVH.h"
+#include "LODChain.h"
+#include "InstanceSet.h"
+#include "Impostor.h"
+#include "CellGraph.h"
+#include "CommandBuffer.h"
+#include "Meshlets.h"
+#include "Terrain.h"
+#include "OcclusionBuffer.h"
+#include "misc/FrameStats.h"
+#include "misc/ResolutionController.h"
 
 /* The class Shader is the primary component of the library.
  * It does the task of creating pixels from memory objects.
@@ -25,6 +37,185 @@ class Shader {
     // The camera to be used for viewing
     Camera m_camera;
 
+    // Counters of the last frame
+    FrameStats m_stats;
+
+    // Scales the render target to meet the frame time budget
+    ResolutionController m_resolution;
+    bool m_dynamicResolution;
+
+    // Resize the render target to the controller's scale
+    void applyRenderScale();
+
+    // What the last frame was drawn from
+    struct LightState {
+        Camera cam;
+        Coeffecient intensity;
+        double magic;
+        bool shadow;
+    };
+    struct ViewState {
+        Camera camera;
+        AmbientLight ambient;
+        std::vector<LightState> lights;
+        std::vector<unsigned> versions;
+        std::vector<Object*> objects;
+        std::vector<unsigned> instanceVersions;
+        unsigned cellsVersion;
+        int width, height;
+    } m_last;
+    bool m_drawn;
+
+    // Screen area covered by every object in the last frame, the
+    // area its shadows may fall in, and the two together
+    std::vector<Rect> m_area;
+    std::vector<Rect> m_shadow;
+    std::vector<Rect> m_footprint;
+    // Objects outside the view volume
+    std::vector<bool> m_culled;
+    // Surfaces of large objects in clusters inside the view volume,
+    // unless all of them are
+    std::vector<std::vector<unsigned> > m_surfaces;
+    std::vector<bool> m_allSurfaces;
+    const std::vector<unsigned>* surfaces(unsigned k) const {
+        return m_allSurfaces[k] ? NULL : &m_surfaces[k];
+    }
+
+    // Clusters of the objects having them, and the vertices of those
+    // in view
+    std::vector<const Meshlets*> m_meshlets;
+    std::vector<std::vector<unsigned> > m_vertices;
+
+    // Hierarchy over the objects and their triangles
+    SceneBVH m_bvh;
+
+    // Levels of detail of the objects having them, m_objects holds
+    // the level in use
+    std::vector<LODChain*> m_lods;
+    // Terrains drawing through objects, their levels are picked with
+    // the objects' and their patches out of view are skipped
+    std::vector<Terrain*> m_terrains;
+    void selectLevels();
+
+    // Pixels across an object's bounding sphere on the screen
+    float screenSize(const Bounds& b) const;
+
+    // Objects hidden behind the large occluders of the frame are
+    // neither transformed, lit nor rasterized
+    bool m_occlusion;
+    bool m_occlusionReuse;
+    float m_occluderSize;
+    OcclusionBuffer m_occlusionBuffer;
+    std::vector<bool> m_occluder;
+    std::vector<bool> m_occluded;
+    // Frames drawn, objects seen are retested in turns
+    unsigned m_frame;
+    const static unsigned occlusionRetest = 8;
+    void drawOccluders();
+    bool occluded(unsigned k, const Matrix<float>& transformation);
+
+    // Objects are drawn nearest first, so that the depth test
+    // rejects what is behind before it is shaded, and the surfaces
+    // of large objects cluster by cluster the same way
+    bool m_sortObjects;
+    bool m_sortClusters;
+    std::vector<unsigned> m_order;
+    void sortObjects();
+
+    // Meshes drawn at many places. Instances are culled and shaded
+    // every frame they are drawn, a change to any redraws everything.
+    std::vector<InstanceSet*> m_instanceSets;
+    bool instancesChanged() const;
+    void drawInstances(bool translucent, const Matrix<float>&
+            transformation, const Frustum& frustum, const Rect& dirty);
+    // Multiply the lit colors of an object by "tint"
+    void tint(Object* obj, Color tint);
+
+    // Impostors of the instance sets having them, and the size on the
+    // screen under which an instance is drawn as its impostor
+    std::vector<Impostor*> m_impostors;
+    std::vector<float> m_impostorSize;
+
+    // Cells and portals the objects are put in, NULL for none
+    CellGraph* mp_cells;
+    // The quad standing in for instance i of set s, whose box is
+    // "min" to "max", false when the instance is drawn as a mesh.
+    // The picture it shows is taken first if it wasn't.
+    bool impostor(unsigned s, unsigned i, const Vector& min,
+            const Vector& max, const Matrix<float>& transformation,
+            CommandBuffer::Command quad[2]);
+
+    // Screen area of a box, false if it reaches behind the camera.
+    // "nearest" is the largest depth of its corners.
+    bool project(const Vector& min, const Vector& max,
+            const Matrix<float>& transformation, Rect& area,
+            float& nearest) const;
+
+    // Frames are recorded into command segments, one for every
+    // object and instance set, and rasterized from them
+    bool m_recording;
+    CommandBuffer m_commands;
+    // Objects prepared in the frame being drawn
+    std::vector<unsigned> m_prepared;
+    // Objects with fewer surfaces prepared are recorded on one thread
+    const static unsigned recordGrain = 4096;
+    void record(const Matrix<float>& transformation,
+            const Frustum& frustum, bool everything);
+    void execute(bool translucent, const Rect& dirty);
+
+    // Whether object k isn't drawn at all
+    bool hidden(unsigned k) const {
+        return m_culled[k] || m_occluded[k];
+    }
+
+    // Perspective projection, and the camera followed by it
+    Matrix<float> projectionMatrix() const;
+    Matrix<float> clipMatrix() const;
+    // Pixels across of a unit length at unit distance
+    float pixelScale() const;
+
+    // Whether the view changed; the camera is left out if asked
+    bool viewChanged(bool ignoreCamera=false) const;
+    // Whether the ambient light or any point light changed
+    bool lightsChanged() const;
+    bool objectsChanged() const;
+    void rememberView();
+
+    // Reuses the last frame when only the camera moves
+    Reprojector m_reprojector;
+    bool m_reprojection;
+    // The transformation the frame on the screen was drawn with
+    Matrix<float> m_lastTransformation;
+
+    // Static opaque objects are drawn once into a saved layer which
+    // later frames start from. The layer holds the shadows moving
+    // objects cast when it was drawn, that area is always redrawn.
+    bool m_staticLayer;
+    bool m_layerValid;
+    Rect m_bakedShadow;
+    std::vector<bool> m_inLayer;
+    bool layered(unsigned k) const {
+        return m_staticLayer && m_objects[k]->isStatic() &&
+            !m_objects[k]->material().translucent();
+    }
+
+    // Transform and light an object, returns its screen area. Only
+    // the listed surfaces are lit if there is a list, and only the
+    // listed vertices, which they must use, are transformed.
+    Rect prepare(Object* obj, const Matrix<float>& transformation,
+            const std::vector<unsigned>* surfaces=NULL,
+            const std::vector<unsigned>* vertices=NULL);
+
+    // Screen area where the shadows of an object may fall
+    Rect shadowArea(Object* obj, const Matrix<float>& transformation,
+            float reach) const;
+
+    // Size of the box bounding all objects
+    float sceneSize() const;
+
+    // Rasterize the surfaces of an object left facing by prepare()
+    void fill(Object* obj);
+
     public:
 
 
@@ -33,15 +224,22 @@ class Shader {
     // Destructor
     ~Shader();
 
-    // Draw a frame
+    // Draw a frame. Only what changed since the last frame is
+    // redrawn, nothing at all if nothing changed.
     void draw();
 
+    // Whether anything that affects the frame changed since the
+    // last draw(): the camera, lights, objects or their materials
+    bool changed() const;
+
     /* Getters and setters */
 
     // Add an Object
     int addObject(Object* obj) {
-        if (obj!=NULL)
+        if (obj!=NULL) {
             m_objects.push_back(obj);
+            m_lods.resize(m_objects.size(),NULL);
+        }
         return m_objects.size()-1;
     }
 
@@ -76,16 +274,123 @@ class Shader {
         return mp_drawer;
     }
 
-    Object* getObjectP(int i) {
+    // Draw the instances of "set", returns its index
+    int addInstances(InstanceSet* set) {
+        if (set!=NULL)
+            m_instanceSets.push_back(set);
+        return m_instanceSets.size()-1;
+    }
+
+    // Draw the instances of set s smaller than "size" pixels across
+    // on the screen as "impostor", made for the set's mesh. NULL
+    // draws them all as meshes.
+    void setImpostor(unsigned s, Impostor* impostor, float size=48);
+
+    // Draw only the objects in cells seen through the portals of
+    // "cells" from the camera's cell, objects in no cell always. NULL
+    // draws every object.
+    void setCells(CellGraph* cells) {
+        mp_cells = cells;
+        m_drawn = false;
+    }
+
+    CellGraph* getCells() const {
+        return mp_cells;
+    }
+
+    InstanceSet* getInstanceSet(unsigned i) {
+        if (i>=m_instanceSets.size())
+            throw ex::OutOfBounds();
+        return m_instanceSets[i];
+    }
+
+    unsigned instanceSetCount() const {
+        return m_instanceSets.size();
+    }
+
+    Object* getObjectP(unsigned i) {
         if (i>=m_objects.size())
             throw ex::OutOfBounds();
         return m_objects[i];
     }
 
-    int objectCount() const {
+    unsigned objectCount() const {
         return m_objects.size();
     }
 
+    // Record every frame into a command buffer before rasterizing
+    // it, objects in parallel. Recorded frames don't use the static
+    // layer.
+    void setRecording(bool enable);
+
+    // Rasterize the last recorded frame again at w x h pixels. The
+    // next draw() goes on at that size.
+    void replay(unsigned w, unsigned h);
+
+    const CommandBuffer& commands() const {
+        return m_commands;
+    }
+
+    // Render at a resolution that keeps draw() within "micros"
+    // micro seconds. Zero disables it and restores the full window
+    // resolution.
+    void setFrameBudget(uintmax_t micros, float minScale=0.5);
+
+    // When only the camera moves, carry the last frame over to the
+    // new view and shade only the pixels that couldn't be reused.
+    // Every refreshPeriod'th row is shaded anew each frame (0 never)
+    // and at most maxReuse frames in a row are reprojected.
+    void setReprojection(bool enable, unsigned refreshPeriod=8,
+            unsigned maxReuse=30);
+
+    // Draw the objects marked static once and start every frame
+    // from a copy of them
+    void setStaticLayer(bool enable) {
+        m_staticLayer = enable;
+        m_layerValid = false;
+    }
+
+    // Draw object k at the level of detail of "chain" fitting its
+    // size on the screen. The chain's base is then the object to
+    // modify; getObjectP(k) returns the level in use.
+    void setLOD(unsigned k, LODChain* chain);
+
+    // Cull object k cluster by cluster with "meshlets", made for it,
+    // NULL for none. Clusters out of view or turned away from the
+    // camera are neither transformed, lit nor rasterized.
+    void setMeshlets(unsigned k, const Meshlets* meshlets);
+
+    // Draw "terrain" as object k, patch by patch at the levels of
+    // detail fitting their distance, NULL for none
+    void setTerrain(unsigned k, Terrain* terrain);
+
+    // Test objects against a small depth buffer of the occluders,
+    // objects whose bounding sphere is at least occluderSize of the
+    // screen's height across, before shading them. With reuseVisible
+    // objects seen in the last frame are tested only every few
+    // frames.
+    void setOcclusion(bool enable, bool reuseVisible=false,
+            float occluderSize=0.25);
+
+    // Draw objects front to back by their depth from the camera, and
+    // with "clusters" the triangle clusters of large objects too
+    void setDepthSort(bool objects, bool clusters=false);
+
+    // Objects that may cast shadows seen by a light's frustum
+    void shadowCasters(const Frustum& frustum,
+            std::vector<unsigned>& casters);
+
+    // Nearest surface hit by a ray from "origin" along "dir"
+    bool trace(const Vector& origin, const Vector& dir, Hit& hit);
+
+    // The surface seen at pixel (x,y) of the render target
+    bool pick(int x, int y, Hit& hit);
+
+    // Get the counters of the last frame
+    const FrameStats& stats() const {
+        return m_stats;
+    }
+
     inline Matrix<float>& shadowMat() const {
         return m_pointLights[0]->shadow_xForm;
     }
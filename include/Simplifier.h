@@ -0,0 +1,115 @@
+#ifndef __SIMPLIFIER__
+#define __SIMPLIFIER__
+
+#include <vector>
+#include "Object.h"
+
+// A symmetric 4x4 matrix, the sum of squared distances to a set of
+// planes: for a point v its error is v' Q v. Only the upper triangle
+// is kept.
+struct Quadric {
+    double a[10];
+
+    Quadric() {
+        for (int i=0; i<10; i++)
+            a[i] = 0;
+    }
+
+    // The quadric of the plane px+qy+rz+s = 0, scaled by "weight"
+    Quadric(double p, double q, double r, double s, double weight) {
+        a[0] = p*p; a[1] = p*q; a[2] = p*r; a[3] = p*s;
+        a[4] = q*q; a[5] = q*r; a[6] = q*s;
+        a[7] = r*r; a[8] = r*s;
+        a[9] = s*s;
+        for (int i=0; i<10; i++)
+            a[i] *= weight;
+    }
+
+    void operator+=(const Quadric& q) {
+        for (int i=0; i<10; i++)
+            a[i] += q.a[i];
+    }
+
+    // Squared distance error of point (x,y,z)
+    double error(double x, double y, double z) const {
+        return a[0]*x*x + 2*a[1]*x*y + 2*a[2]*x*z + 2*a[3]*x
+            + a[4]*y*y + 2*a[5]*y*z + 2*a[6]*y
+            + a[7]*z*z + 2*a[8]*z
+            + a[9];
+    }
+};
+
+// Simplifier reduces the surfaces of an object by collapsing edges,
+// cheapest first by the quadric error metric (Garland and Heckbert).
+// An edge collapses onto one of its ends, so every vertex of a
+// simplified object is a vertex of the original; vertexOf() maps
+// them back, which lets a simplified object follow the original when
+// it moves. Collapses that would flip a surface are refused and the
+// borders of open meshes are held in place by extra planes.
+class Simplifier {
+
+    Object* mp_source;
+
+    // Quadric of every vertex
+    std::vector<Quadric> m_quadric;
+    // Surfaces around every vertex, dead ones are skipped lazily
+    std::vector<std::vector<unsigned> > m_around;
+    // The surfaces, as vertex indices of the source
+    std::vector<Triplet<unsigned> > m_surface;
+    // The texture co-ordinate indices of their corners, a corner
+    // taking that of the vertex it collapses onto
+    std::vector<Triplet<unsigned> > m_texture;
+    std::vector<bool> m_alive;
+    unsigned m_aliveCount;
+    // Where a vertex went, itself while it hasn't collapsed
+    std::vector<unsigned> m_target;
+    // Bumped whenever a vertex's neighbourhood changes, candidates
+    // taken before that are stale
+    std::vector<unsigned> m_stamp;
+
+    // The vertex v has collapsed into by now
+    unsigned find(unsigned v);
+
+    // Cost of collapsing u onto v
+    double cost(unsigned u, unsigned v) const;
+
+    // Whether moving u onto v turns a surface of u over or makes
+    // it degenerate
+    bool flips(unsigned u, unsigned v);
+
+    // Queue the collapses of the edges around v
+    void queueAround(unsigned v);
+
+    // The texture co-ordinate index of surface f's corner at vertex w
+    unsigned& texture(unsigned f, unsigned w);
+
+    struct Candidate {
+        double cost;
+        unsigned u, v;
+        unsigned stampU, stampV;
+        bool operator<(const Candidate& c) const {
+            // The smallest cost is on top of std::priority_queue
+            return cost > c.cost;
+        }
+    };
+    std::vector<Candidate> m_heap;
+
+    public:
+    // Start from all the surfaces of "source"
+    Simplifier(Object* source);
+
+    // Collapse edges until at most "surfaces" are left, or no edge can
+    // be collapsed. Returns the number left.
+    unsigned simplify(unsigned surfaces);
+
+    // The surfaces left, as a new object sharing the source's material
+    // and render state. vertexOf(i) is the source's vertex of its i'th
+    // vertex. The caller owns the object.
+    Object* object(std::vector<unsigned>& vertexOf) const;
+
+    unsigned surfaceCount() const {
+        return m_aliveCount;
+    }
+};
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef __STATICBATCH__
+#define __STATICBATCH__
+
+#include <vector>
+#include "Object.h"
+
+// StaticBatch merges static objects at load time. Objects sharing a
+// material, shading and face culling whose centres fall in the same
+// cube of chunkSize become one object, so the Shader pays the per
+// object costs once a chunk while culling still works on the chunks.
+// The merged vertices are in world co-ordinates and keep their vertex
+// normals.
+//
+// Objects drawn through a LODChain, or that may move, should not be
+// given. The batches are owned by the StaticBatch.
+class StaticBatch {
+
+    // The objects to draw in place of those given
+    std::vector<Object*> m_objects;
+    // The merged objects, owned
+    std::vector<Object*> m_batches;
+    unsigned m_merged;
+
+    // Merge "sources" into one object
+    static Object* merge(const std::vector<Object*>& sources);
+
+    public:
+    StaticBatch(const std::vector<Object*>& objects, float chunkSize=16);
+    ~StaticBatch();
+
+    StaticBatch(const StaticBatch&) = delete;
+    StaticBatch& operator=(const StaticBatch&) = delete;
+
+    // Objects left as they were in their order, then the batches
+    const std::vector<Object*>& objects() const {
+        return m_objects;
+    }
+
+    unsigned batchCount() const {
+        return m_batches.size();
+    }
+
+    // Objects merged into the batches
+    unsigned mergedCount() const {
+        return m_merged;
+    }
+};
+
+#endif
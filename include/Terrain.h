@@ -0,0 +1,109 @@
+#ifndef __TERRAIN__
+#define __TERRAIN__
+
+#include <vector>
+#include "Object.h"
+#include "Frustum.h"
+
+// Terrain is ground made from a grid of heights, "width" of them
+// along x and "depth" along z, "spacing" apart from "origin". The
+// grid is split in square patches of patchSize x patchSize cells and
+// every patch is drawn at one of its levels of detail, level l
+// keeping every 2^l-th row and column (geomipmapping). A patch takes
+// the coarsest level whose height error, seen from the eye, is within
+// a tolerance of pixels.
+//
+// The terrain draws through an Object of its own holding every grid
+// vertex. Its surfaces are those of every patch at its level, made
+// again from the grid and the levels whenever the levels change, so
+// that filling, shadows and tracing take the terrain as any other
+// object. Where neighbouring patches are at different levels, the
+// edge they share is cut at the coarser of the two, so the patches
+// meet without cracks. Vertex normals are taken once, from the
+// heights around every vertex.
+//
+// The terrain is in world co-ordinates, its object takes no node.
+// The width and depth less one must be multiples of patchSize, which
+// is a power of two.
+class Terrain {
+
+    struct Patch {
+        // Box bounding the patch
+        Vector min, max;
+        // Height error of every level, never less than the finer one's
+        std::vector<float> error;
+        unsigned level;
+        // The surfaces made for the patch
+        unsigned firstSurface, surfaceCount;
+    };
+
+    Object m_object;
+    unsigned m_width, m_depth;
+    unsigned m_patchSize;
+    unsigned m_patchesX, m_patchesZ;
+    unsigned m_levels;
+    float m_tolerance;
+    std::vector<Patch> m_patches;
+
+    unsigned vertex(unsigned x, unsigned z) const {
+        return z*m_width + x;
+    }
+
+    // Vertex normals from central differences of the heights
+    void computeNormals(const std::vector<float>& heights, float spacing);
+
+    // Height error of every level of patch p
+    void measure(Patch& p, unsigned x0, unsigned z0,
+            const std::vector<float>& heights);
+
+    // Append the surfaces of patch p at its level to "surfaces"
+    void triangulate(unsigned p, std::vector<Surface>& surfaces) const;
+
+    // Make the surfaces of every patch again
+    void build();
+
+    public:
+    Terrain(const std::vector<float>& heights, unsigned width,
+            unsigned depth, float spacing, const Vector& origin,
+            const Material& m, Shading sh=Shading::gouraud,
+            unsigned patchSize=16);
+
+    Terrain(const Terrain&) = delete;
+    Terrain& operator=(const Terrain&) = delete;
+
+    Object* object() {
+        return &m_object;
+    }
+
+    // Pick the level of every patch for "eye", "scale" being the
+    // pixels across of a unit length at unit distance. Returns whether
+    // any changed, the surfaces are made again then.
+    bool select(const Vector& eye, float scale);
+
+    // The surfaces and the vertices of the patches inside the
+    // frustum. Returns the patches culled.
+    unsigned cull(const Frustum& frustum, std::vector<unsigned>& surfaces,
+            std::vector<unsigned>& vertices) const;
+
+    // Height error, in pixels, allowed to a coarser level
+    void setTolerance(float pixels) {
+        m_tolerance = pixels;
+    }
+
+    unsigned patchCount() const {
+        return m_patches.size();
+    }
+
+    unsigned levelCount() const {
+        return m_levels;
+    }
+
+    // The level patch p is drawn at
+    unsigned level(unsigned p) const {
+        if (p>=m_patches.size())
+            throw ex::OutOfBounds();
+        return m_patches[p].level;
+    }
+};
+
+#endif
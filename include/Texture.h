@@ -0,0 +1,113 @@
+#ifndef __TEXTURE__
+#define __TEXTURE__
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+#include <stddef.h>
+#include "Color.h"
+
+// A Texture is an image with its chain of mipmaps, each level half the
+// size of the one before down to 1x1. Sizes are powers of two, images
+// of other sizes are resampled up to the next one when loaded.
+//
+// The texels of every level are stored in Morton order: the bits of x
+// and y interleaved, so that texels near each other on the image are
+// near each other in memory whichever way a triangle walks across it.
+// Co-ordinates wrap around, u and v run from 0 to 1 over the image, v
+// from the top row down.
+//
+// Texels may be empty, of alpha 0, and may carry a depth: how far in
+// front of the textured surface they stand, from -1 to 1. Levels
+// average the texels that aren't empty.
+class Texture {
+
+    public:
+    // Points sampled by one call of sample()
+    const static unsigned lanes = 4;
+
+    private:
+    std::vector<Color> m_texels;
+    // Where every level starts in m_texels, and its size as powers of
+    // two
+    std::vector<unsigned> m_offset;
+    std::vector<unsigned> m_widthBits, m_heightBits;
+    // Depths of the texels in steps of 1/127, in the order of
+    // m_texels, empty without depths
+    std::vector<int8_t> m_depth;
+
+    // Build the levels from the row major texels and depths of level 0
+    void build(unsigned width, unsigned height,
+            const std::vector<Color>& texels,
+            const std::vector<float>& depth=std::vector<float>());
+
+    public:
+    // Load a binary .ppm (P6) image
+    Texture(const std::string& filename);
+    // From "width" by "height" row major texels, and their depths if
+    // given
+    Texture(unsigned width, unsigned height, const Color* texels,
+            const float* depth=NULL);
+
+    unsigned width() const {
+        return 1u<<m_widthBits[0];
+    }
+    unsigned height() const {
+        return 1u<<m_heightBits[0];
+    }
+    unsigned levels() const {
+        return m_offset.size();
+    }
+    bool hasDepth() const {
+        return !m_depth.empty();
+    }
+
+    // Position of texel (x,y) of a level of 2^wb by 2^hb in Morton
+    // order. The longer side's bits beyond the shorter's go on top.
+    static unsigned morton(unsigned x, unsigned y, unsigned wb,
+            unsigned hb);
+
+    // Texel (x,y) of a level, wrapped
+    const Color& texel(unsigned level, int x, int y) const;
+
+    // Bilinearly filtered colors at up to "lanes" points, point k
+    // at (u[k],v[k]) on mipmap level[k], and the depths of the nearest
+    // texels if asked and held
+    void sample(const float* u, const float* v, const int* level,
+            Color* out, unsigned count, float* depth=NULL) const;
+};
+
+// What a triangle samples: the texture and, at each corner, the
+// texture co-ordinates and 1/w of the corner before the perspective
+// divide, which makes u/w, v/w and 1/w linear on the screen. Texel
+// depths are taken to the screen by "depthScale", the screen depth of
+// a depth of 1.
+struct TextureCorners {
+    const Texture* texture;
+    float u[3], v[3], q[3];
+    float depthScale;
+};
+
+inline unsigned Texture::morton(unsigned x, unsigned y, unsigned wb,
+        unsigned hb) {
+    unsigned bits = wb<hb ? wb : hb;
+    unsigned mask = (1u<<bits)-1;
+    // Spread the low 16 bits apart by one
+    auto spread = [](unsigned a) {
+        a = (a | (a<<8)) & 0x00ff00ff;
+        a = (a | (a<<4)) & 0x0f0f0f0f;
+        a = (a | (a<<2)) & 0x33333333;
+        a = (a | (a<<1)) & 0x55555555;
+        return a;
+    };
+    // One of x and y has no bits beyond the shorter side's
+    return spread(x&mask) | spread(y&mask)<<1 | ((x|y)>>bits)<<2*bits;
+}
+
+inline const Color& Texture::texel(unsigned level, int x, int y) const {
+    unsigned wb = m_widthBits[level], hb = m_heightBits[level];
+    return m_texels[m_offset[level] + morton(x&((1u<<wb)-1),
+            y&((1u<<hb)-1),wb,hb)];
+}
+
+#endif
@@ -9,6 +9,9 @@
 class TfMatrix: public Matrix<float> {
     public:
 
+        // Returns the identity transformation
+        static Matrix<float> identity();
+
         // Returns a shearing matrix
         static Matrix<float> shearing(float a, float b,
                 float c, float d, float e, float f);
@@ -0,0 +1,103 @@
+#ifndef __VERTEXANIMATION__
+#define __VERTEXANIMATION__
+
+#include <vector>
+#include "Object.h"
+
+// VertexAnimation deforms an object's vertices every frame without
+// touching them: the deformed ones are written to a matrix of its own
+// which the object draws in their place, shadows and bounds included.
+//
+// Two deformations are applied, in order:
+//  - morph targets, each a full set of vertex positions, blended in
+//    by their weights as offsets from the object's own,
+//  - linear blend skinning, every vertex moved by up to four bones,
+//    the sum of their matrices scaled by the vertex's weights.
+// Vertex normals are skinned too, when every surface's normals are
+// those of its vertices. Morph targets leave normals as they are.
+//
+// All the data is kept a row, or a slot of influences, at a time so
+// that the blending loops run over plain arrays and vectorize. Large
+// meshes are split in ranges of vertices blended on threads of their
+// own.
+class VertexAnimation {
+
+    Object* mp_object;
+    unsigned m_count;
+
+    // Offsets of every target from the object's vertices, x, y and z
+    // one after another, and the weights of the targets
+    std::vector<std::vector<float> > m_targets;
+    std::vector<float> m_weights;
+
+    // Bones and weights of the four influences of every vertex, all
+    // vertices of the first influence, then the second and so on
+    unsigned m_boneCount;
+    std::vector<unsigned> m_bones;
+    std::vector<float> m_boneWeights;
+    // The top three rows of every bone's matrix, all bones of the
+    // first element, then the second and so on
+    std::vector<float> m_poses;
+
+    // The deformed vertices and normals
+    Matrix<float> m_vertices;
+    Matrix<float> m_normals;
+
+    // Whether normal i belongs to vertex i in every surface
+    bool normalsFollow() const;
+
+    // Deform vertices "first" up to "last"
+    void blend(unsigned first, unsigned last, bool normals);
+
+    public:
+    // Vertices blended at a time, and the fewest given a thread
+    const static unsigned blockSize = 256;
+    const static unsigned minRange = 4096;
+
+    VertexAnimation(Object* obj);
+    ~VertexAnimation();
+
+    VertexAnimation(const VertexAnimation&) = delete;
+    VertexAnimation& operator=(const VertexAnimation&) = delete;
+
+    // Add a morph target of a column for every vertex, in model
+    // co-ordinates, at weight 0. Returns its index.
+    unsigned addTarget(const Matrix<float>& vertices);
+
+    void setWeight(unsigned target, float weight);
+
+    // Skin with "count" bones, all at the identity, every vertex
+    // following bone 0 alone
+    void setBones(unsigned count);
+
+    // Vertex v follows bones[i] by weights[i], the weights are scaled
+    // to add up to one
+    void setInfluences(unsigned v, const unsigned bones[4],
+            const float weights[4]);
+
+    // The bone's matrix, from the object's model co-ordinates to where
+    // the bone has moved them: its pose times the inverse of its bind
+    // pose. Only the top three rows are used.
+    void setPose(unsigned bone, const Matrix<float>& transform);
+
+    // Deform the vertices and hand them to the object
+    void apply();
+
+    Object* object() const {
+        return mp_object;
+    }
+
+    unsigned targetCount() const {
+        return m_targets.size();
+    }
+
+    unsigned boneCount() const {
+        return m_boneCount;
+    }
+
+    const Matrix<float>& vertices() const {
+        return m_vertices;
+    }
+};
+
+#endif
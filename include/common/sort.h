@@ -0,0 +1,46 @@
+#ifndef __SORT_H__
+#define __SORT_H__
+
+// sort.h contains sorting of items by integer keys
+#include <vector>
+#include <cstring>
+#include <stdint.h>
+
+// A key ordering non negative floats as they compare, the upper half
+// of the float's bits: the exponent and 7 bits of the mantissa are
+// plenty for ordering draws
+inline uint32_t depthKey(float depth) {
+    if (!(depth > 0))
+        return 0;
+    uint32_t bits;
+    std::memcpy(&bits,&depth,sizeof(bits));
+    return bits>>16;
+}
+
+// Stable least significant digit radix sort of "items" by "keys", 8
+// bits a pass. Passes over a byte all keys share are skipped, so 16 bit
+// keys take two passes.
+inline void radixSort(std::vector<uint32_t>& keys,
+        std::vector<unsigned>& items) {
+    unsigned n = keys.size();
+    std::vector<uint32_t> keysOut(n);
+    std::vector<unsigned> itemsOut(n);
+    for (unsigned shift=0; shift<32; shift+=8) {
+        unsigned count[257] = {0};
+        for (unsigned i=0; i<n; i++)
+            count[((keys[i]>>shift)&0xff)+1]++;
+        if (n==0 || count[((keys[0]>>shift)&0xff)+1]==n)
+            continue;
+        for (unsigned d=1; d<257; d++)
+            count[d] += count[d-1];
+        for (unsigned i=0; i<n; i++) {
+            unsigned at = count[(keys[i]>>shift)&0xff]++;
+            keysOut[at] = keys[i];
+            itemsOut[at] = items[i];
+        }
+        keys.swap(keysOut);
+        items.swap(itemsOut);
+    }
+}
+
+#endif
@@ -123,6 +123,9 @@ class Matrix {
         // Returns the determinant of a matrix
         T determinant() const;
 
+        // Returns the inverse of a square matrix
+        Matrix<T> inverse() const;
+
         // Clears the matrix
         void clear();
 
@@ -197,8 +200,8 @@ bool Matrix<T>::isSquare() const {
 template<class T>
 Matrix<T> Matrix<T>::transpose() const {
     Matrix<T> t({col(),row()});
-    for(int i=0;i<row();i++)
-        for(int j=0;j<col();j++)
+    for(unsigned i=0;i<row();i++)
+        for(unsigned j=0;j<col();j++)
             t(j,i) = (*this)(i,j);
     return t;
 }
@@ -283,7 +286,7 @@ T Matrix<T>::determinant() const {
 template<class T>
 Matrix<T> Matrix<T>::identity(unsigned n) {
     Matrix<T> inst({n,n});
-    for(int i=0;i<inst.space();i++)
+    for(unsigned i=0;i<inst.space();i++)
         inst(i) = (i%(n+1) == 0);
     return inst;
 }
@@ -291,7 +294,7 @@ Matrix<T> Matrix<T>::identity(unsigned n) {
 template<class T>
 Matrix<T> Matrix<T>::zero(const Pair<unsigned>& size){
     Matrix<T> inst({size.x,size.y});
-    for(int i=0;i<inst.space();i++)
+    for(unsigned i=0;i<inst.space();i++)
         inst(i) = 0;
     return inst;
 }
@@ -431,8 +434,8 @@ Matrix<T> Matrix<T>::operator/(T f) const {
 template<class T>
 void Matrix<T>::print() const {
     std::cout.precision(2);
-    for(int i=0;i<row();i++){
-        for(int j=0;j<col();j++){
+    for(unsigned i=0;i<row();i++){
+        for(unsigned j=0;j<col();j++){
             std::cout <<  std::fixed << std::setw(8) << std::right << (*this)(i,j);
         }
         std::cout << "\n";
@@ -440,26 +443,51 @@ void Matrix<T>::print() const {
     std::cout << std::setw(8*col()+1) << std::right << row() << "x" << col() << "\n";
 }
 
-/*template<class T>
-Matrix<T> Matrix<T>::inverse() {
-    double det = determinant();
-    if (Math::equal(det,0))
-        throw "No inverse";
-    Matrix<T> res(4,4);
-    res(0,0) = (*this)(1,1)*(*this)(2,2)-(*this)(1,2)*(*this)(2,1);
-    res(0,1) = -(*this)(1,0)*(*this)(2,2)+(*this)(1,2)*(*this)(2,0);
-    res(0,2) = (*this)(1,0)*(*this)(2,1)-(*this)(1,1)*(*this)(2,0);
-
-    res(1,0) = -(*this)(0,1)*(*this)(2,2)+(*this)(0,2)*(*this)(2,1);
-    res(1,1) = (*this)(0,0)*(*this)(2,2)-(*this)(0,2)*(*this)(2,0);
-    res(1,2) = -(*this)(0,0)*(*this)(2,1)+(*this)(0,1)*(*this)(2,0);
-
-    res(2,0) = (*this)(0,1)*(*this)(1,2)-(*this)(0,2)*(*this)(1,1);
-    res(2,1) = -(*this)(0,0)*(*this)(1,2)+(*this)(0,2)*(*this)(1,0);
-    res(2,2) = (*this)(0,0)*(*this)(1,1)-(*this)(0,1)*(*this)(1,0);
-    res /= det;
-    res(3,3) = 1;
-    return res;
-}*/
+// Gauss-Jordan elimination with partial pivoting
+template<class T>
+Matrix<T> Matrix<T>::inverse() const {
+    if(row()!=col())
+        throw ex::DimensionMismatch();
+
+    unsigned size = row();
+    Matrix<T> arr = *this;
+    Matrix<T> inv = identity(size);
+
+    for(unsigned i=0;i<size;i++){   // Columns
+
+        // Bring the largest value of the column to the diagonal
+        unsigned pivot = i;
+        for(unsigned j=i+1;j<size;j++)
+            if(Math::abs(arr(j,i)) > Math::abs(arr(pivot,i)))
+                pivot = j;
+        if(arr(pivot,i)==0)
+            throw ex::DivideByZero();
+        if(pivot!=i)
+            for(unsigned k=0;k<size;k++){
+                swap(arr(i,k),arr(pivot,k));
+                swap(inv(i,k),inv(pivot,k));
+            }
+
+        // Unit diagonal
+        T c = arr(i,i);
+        for(unsigned k=0;k<size;k++){
+            arr(i,k) /= c;
+            inv(i,k) /= c;
+        }
+
+        // Eliminate the column from the other rows
+        for(unsigned j=0;j<size;j++){   // Row
+            if(j==i)
+                continue;
+            T f = arr(j,i);
+            for(unsigned k=0;k<size;k++){
+                arr(j,k) -= f*arr(i,k);
+                inv(j,k) -= f*inv(i,k);
+            }
+        }
+    }
+
+    return inv;
+}
 
 #endif
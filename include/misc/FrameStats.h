@@ -0,0 +1,130 @@
+#ifndef __FRAMESTATS__
+#define __FRAMESTATS__
+
+#include <iostream>
+#include <cstddef>
+#include <stdint.h>
+
+// FrameStats collects counters about the last frame drawn by the
+// Shader, for profiling and tuning.
+struct FrameStats {
+    // Translucent fragments stored in the A-buffer
+    unsigned fragments;
+    // Translucent fragments dropped because the A-buffer was full
+    unsigned droppedFragments;
+    // Memory held by the A-buffer in bytes
+    size_t abufferBytes;
+    // Dimensions of the render target
+    unsigned renderWidth, renderHeight;
+    // Pixels redrawn, zero when the frame was skipped
+    unsigned redrawnPixels;
+    // Opaque fragments shaded, the redrawn pixels times the overdraw
+    unsigned shadedFragments;
+    // Pixels reused from the last frame by reprojection
+    unsigned reusedPixels;
+    // Static objects copied from the saved layer instead of drawn
+    unsigned layeredObjects;
+    // Objects in the scene
+    unsigned objects;
+    // Objects outside the view volume, skipped entirely
+    unsigned culledObjects;
+    // Cells of the cell graph seen from the camera's cell
+    unsigned visibleCells;
+    // Objects hidden behind occluders, and occlusion tests made
+    unsigned occludedObjects;
+    unsigned occlusionTests;
+    // Meshlets out of view or facing away, of the objects prepared
+    unsigned culledMeshlets;
+    // Terrain patches out of view
+    unsigned culledPatches;
+    // Instances shaded and filled
+    unsigned instances;
+    // Instances drawn as impostors, and impostor pictures taken
+    unsigned impostors;
+    unsigned impostorCaptures;
+    // Surfaces of the objects drawn, after culling and level of detail
+    unsigned surfaces;
+    // Triangles dropped at setup for having no area or for covering
+    // no pixel centre, and triangles filled by the small triangle path
+    unsigned degenerateTriangles;
+    unsigned microTriangles;
+    unsigned smallTriangles;
+    // Commands in the recorded frame and the memory they hold
+    unsigned commands;
+    size_t commandBytes;
+    // Time the last build and refit of the scene hierarchy took,
+    // in micro seconds
+    uintmax_t bvhBuildMicros, bvhRefitMicros;
+
+    FrameStats() {
+        reset();
+    }
+
+    // Zero all counters
+    void reset() {
+        fragments = 0;
+        droppedFragments = 0;
+        abufferBytes = 0;
+        renderWidth = 0;
+        renderHeight = 0;
+        redrawnPixels = 0;
+        shadedFragments = 0;
+        reusedPixels = 0;
+        layeredObjects = 0;
+        objects = 0;
+        culledObjects = 0;
+        visibleCells = 0;
+        occludedObjects = 0;
+        occlusionTests = 0;
+        culledMeshlets = 0;
+        culledPatches = 0;
+        instances = 0;
+        impostors = 0;
+        impostorCaptures = 0;
+        surfaces = 0;
+        degenerateTriangles = 0;
+        microTriangles = 0;
+        smallTriangles = 0;
+        commands = 0;
+        commandBytes = 0;
+        bvhBuildMicros = 0;
+        bvhRefitMicros = 0;
+    }
+
+    // Ratio of the objects culled or occluded
+    float culledRatio() const {
+        return objects ? float(culledObjects+occludedObjects)/objects : 0;
+    }
+
+    void print() const {
+        std::cout << "fragments " << fragments
+            << " dropped " << droppedFragments
+            << " abuffer " << abufferBytes/1024 << "KiB"
+            << " render " << renderWidth << "x" << renderHeight
+            << " redrawn " << redrawnPixels
+            << " shaded " << shadedFragments
+            << " reused " << reusedPixels
+            << " layered " << layeredObjects
+            << " culled " << culledObjects
+            << " cells " << visibleCells
+            << " occluded " << occludedObjects
+            << " (" << culledRatio()*100 << "%)"
+            << " tests " << occlusionTests
+            << " meshlets culled " << culledMeshlets
+            << " patches culled " << culledPatches
+            << " instances " << instances
+            << " impostors " << impostors
+            << " (" << impostorCaptures << " taken)"
+            << " surfaces " << surfaces
+            << " degenerate " << degenerateTriangles
+            << " micro " << microTriangles
+            << " small " << smallTriangles
+            << " commands " << commands
+            << " (" << commandBytes/1024 << "KiB)"
+            << " bvh build " << bvhBuildMicros << "us"
+            << " refit " << bvhRefitMicros << "us"
+            << std::endl;
+    }
+};
+
+#endif
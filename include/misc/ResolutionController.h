@@ -0,0 +1,94 @@
+#ifndef __RESOLUTIONCONTROLLER__
+#define __RESOLUTIONCONTROLLER__
+
+#include <cmath>
+#include <stdint.h>
+
+#include "common/helper.h"
+
+// ResolutionController picks the render scale that keeps the frame
+// time within a budget. The average of the recent frame times is
+// compared against a band around the budget; outside the band the
+// scale is corrected assuming the cost grows with the pixel count.
+// Changes are limited per step, quantized, and followed by a cooldown
+// during which the history refills, so the scale doesn't oscillate.
+class ResolutionController {
+private:
+    // Number of frames averaged
+    const static unsigned history = 8;
+
+    uintmax_t m_budget;
+    float m_scale, m_minScale, m_maxScale;
+
+    uintmax_t m_times[history];
+    unsigned m_count, m_index;
+
+public:
+    // Frame time budget in micro seconds, scale limits
+    ResolutionController(uintmax_t budget, float minScale=0.5,
+            float maxScale=1);
+
+    // Record the time of a frame and return the scale to be used
+    // for the next one
+    float update(uintmax_t frameTime);
+
+    // The current scale
+    float scale() const;
+
+    uintmax_t budget() const;
+    void budget(uintmax_t b);
+};
+
+inline ResolutionController::ResolutionController(uintmax_t budget,
+        float minScale, float maxScale) :
+    m_budget(budget), m_scale(maxScale), m_minScale(minScale),
+    m_maxScale(maxScale), m_count(0), m_index(0) {
+}
+
+inline float ResolutionController::update(uintmax_t frameTime) {
+    m_times[m_index] = frameTime;
+    m_index = (m_index+1)%history;
+    if (++m_count < history)
+        return m_scale;
+
+    uintmax_t sum = 0;
+    for (unsigned i=0; i<history; i++)
+        sum += m_times[i];
+    float average = (float)sum/history;
+
+    // Hysteresis band: shrink above 105% of the budget, grow only
+    // below 80% of it
+    if (average <= m_budget*1.05f && (average >= m_budget*0.8f ||
+                m_scale >= m_maxScale))
+        return m_scale;
+
+    // Cost is roughly proportional to the number of pixels
+    float target = m_scale*std::sqrt(m_budget/Math::max(average,1.0f));
+    // Never change by more than 15% at a time
+    target = Math::max(m_scale*0.85f,Math::min(target,m_scale*1.15f));
+    // Quantize to 1/32 steps so tiny corrections are ignored
+    target = std::floor(target*32+0.5f)/32;
+    target = Math::max(m_minScale,Math::min(target,m_maxScale));
+
+    if (target != m_scale) {
+        m_scale = target;
+        // Cool down, wait for a full history at the new scale
+        m_count = 0;
+    }
+    return m_scale;
+}
+
+inline float ResolutionController::scale() const {
+    return m_scale;
+}
+
+inline uintmax_t ResolutionController::budget() const {
+    return m_budget;
+}
+
+inline void ResolutionController::budget(uintmax_t b) {
+    m_budget = b;
+    m_count = 0;
+}
+
+#endif
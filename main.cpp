@@ -1,5 +1,6 @@
 #include<iostream>
 #include<cstring>
+#include<list>
 
 #include<SDL2/SDL.h>
 
@@ -12,6 +13,12 @@
 #include "PointLight.h"
 #include "AmbientLight.h"
 #include "Object.h"
+#include "SceneNode.h"
+#include "InstanceSet.h"
+#include "Impostor.h"
+#include "Terrain.h"
+#include "StaticBatch.h"
+#include "MeshOptimizer.h"
 #include "Camera.h"
 #include "Shader.h"
 
@@ -69,14 +76,38 @@ int main(int argc, char*argv[]) {
     // plane.vmatrix()/=TfMatrix::scaling({5,5,5,1},{0,0,0,1});
     Matrix<float> placePlane = TfMatrix::translation({0, 12, 0, 0});
     Matrix<float> unplacePlane = TfMatrix::translation({0, -12, 0, 0});
-    plane.vmatrix() /= placePlane;
-
-    Object ground("resources/terrain.obj",groundMat,Shading::flat,
-            true,false);
+    // The objects are placed by scene graph nodes, their vertices
+    // stay as loaded
+    SceneNode planeNode(placePlane);
+    plane.setNode(&planeNode);
+
+    // The ground is a grid of heights, its patches are drawn at less
+    // detail the farther they are
+    const unsigned side = 65;
+    std::vector<float> heights(side*side);
+    for (unsigned z=0; z<side; z++)
+        for (unsigned x=0; x<side; x++) {
+            float px = -30 + x*60.0f/(side-1), pz = -30 + z*60.0f/(side-1);
+            heights[z*side+x] = -1.5*std::sin(M_PI*px/10)*
+                std::cos(M_PI*pz/10);
+        }
+    Terrain terrain(heights,side,side,60.0f/(side-1),{-30,0,-30,1},
+            groundMat,Shading::flat);
+    Object& ground = *terrain.object();
 
     Object tree("resources/tree.obj",treeMat, Shading::gouraud,
             true,false);
-    tree.vmatrix() /= TfMatrix::translation({6, 1, 2, 0});
+    SceneNode treeNode(TfMatrix::translation({6, 1, 2, 0}));
+    tree.setNode(&treeNode);
+
+    // Weld and reorder the meshes as loaded, before anything refers
+    // to their vertices
+    for (Object* obj : {&plane,&tree})
+        MeshOptimizer optimized(obj);
+
+    // The terrain and the tree never move
+    ground.setStatic(true);
+    tree.setStatic(true);
 
     /*
     Object ground(4,groundMat,Shading::flat,true,false);
@@ -93,6 +124,60 @@ int main(int argc, char*argv[]) {
     shader.addObject(&tree);
     shader.addObject(&ground);
 
+    shader.setTerrain(2,&terrain);
+
+    // A simplified version of the tree, drawn when it is small on the
+    // screen
+    LODChain treeLOD(&tree);
+    shader.setLOD(1,&treeLOD);
+
+    // A forest of one tree mesh drawn at many places, standing where
+    // a ray down meets the terrain
+    Object treeMesh("resources/tree.obj",treeMat, Shading::gouraud,
+            true,false);
+    MeshOptimizer optimizedTree(&treeMesh);
+    InstanceSet forest(&treeMesh);
+    for (int x=-20; x<=20; x+=10)
+        for (int z=-20; z<=20; z+=10) {
+            Hit hit;
+            if ((x==0 && z==0) || !shader.trace({(float)x,50,(float)z,1},
+                        {0,-1,0,0},hit))
+                continue;
+            Color tint = {(uint8_t)(200+x), 255, (uint8_t)(200+z), 255};
+            forest.add(TfMatrix::translation({hit.point.x,hit.point.y,
+                        hit.point.z,0}),tint);
+        }
+    shader.addInstances(&forest);
+    // Trees small on the screen are drawn as pictures of the mesh
+    Impostor treeImpostor(&treeMesh);
+    shader.setImpostor(0,&treeImpostor);
+
+    // A grove of trees loaded one by one that never move. Batched,
+    // those in the same chunk are merged into one object at load time.
+    const bool batchGrove = true;
+    std::list<Object> grove;
+    std::list<SceneNode> groveNodes;
+    std::vector<Object*> groveObjects;
+    for (int x=-27; x<=-23; x+=4)
+        for (int z=-27; z<=-23; z+=4) {
+            Hit hit;
+            if (!shader.trace({(float)x,50,(float)z,1},{0,-1,0,0},hit))
+                continue;
+            grove.emplace_back("resources/tree.obj",treeMat,
+                    Shading::gouraud,true,false);
+            groveNodes.emplace_back(TfMatrix::translation({hit.point.x,
+                        hit.point.y,hit.point.z,0}));
+            grove.back().setNode(&groveNodes.back());
+            grove.back().setStatic(true);
+            groveObjects.push_back(&grove.back());
+        }
+    StaticBatch groveBatch(batchGrove ? groveObjects :
+            std::vector<Object*>());
+    const std::vector<Object*>& groveDrawn = batchGrove ?
+        groveBatch.objects() : groveObjects;
+    for (unsigned k=0; k<groveDrawn.size(); k++)
+        shader.addObject(groveDrawn[k]);
+
     // Initialize camera
     // view-reference point, view-plane normal, view-up vector
     Camera cam({27.8404,37.8099,25.767},
@@ -100,6 +185,16 @@ int main(int argc, char*argv[]) {
 
 
     shader.setCamera(cam);
+    // Drop the resolution rather than the frame rate
+    shader.setFrameBudget(DELAY);
+    // Reusing frames while the camera orbits trades view dependent
+    // lighting accuracy for speed
+    // shader.setReprojection(true);
+    // Only the plane is drawn while it flies over the static scene
+    shader.setStaticLayer(true);
+    shader.setOcclusion(true);
+    // Nearer objects first, so the depth test saves shading
+    shader.setDepthSort(true);
     Matrix<float> translator = TfMatrix::translation(
             {0.05,0,0.05,0});
 
@@ -111,7 +206,6 @@ int main(int argc, char*argv[]) {
     if (red.shadow_buffer==NULL)
         red.initShadowBuffer({1000,1000});
     red.magic = 0.0004;
-    int i = 0;
     while (!fb.checkTerm()) {
         //plane.vmatrix() /= translator;
         //i++;
@@ -173,15 +267,17 @@ int main(int argc, char*argv[]) {
         } else if (keys[SDL_GetScancodeFromKey(SDLK_m)]) {
             red.magic *= 1.5;
         } else if (keys[SDL_GetScancodeFromKey(SDLK_i)]) {
-            plane.vmatrix() /= TfMatrix::translation({0,0,0.2,0});
+            planeNode.transform(TfMatrix::translation({0,0,0.2,0}));
         } else if (keys[SDL_GetScancodeFromKey(SDLK_k)]) {
-            plane.vmatrix() /= TfMatrix::translation({0,0,-0.2,0});
+            planeNode.transform(TfMatrix::translation({0,0,-0.2,0}));
         } else if (keys[SDL_GetScancodeFromKey(SDLK_j)]) {
-            plane.vmatrix() /= placePlane*TfMatrix::rotationz(0.1)
-                *TfMatrix::rotationy(0.1)*unplacePlane;
+            planeNode.transform(placePlane*TfMatrix::rotationz(0.1)
+                *TfMatrix::rotationy(0.1)*unplacePlane);
         } else if (keys[SDL_GetScancodeFromKey(SDLK_l)]) {
-            plane.vmatrix() /= placePlane*TfMatrix::rotationz(-0.1)
-                *TfMatrix::rotationy(-0.1)*unplacePlane;
+            planeNode.transform(placePlane*TfMatrix::rotationz(-0.1)
+                *TfMatrix::rotationy(-0.1)*unplacePlane);
+        } else if (keys[SDL_GetScancodeFromKey(SDLK_p)]) {
+            shader.stats().print();
         }
 
         // For cirualar camera movement due to direction
@@ -203,8 +299,11 @@ int main(int argc, char*argv[]) {
             std::cout<<"OnShadow"<<std::endl;
         else
             std::cout<<"nOShadow"<<std::endl;*/
-        red.updateShadowBuffer(&shader,&fb);
-        shader.draw();
+        // Nothing to do unless something changed
+        if (shader.changed()) {
+            red.updateShadowBuffer(&shader,&fb);
+            shader.draw();
+        }
 
         //break;
         //fb.update();
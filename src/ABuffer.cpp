@@ -0,0 +1,95 @@
+#include "ABuffer.h"
+
+const uint32_t ABuffer::none;
+const unsigned ABuffer::maxLayers;
+
+// Construct
+ABuffer::ABuffer(unsigned w, unsigned h, unsigned capacity) :
+    m_width(0), m_height(0), m_arena(capacity), m_used(0),
+    m_dropped(0)
+{
+    readjust(w,h);
+}
+
+// Resize to new dimensions, discarding all fragments
+void ABuffer::readjust(unsigned w, unsigned h) {
+    m_width = w;
+    m_height = h;
+    m_head.assign(w*h,none);
+    // Reserving every pixel keeps push_back from ever reallocating
+    // in the middle of a frame
+    m_touched.clear();
+    m_touched.reserve(w*h);
+    m_used = 0;
+    m_dropped = 0;
+}
+
+// Change the number of fragments the arena can hold
+void ABuffer::setCapacity(unsigned capacity) {
+    reset();
+    m_arena.resize(capacity);
+    m_arena.shrink_to_fit();
+}
+
+// Only the touched heads are reset, so an empty frame costs nothing
+void ABuffer::reset() {
+    for (unsigned i=0; i<m_touched.size(); i++)
+        m_head[m_touched[i]] = none;
+    m_touched.clear();
+    m_used = 0;
+    m_dropped = 0;
+}
+
+// Blend the fragments of a pixel over the opaque color "base"
+Color ABuffer::blend(unsigned index, Color base) const {
+    // Gather the nearest maxLayers fragments of the pixel
+    int32_t depth[maxLayers];
+    Color color[maxLayers];
+    unsigned count = 0;
+    for (uint32_t f=m_head[m_touched[index]]; f!=none;
+            f=m_arena[f].next) {
+        const Fragment& frag = m_arena[f];
+        if (count < maxLayers) {
+            depth[count] = frag.depth;
+            color[count++] = frag.color;
+            continue;
+        }
+        // Replace the farthest fragment (smallest depth value)
+        // if this one is nearer
+        unsigned far = 0;
+        for (unsigned i=1; i<maxLayers; i++)
+            if (depth[i] < depth[far])
+                far = i;
+        if (frag.depth > depth[far]) {
+            depth[far] = frag.depth;
+            color[far] = frag.color;
+        }
+    }
+
+    // Insertion sort, farthest first. Lists are short.
+    for (unsigned i=1; i<count; i++) {
+        int32_t d = depth[i];
+        Color c = color[i];
+        int j = i-1;
+        while (j>=0 && depth[j] > d) {
+            depth[j+1] = depth[j];
+            color[j+1] = color[j];
+            j--;
+        }
+        depth[j+1] = d;
+        color[j+1] = c;
+    }
+
+    // Back to front "over" compositing. Most of the time goes to the
+    // list walk and sort above, see tests/abuffer_resolve.cpp
+    float acc[4] = {(float)base.blue, (float)base.green,
+        (float)base.red, 0};
+    for (unsigned i=0; i<count; i++) {
+        float a = color[i].alpha/255.0f;
+        float src[4] = {(float)color[i].blue, (float)color[i].green,
+            (float)color[i].red, 0};
+        for (int k=0; k<4; k++)
+            acc[k] += (src[k]-acc[k])*a;
+    }
+    return {(uint8_t)acc[0],(uint8_t)acc[1],(uint8_t)acc[2],0xff};
+}
@@ -0,0 +1,156 @@
+#include <future>
+#include "BVH.h"
+
+// Number of bins the centroids are sorted in along an axis
+static const int bins = 12;
+// Subtrees over more items than this are built on another thread,
+// down to parallelDepth levels
+static const unsigned parallelItems = 4096;
+static const int parallelDepth = 4;
+// Deeper nodes become leaves whatever their size, queries keep their
+// stacks on the machine stack
+static const int maxDepth = 60;
+
+// Build anew over "boxes"
+void BVH::build(const std::vector<Box>& boxes) {
+    m_nodes.clear();
+    m_items.resize(boxes.size());
+    for (unsigned i=0; i<boxes.size(); i++)
+        m_items[i] = i;
+    if (boxes.empty())
+        return;
+    // A binary tree over n leaves has at most 2n-1 nodes
+    m_nodes.reserve(2*boxes.size());
+    m_nodes.push_back(BVHNode());
+    split(boxes,m_nodes,0,0,boxes.size(),0);
+}
+
+// Build the subtree over items [begin,end) into nodes[root]
+void BVH::split(const std::vector<Box>& boxes,
+        std::vector<BVHNode>& nodes, unsigned root, unsigned begin,
+        unsigned end, int depth) {
+
+    Box box, centroids;
+    for (unsigned i=begin; i<end; i++) {
+        const Box& b = boxes[m_items[i]];
+        box.include(b);
+        centroids.include(b.center(0),b.center(1),b.center(2));
+    }
+    nodes[root].box = box;
+    unsigned count = end-begin;
+    if (count <= m_leafSize || depth >= maxDepth) {
+        nodes[root].first = begin;
+        nodes[root].count = count;
+        return;
+    }
+
+    // Cost of every split between bins along every axis, the cost of
+    // a side being its area times its number of items
+    int bestAxis = -1, bestBin = 0;
+    float bestCost = box.area()*count;
+    for (int axis=0; axis<3; axis++) {
+        float lo = centroids.min[axis], hi = centroids.max[axis];
+        if (hi <= lo)
+            continue;
+        float scale = bins/(hi-lo);
+        Box binBox[bins];
+        unsigned binCount[bins] = {0};
+        for (unsigned i=begin; i<end; i++) {
+            const Box& b = boxes[m_items[i]];
+            int bin = Math::min(bins-1,
+                    (int)((b.center(axis)-lo)*scale));
+            binBox[bin].include(b);
+            binCount[bin]++;
+        }
+        // Areas and counts on the right of every split, swept from
+        // the right, then the left side is swept from the left
+        float rightArea[bins];
+        unsigned rightCount[bins];
+        Box acc;
+        unsigned n = 0;
+        for (int b=bins-1; b>0; b--) {
+            acc.include(binBox[b]);
+            n += binCount[b];
+            rightArea[b] = acc.area();
+            rightCount[b] = n;
+        }
+        acc = Box();
+        n = 0;
+        for (int b=1; b<bins; b++) {
+            acc.include(binBox[b-1]);
+            n += binCount[b-1];
+            if (n==0 || rightCount[b]==0)
+                continue;
+            float cost = acc.area()*n + rightArea[b]*rightCount[b];
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestAxis = axis;
+                bestBin = b;
+            }
+        }
+    }
+
+    unsigned mid;
+    if (bestAxis >= 0) {
+        float lo = centroids.min[bestAxis];
+        float scale = bins/(centroids.max[bestAxis]-lo);
+        uint32_t* first = &m_items[0]+begin;
+        uint32_t* last = &m_items[0]+end;
+        mid = std::partition(first,last,[&](uint32_t item) {
+                int bin = Math::min(bins-1,
+                    (int)((boxes[item].center(bestAxis)-lo)*scale));
+                return bin < bestBin;
+                }) - &m_items[0];
+    } else {
+        // No split is cheaper than a leaf, or all centroids are the
+        // same; leaves are kept small anyway
+        mid = begin + count/2;
+    }
+
+    // Siblings are adjacent
+    unsigned left = nodes.size();
+    nodes.push_back(BVHNode());
+    nodes.push_back(BVHNode());
+    nodes[root].first = left;
+    nodes[root].count = 0;
+
+    if (depth < parallelDepth && count > parallelItems) {
+        // The right subtree is built into nodes of its own, which are
+        // appended once both sides are done. Both sides work on
+        // disjoint ranges of the items.
+        std::vector<BVHNode> right(1);
+        std::future<void> task = std::async(std::launch::async,
+                [&]() { split(boxes,right,0,mid,end,depth+1); });
+        split(boxes,nodes,left,begin,mid,depth+1);
+        task.get();
+
+        // Local node i>0 lands at base+i-1, local node 0 at left+1
+        unsigned base = nodes.size();
+        for (unsigned i=0; i<right.size(); i++)
+            if (right[i].count==0)
+                right[i].first += base-1;
+        nodes[left+1] = right[0];
+        nodes.insert(nodes.end(),right.begin()+1,right.end());
+    } else {
+        split(boxes,nodes,left,begin,mid,depth+1);
+        split(boxes,nodes,left+1,mid,end,depth+1);
+    }
+}
+
+// Children are always stored after their parent, so one backward
+// sweep sees every child before its parent
+void BVH::refit(const std::vector<Box>& boxes) {
+    if (boxes.size()!=m_items.size())
+        throw ex::DimensionMismatch();
+    for (int i=(int)m_nodes.size()-1; i>=0; i--) {
+        BVHNode& n = m_nodes[i];
+        n.box = Box();
+        if (n.count) {
+            for (unsigned k=n.first; k<n.first+n.count; k++)
+                n.box.include(boxes[m_items[k]]);
+        } else {
+            n.box.include(m_nodes[n.first].box);
+            n.box.include(m_nodes[n.first+1].box);
+        }
+    }
+}
@@ -0,0 +1,192 @@
+#include "CellGraph.h"
+#include "common/ex.h"
+
+namespace {
+
+// The part x0,y0 to x1,y1 of the normalized view of "clip", which
+// runs from -0.5 to 0.5 across the screen, stretched over all of it,
+// so that a Frustum of the result is bounded by the sides of that part
+Matrix<float> narrow(const Matrix<float>& clip, float x0, float y0,
+        float x1, float y1) {
+    Matrix<float> part(clip);
+    for (unsigned c=0; c<4; c++) {
+        part(0,c) = (clip(0,c) - 0.5f*(x0+x1)*clip(3,c))/(x1-x0);
+        part(1,c) = (clip(1,c) - 0.5f*(y0+y1)*clip(3,c))/(y1-y0);
+    }
+    return part;
+}
+
+}
+
+unsigned CellGraph::addCell(const Vector& min, const Vector& max) {
+    Cell cell;
+    cell.min = min;
+    cell.max = max;
+    cell.visible = false;
+    cell.frustum = 0;
+    m_cells.push_back(cell);
+    m_version++;
+    return m_cells.size()-1;
+}
+
+unsigned CellGraph::addPortal(unsigned a, unsigned b,
+        const std::vector<Vector>& points) {
+    if (a>=m_cells.size() || b>=m_cells.size())
+        throw ex::OutOfBounds();
+    if (a==b || points.size()<3)
+        throw ex::InitFailure();
+    Portal portal;
+    portal.points = points;
+    portal.cells[0] = a;
+    portal.cells[1] = b;
+    m_portals.push_back(portal);
+    m_cells[a].portals.push_back(m_portals.size()-1);
+    m_cells[b].portals.push_back(m_portals.size()-1);
+    m_version++;
+    return m_portals.size()-1;
+}
+
+void CellGraph::assign(unsigned k, unsigned cell) {
+    if (cell>=m_cells.size())
+        throw ex::OutOfBounds();
+    if (k>=m_objectCell.size())
+        m_objectCell.resize(k+1,-1);
+    m_objectCell[k] = cell;
+    m_version++;
+}
+
+void CellGraph::unassign(unsigned k) {
+    if (k<m_objectCell.size())
+        m_objectCell[k] = -1;
+    m_version++;
+}
+
+int CellGraph::cellAt(const Vector& p) const {
+    for (unsigned c=0; c<m_cells.size(); c++) {
+        const Cell& cell = m_cells[c];
+        if (p.x>=cell.min.x && p.y>=cell.min.y && p.z>=cell.min.z &&
+                p.x<=cell.max.x && p.y<=cell.max.y && p.z<=cell.max.z)
+            return c;
+    }
+    return -1;
+}
+
+void CellGraph::update(const Matrix<float>& clip, const Vector& eye) {
+    m_frustums.clear();
+    for (unsigned c=0; c<m_cells.size(); c++)
+        m_cells[c].visible = false;
+    m_visible = 0;
+
+    int start = cellAt(eye);
+    if (start < 0) {
+        // From outside every cell may be seen
+        m_frustums.push_back(Frustum(clip));
+        for (unsigned c=0; c<m_cells.size(); c++) {
+            Cell& cell = m_cells[c];
+            cell.visible = true;
+            cell.x0 = cell.y0 = -0.5;
+            cell.x1 = cell.y1 = 0.5;
+            cell.frustum = 0;
+        }
+        m_visible = m_cells.size();
+        return;
+    }
+
+    std::vector<bool> path(m_cells.size(),false);
+    traverse(start,clip,-0.5,-0.5,0.5,0.5,path);
+
+    // A cell reached along several paths is seen through the box
+    // bounding all of them
+    for (unsigned c=0; c<m_cells.size(); c++) {
+        Cell& cell = m_cells[c];
+        if (!cell.visible)
+            continue;
+        m_visible++;
+        cell.frustum = m_frustums.size();
+        m_frustums.push_back(Frustum(narrow(clip,cell.x0,cell.y0,
+                        cell.x1,cell.y1)));
+    }
+}
+
+// A portal is clipped by the planes of the view it is seen in, one
+// after another, and the box bounding what is left of it on the
+// screen is the view on through it. The near plane is left out: a
+// portal the camera is about to pass through reaches nearer than it,
+// and the view on through that is all of the view it is seen in.
+void CellGraph::traverse(unsigned c, const Matrix<float>& clip, float x0,
+        float y0, float x1, float y1, std::vector<bool>& path) {
+    Cell& cell = m_cells[c];
+    if (!cell.visible) {
+        cell.visible = true;
+        cell.x0 = x0; cell.y0 = y0;
+        cell.x1 = x1; cell.y1 = y1;
+    } else {
+        cell.x0 = Math::min(cell.x0,x0); cell.y0 = Math::min(cell.y0,y0);
+        cell.x1 = Math::max(cell.x1,x1); cell.y1 = Math::max(cell.y1,y1);
+    }
+
+    path[c] = true;
+    Frustum frustum(narrow(clip,x0,y0,x1,y1));
+    std::vector<Vector> polygon, clipped;
+    for (unsigned n=0; n<cell.portals.size(); n++) {
+        const Portal& portal = m_portals[cell.portals[n]];
+        unsigned next = portal.cells[0]==c ? portal.cells[1] :
+            portal.cells[0];
+        if (path[next])
+            continue;
+
+        polygon = portal.points;
+        for (int p=0; p<6 && polygon.size()>=3; p++) {
+            if (p == 4)
+                continue;
+            clipped.clear();
+            for (unsigned i=0; i<polygon.size(); i++) {
+                const Vector& a = polygon[i];
+                const Vector& b = polygon[(i+1)%polygon.size()];
+                float da = frustum.distance(p,a.x,a.y,a.z);
+                float db = frustum.distance(p,b.x,b.y,b.z);
+                if (da >= 0)
+                    clipped.push_back(a);
+                if ((da >= 0) != (db >= 0)) {
+                    Vector cut = a + (b-a)*(da/(da-db));
+                    cut.w = 1;
+                    clipped.push_back(cut);
+                }
+            }
+            polygon.swap(clipped);
+        }
+        if (polygon.size() < 3)
+            continue;
+
+        float px0 = 0.5, py0 = 0.5, px1 = -0.5, py1 = -0.5;
+        for (unsigned i=0; i<polygon.size(); i++) {
+            const Vector& a = polygon[i];
+            if (frustum.distance(4,a.x,a.y,a.z) < 0) {
+                px0 = py0 = -0.5;
+                px1 = py1 = 0.5;
+                break;
+            }
+            float h[4];
+            for (int r=0; r<4; r++)
+                h[r] = clip(r,0)*a.x + clip(r,1)*a.y + clip(r,2)*a.z +
+                    clip(r,3);
+            px0 = Math::min(px0,h[0]/h[3]); px1 = Math::max(px1,h[0]/h[3]);
+            py0 = Math::min(py0,h[1]/h[3]); py1 = Math::max(py1,h[1]/h[3]);
+        }
+        px0 = Math::max(px0,x0); py0 = Math::max(py0,y0);
+        px1 = Math::min(px1,x1); py1 = Math::min(py1,y1);
+        if (px1 <= px0 || py1 <= py0)
+            continue;
+        traverse(next,clip,px0,py0,px1,py1,path);
+    }
+    path[c] = false;
+}
+
+bool CellGraph::visible(unsigned k, const Vector& min,
+        const Vector& max) const {
+    int c = cellOf(k);
+    if (c < 0)
+        return true;
+    const Cell& cell = m_cells[c];
+    return cell.visible && m_frustums[cell.frustum].sees(min,max);
+}
@@ -0,0 +1,75 @@
+#include "CommandBuffer.h"
+#include "Shader.h"
+
+// The same triangles Shader::fill() would draw
+void CommandBuffer::record(unsigned s, Object* obj, const Rect& area) {
+    Segment& segment = m_segments[s];
+    segment.area = segment.area.unite(area);
+    segment.opacity = obj->material().opacity;
+
+    bool GOURAUD = obj->getShading()==Shading::gouraud;
+    const ProjectedVertices& p = obj->projected();
+    const FacingSurfaces& facing = obj->facing();
+
+    for (unsigned n=0; n<facing.list.size(); n++) {
+        unsigned i = facing.list[n];
+        const Surface& surface = obj->getSurface(i);
+
+        segment.commands.push_back(Command());
+        Command& c = segment.commands.back();
+        unsigned index[] = {surface.x,surface.y,surface.z};
+        for (int v=0; v<3; v++) {
+            unsigned j = index[v];
+            c.x[v] = p.sx[j];
+            c.y[v] = p.sy[j];
+            c.d[v] = p.d[j];
+            c.color[v] = obj->getColor(GOURAUD?(i*3+v):i);
+            c.real[v][0] = p.wx[j];
+            c.real[v][1] = p.wy[j];
+            c.real[v][2] = p.wz[j];
+        }
+        c.gouraud = GOURAUD;
+        c.overwrite = facing.facing(i);
+        if (!obj->textureCorners(i,c.texture))
+            c.texture.texture = NULL;
+    }
+}
+
+void CommandBuffer::execute(unsigned s, Drawer* drawer, Shader* sh) const {
+    const Segment& segment = m_segments[s];
+    float sx = m_width ? (float)drawer->getWidth()/m_width : 1;
+    float sy = m_height ? (float)drawer->getHeight()/m_height : 1;
+    for (unsigned n=0; n<segment.commands.size(); n++)
+        draw(segment.commands[n],drawer,sh,sx,sy);
+}
+
+void CommandBuffer::draw(const Command& c, Drawer* drawer, Shader* sh,
+        float sx, float sy) {
+    ScreenPoint p[3];
+    float x[3], y[3];
+    for (int v=0; v<3; v++) {
+        x[v] = c.x[v]*sx;
+        y[v] = c.y[v]*sy;
+        p[v].x = Math::round(x[v]);
+        p[v].y = Math::round(y[v]);
+        p[v].d = c.d[v];
+        p[v].color = c.color[v];
+        p[v].real = Vector(c.real[v][0],c.real[v][1],c.real[v][2],1);
+    }
+    drawer->fillD(p[0],p[1],p[2],x,y,c.gouraud,sh,c.overwrite,
+            c.texture.texture ? &c.texture : NULL);
+}
+
+unsigned CommandBuffer::commandCount() const {
+    unsigned count = 0;
+    for (unsigned s=0; s<m_segments.size(); s++)
+        count += m_segments[s].commands.size();
+    return count;
+}
+
+size_t CommandBuffer::memoryUsage() const {
+    size_t bytes = m_segments.capacity()*sizeof(Segment);
+    for (unsigned s=0; s<m_segments.size(); s++)
+        bytes += m_segments[s].commands.capacity()*sizeof(Command);
+    return bytes;
+}
@@ -1,13 +1,83 @@
+#include <cstring>
 #include "Drawer.h"
 #include "Shader.h"
 
 // Construct.
 Drawer::Drawer(Plotter_ *pltr):
     plotter(pltr),
-    depth({pltr->width(),pltr->height()})
+    depth({pltr->width(),pltr->height()}),
+    // One translucent fragment per pixel on average
+    m_abuffer(pltr->width(),pltr->height(),
+            pltr->width()*pltr->height()),
+    m_alpha(0xff),
+    m_clip(0,0,pltr->width()-1,pltr->height()-1),
+    m_mask(NULL),
+    m_shaded(0),
+    m_degenerate(0), m_micro(0), m_small(0)
 {
 }
 
+// Clear a rectangle of the screen and the depth-buffer
+void Drawer::clear(Color clearColor, const Rect& rect) {
+    Rect r = rect.intersect(screenRect());
+    plotter->clear(clearColor,r);
+    // The depth-buffer is indexed (x,y), so columns are contiguous
+    for (int x=r.x0; x<=r.x1; x++)
+        memset(&depth(x,r.y0),0,r.height()*sizeof(uint32_t));
+    m_abuffer.reset();
+}
+
+// Save the color and depth buffers as they are now
+void Drawer::saveLayer() {
+    const unsigned w = getWidth(), h = getHeight();
+    const uint32_t* color = plotter->pixels();
+    m_layerColor.resize(w*h);
+    m_layerDepth.resize(w*h);
+    for (unsigned y=0; y<h; y++)
+        memcpy(&m_layerColor[y*w],color+y*plotter->pitch(),
+                w*sizeof(uint32_t));
+    memcpy(&m_layerDepth[0],&depth(0,0),w*h*sizeof(uint32_t));
+}
+
+// Copy a rectangle of the saved layer back, rows of color and
+// columns of depth are contiguous
+void Drawer::restoreLayer(const Rect& rect) {
+    const unsigned w = getWidth(), h = getHeight();
+    Rect r = rect.intersect(screenRect());
+    if (r.empty() || m_layerColor.size()!=w*h)
+        return;
+    uint32_t* color = plotter->pixels();
+    for (int y=r.y0; y<=r.y1; y++)
+        memcpy(color+y*plotter->pitch()+r.x0,&m_layerColor[y*w+r.x0],
+                r.width()*sizeof(uint32_t));
+    for (int x=r.x0; x<=r.x1; x++)
+        memcpy(&depth(x,r.y0),&m_layerDepth[x*h+r.y0],
+                r.height()*sizeof(uint32_t));
+    m_abuffer.reset();
+}
+
+// Render at w x h pixels, buffers are reallocated to match
+void Drawer::setRenderSize(unsigned w, unsigned h) {
+    plotter->setRenderSize(w,h);
+    depth.readjust({plotter->width(),plotter->height()});
+    m_abuffer.readjust(plotter->width(),plotter->height());
+    // A saved layer is of no use at another size
+    m_layerColor.clear();
+    m_layerDepth.clear();
+    resetClip();
+}
+
+// Blend the translucent fragments of every touched pixel over
+// the opaque surfaces already on the plotter
+void Drawer::resolve() {
+    for (unsigned i=0; i<m_abuffer.touchedCount(); i++) {
+        unsigned x = m_abuffer.touchedX(i);
+        unsigned y = m_abuffer.touchedY(i);
+        plotter->plot(x,y,m_abuffer.blend(i,plotter->getPixel(x,y)),
+                false);
+    }
+}
+
 void Drawer::pixel(const ScreenPoint& point){
     plotter->plot(point.x,point.y,point.color,false);
 }
@@ -73,18 +143,18 @@ void Drawer::line(const ScreenPoint& start,
 // This one doesn't consider the point depths.
 void Drawer::hLine(int y, int xStart, int xEnd, Color cl) {
     // If y lies outside then return
-    if( y >= (int)plotter->height() || y < 0)
+    if( y > m_clip.y1 || y < m_clip.y0)
         return;
     // xStart must be smaller than xEnd
     if (xStart>xEnd)
         swap(xStart,xEnd);
     // If x lies outside then return
-    if( xStart >= (int)plotter->width() || xEnd < 0)
+    if( xStart > m_clip.x1 || xEnd < m_clip.x0)
         return;
 
     // Clip the x axis
-    xStart = Math::max(0,xStart);
-    xEnd = Math::min(xEnd,(int)plotter->width()-1);
+    xStart = Math::max(m_clip.x0,xStart);
+    xEnd = Math::min(xEnd,m_clip.x1);
 
     while(xStart <= xEnd){
         plotter->plot(xStart,y,cl,false);
@@ -92,6 +162,17 @@ void Drawer::hLine(int y, int xStart, int xEnd, Color cl) {
     }
 }
 
+// Project the ends of a span into the light's shadow buffer
+static void shadowEnds(const Matrix<float>& shadow_xForm,
+        const Pair<Vector>& realvs, Vector& sstart, Vector& send) {
+    sstart = {realvs.x.x,realvs.x.y,realvs.x.z,realvs.x.w};
+    sstart = sstart * shadow_xForm;
+    sstart.projectionNormalize();
+    send = {realvs.y.x,realvs.y.y,realvs.y.z,realvs.y.w};
+    send = send * shadow_xForm;
+    send.projectionNormalize();
+}
+
 // This one considers the pixel depths while plotting. It only
 // plots points closer than already there.
 // The parameters are : y-coordinate, starting x-coordinate,
@@ -101,62 +182,18 @@ void Drawer::hLine(int y, int xStart, int xEnd, Color cl) {
 void Drawer::hLineD(int y, int xStart, int dStart,
         int xEnd, int dEnd, Color cl, Pair<Vector> realvs, Shader* sh,
         bool overwrite) {
-    // Sort the start end end values if they are not in order
-
-    if (xStart>xEnd) {
-        swap(xStart,xEnd);
-        swap(dStart,dEnd);
-        swap(realvs.x,realvs.y);
-    }
     // If y lies outside then return
-    if( y >= (int)plotter->height() || y < 0)
+    if( y > m_clip.y1 || y < m_clip.y0)
         return;
     // If x lies outside then return
-    if( xStart >= (int)plotter->width() || xEnd < 0)
+    if (Math::min(xStart,xEnd) > m_clip.x1 ||
+            Math::max(xStart,xEnd) < m_clip.x0)
         return;
 
-    Linspace d(dStart,dEnd,xStart,xEnd);
-
-    const Matrix<float>& shadow_xForm = sh->shadowMat();
-    Vector sstart = {realvs.x.x,realvs.x.y,realvs.x.z,realvs.x.w};
-    sstart = sstart * shadow_xForm;
-    sstart.projectionNormalize();
-    Vector send = {realvs.y.x,realvs.y.y,realvs.y.z,realvs.y.w};
-    send = send * shadow_xForm;
-    send.projectionNormalize();
-
-    Vector delta = {0,0,0,0};
-    if (xStart!=xEnd)
-        delta = (send-sstart)/(double)(xEnd-xStart);
-
-    // Clipping
-    xEnd = Math::min(xEnd,(int)plotter->width()-1);
-    // Clipping
-    xStart = Math::max(0,xStart);
-
-    while(xStart <= xEnd){
-        // Depth clipping, checking with zero isn't necessary
-        // as depth(xStart,y) is always greater than or equal
-        // to 0
-        // checking with far value must be done however
-        // 0xffffff value because it is the maximum value it
-        // should attain
-        int de = d.at(xStart);
-        if ((overwrite && de<=ScreenPoint::maxDepth &&
-                    de>=depth(xStart,y)) ||
-            (!overwrite &&  de<=ScreenPoint::maxDepth &&
-             de>depth(xStart,y)) ) {
-                if (sh->onShadow(sstart)) {
-                    Color ncol = {cl.blue*0.5,cl.green*0.5,cl.red*0.5,
-                        0xff};
-                    plotter->plot(xStart,y,ncol,false);
-                } else
-                    plotter->plot(xStart,y,cl,false);
-                depth(xStart,y)=de;
-            }
-        ++xStart;
-        sstart += delta;
-    }
+    Vector sstart, send;
+    shadowEnds(sh->shadowMat(),realvs,sstart,send);
+    span(y,xStart,dStart,xEnd,dEnd,cl,cl,false,sstart,send,sh,
+            overwrite);
 }
 
 // This one considers the pixel depths while plotting. It only
@@ -167,37 +204,95 @@ void Drawer::hLineD(int y, int xStart, int dStart,
 void Drawer::hLineD(int y, int xStart, int dStart, int xEnd,
         int dEnd, Color cStart,Color cEnd, Pair<Vector> realvs,
         Shader* sh, bool overwrite) {
+    // If y lies outside then return
+    if( y > m_clip.y1 || y < m_clip.y0)
+        return;
+    // If x lies outside then return
+    if (Math::min(xStart,xEnd) > m_clip.x1 ||
+            Math::max(xStart,xEnd) < m_clip.x0)
+        return;
+
+    Vector sstart, send;
+    shadowEnds(sh->shadowMat(),realvs,sstart,send);
+    span(y,xStart,dStart,xEnd,dEnd,cStart,cEnd,true,sstart,send,sh,
+            overwrite);
+}
+
+// The pixels of a span whose ends are already in the shadow buffer's
+// co-ordinates. The span is on the screen in y and overlaps it in x.
+void Drawer::span(int y, int xStart, int dStart, int xEnd, int dEnd,
+        Color cStart, Color cEnd, bool interpolate, Vector sstart,
+        Vector send, Shader* sh, bool overwrite,
+        const TexturePlanes* planes) {
     // Sort the start end end values if they are not in order
     if (xStart>xEnd) {
         swap(xStart,xEnd);
         swap(dStart,dEnd);
         swap(cStart,cEnd);
-        swap(realvs.x,realvs.y);
+        swap(sstart,send);
     }
-    // If y lies outside then return
-    if( y >= (int)plotter->height() || y < 0)
-        return;
-    // If x lies outside then return
-    if( xStart >= (int)plotter->width() || xEnd < 0)
-        return;
 
     Linspace d(dStart,dEnd,xStart,xEnd);
     Lincolor c(cStart,cEnd,xStart,xEnd);
 
-    const Matrix<float>& shadow_xForm = sh->shadowMat();
-    Vector sstart = {realvs.x.x,realvs.x.y,realvs.x.z,realvs.x.w};
-    sstart = sstart * shadow_xForm;
-    sstart.projectionNormalize();
-    Vector send = {realvs.y.x,realvs.y.y,realvs.y.z,realvs.y.w};
-    send = send * shadow_xForm;
-    send.projectionNormalize();
     Vector delta = {0,0,0,0};
     if (xStart!=xEnd)
         delta = (send-sstart)/(float)(xEnd-xStart);
 
     // Clipping
-    xEnd = Math::min(xEnd,(int)plotter->width()-1);
-    xStart = Math::max(0,xStart);
+    xEnd = Math::min(xEnd,m_clip.x1);
+    // Clipping, the shadow co-ordinate must skip the clipped part
+    if (xStart < m_clip.x0) {
+        sstart += delta*(float)(m_clip.x0-xStart);
+        xStart = m_clip.x0;
+    }
+
+    if (planes) {
+        // Textured pixels go Texture::lanes at a time, the depth test
+        // first so that only the pixels drawn are sampled, unless the
+        // texels move the depths
+        const unsigned lanes = Texture::lanes;
+        bool deep = planes->depthScale != 0;
+        while (xStart <= xEnd) {
+            unsigned count = Math::min(lanes,(unsigned)(xEnd-xStart+1));
+            int de[lanes];
+            bool drawn[lanes];
+            bool any = false;
+            Color texel[lanes];
+            float offset[lanes];
+            if (deep)
+                texels(*planes,xStart,y,count,texel,offset);
+            for (unsigned k=0; k<count; k++) {
+                int x = xStart+k;
+                de[k] = d.at(x);
+                if (deep)
+                    de[k] += (int)(offset[k]*planes->depthScale);
+                drawn[k] = !masked(x,y) && de[k]<=ScreenPoint::maxDepth &&
+                    (overwrite ? de[k]>=(int)depth(x,y) :
+                     de[k]>(int)depth(x,y));
+                any = any || drawn[k];
+            }
+            if (any && !deep)
+                texels(*planes,xStart,y,count,texel);
+            for (unsigned k=0; k<count; k++, sstart += delta) {
+                // Empty texels leave the pixel as it is
+                if (!drawn[k] || texel[k].alpha<0x80)
+                    continue;
+                int x = xStart+k;
+                Color cl = interpolate ? c.at(x) : cStart;
+                cl.red = cl.red*texel[k].red/255;
+                cl.green = cl.green*texel[k].green/255;
+                cl.blue = cl.blue*texel[k].blue/255;
+                if (sh->onShadow(sstart)) {
+                    Color ncol = {cl.blue*0.5,cl.green*0.5,cl.red*0.5,
+                        0xff};
+                    write(x,y,de[k],ncol);
+                } else write(x,y,de[k],cl);
+            }
+            xStart += count;
+        }
+        return;
+    }
 
     while(xStart <= xEnd){
         // Depth clipping, checking with zero isn't necessary
@@ -207,23 +302,66 @@ void Drawer::hLineD(int y, int xStart, int dStart, int xEnd,
         // 0xffffff value because it is the maximum value it
         // should attain
         int de = d.at(xStart);
-        if ((overwrite && de<=ScreenPoint::maxDepth &&
-                    de>=depth(xStart,y)) ||
+        // Masked pixels are kept as they are
+        if (!masked(xStart,y) &&
+            ((overwrite && de<=ScreenPoint::maxDepth &&
+                    de>=(int)depth(xStart,y)) ||
             (!overwrite && de<=ScreenPoint::maxDepth &&
-             de>depth(xStart,y)) ) {
-            Color cl = c.at(xStart);
+             de>(int)depth(xStart,y))) ) {
+            Color cl = interpolate ? c.at(xStart) : cStart;
             if (sh->onShadow(sstart)) {
                 Color ncol = {cl.blue*0.5,cl.green*0.5,cl.red*0.5,
                     0xff};
-                plotter->plot(xStart,y,ncol,false);
-            } else plotter->plot(xStart,y,cl,false);
-            depth(xStart,y)=de;
+                write(xStart,y,de,ncol);
+            } else write(xStart,y,de,cl);
         }
         ++xStart;
-        sstart+=delta;
+        sstart += delta;
     }
 }
 
+// u and v are the planes of u/w and v/w over that of 1/w. The mipmap
+// level is chosen once for every 2x2 quad of pixels, from the rate u
+// and v change at its top left pixel: the larger of the steps in
+// texels along x and along y, as a power of two.
+void Drawer::texels(const TexturePlanes& p, int x, int y,
+        unsigned count, Color* out, float* depth) const {
+    const unsigned lanes = Texture::lanes;
+    const Texture* texture = p.texture;
+    float u[lanes], v[lanes];
+    int level[lanes];
+    float dy = y-p.y0;
+    for (unsigned k=0; k<lanes; k++) {
+        float dx = x+(int)k-p.x0;
+        float q = p.q[0] + p.q[1]*dx + p.q[2]*dy;
+        u[k] = (p.u[0] + p.u[1]*dx + p.u[2]*dy)/q;
+        v[k] = (p.v[0] + p.v[1]*dx + p.v[2]*dy)/q;
+    }
+
+    float width = texture->width(), height = texture->height();
+    int top = texture->levels()-1;
+    int quad = -1, chosen = 0;
+    for (unsigned k=0; k<count; k++) {
+        if (((x+(int)k)&~1) != quad) {
+            quad = (x+(int)k)&~1;
+            float dx = quad-p.x0, qy = (y&~1)-p.y0;
+            float q = p.q[0] + p.q[1]*dx + p.q[2]*qy;
+            float uq = (p.u[0] + p.u[1]*dx + p.u[2]*qy)/q;
+            float vq = (p.v[0] + p.v[1]*dx + p.v[2]*qy)/q;
+            float dudx = (p.u[1]-uq*p.q[1])/q*width;
+            float dvdx = (p.v[1]-vq*p.q[1])/q*height;
+            float dudy = (p.u[2]-uq*p.q[2])/q*width;
+            float dvdy = (p.v[2]-vq*p.q[2])/q*height;
+            float rho = Math::max(dudx*dudx+dvdx*dvdx,
+                    dudy*dudy+dvdy*dvdy);
+            chosen = rho>1 ? (int)(0.5f*std::log2(rho)+0.5f) : 0;
+            chosen = Math::min(chosen,top);
+        }
+        level[k] = chosen;
+    }
+    texture->sample(u,v,level,out,count,depth);
+}
+
 // We need to sort the points according to their
 // y-coordinates
 void Drawer::initAscending(ScreenPoint& start,
@@ -262,91 +400,281 @@ void Drawer::initAscending(ScreenPoint& start,
 }
 
 
+namespace {
+
+// Corners of a triangle given as screen points, and their unrounded
+// co-ordinates if known
+struct PointCorners {
+    const ScreenPoint* p[3];
+    const float* ux;
+    const float* uy;
+
+    int32_t x(int k) const { return p[k]->x; }
+    int32_t y(int k) const { return p[k]->y; }
+    int32_t d(int k) const { return p[k]->d; }
+    float fx(int k) const { return ux ? ux[k] : p[k]->x; }
+    float fy(int k) const { return uy ? uy[k] : p[k]->y; }
+    const Color& color(int k) const { return p[k]->color; }
+    float rx(int k) const { return p[k]->real.x; }
+    float ry(int k) const { return p[k]->real.y; }
+    float rz(int k) const { return p[k]->real.z; }
+};
+
+// Corners of a triangle in a vertex array
+struct ArrayCorners {
+    const ProjectedVertices* v;
+    unsigned i[3];
+    const Color* colors;
+    bool interpolate;
+
+    int32_t x(int k) const { return v->x[i[k]]; }
+    int32_t y(int k) const { return v->y[i[k]]; }
+    int32_t d(int k) const { return v->d[i[k]]; }
+    float fx(int k) const { return v->sx[i[k]]; }
+    float fy(int k) const { return v->sy[i[k]]; }
+    const Color& color(int k) const {
+        return colors[interpolate ? k : 0];
+    }
+    float rx(int k) const { return v->wx[i[k]]; }
+    float ry(int k) const { return v->wy[i[k]]; }
+    float rz(int k) const { return v->wz[i[k]]; }
+};
+
+}
+
 // Fill the triangle bounded by pt1, pt2 and pt3
-// What is implemented here is a special case of
-// scan-line filling which works only for triangles.
 // considering depth buffer
 // overwrite when true will enable overwrite to same depth
 void Drawer::fillD(ScreenPoint pt1, ScreenPoint pt2,
-        ScreenPoint pt3, bool interpolate,Shader* sh,bool overwrite) {
+        ScreenPoint pt3, bool interpolate,Shader* sh,bool overwrite,
+        const TextureCorners* texture) {
+    PointCorners corners = {{&pt1,&pt2,&pt3},NULL,NULL};
+    fillCorners(corners,interpolate,sh,overwrite,texture);
+}
 
-    ScreenPoint start, mid, end;
-    initAscending(start,mid,end,pt1,pt2,pt3);
+void Drawer::fillD(ScreenPoint pt1, ScreenPoint pt2, ScreenPoint pt3,
+        const float x[3], const float y[3], bool interpolate,
+        Shader* sh, bool overwrite, const TextureCorners* texture) {
+    PointCorners corners = {{&pt1,&pt2,&pt3},x,y};
+    fillCorners(corners,interpolate,sh,overwrite,texture);
+}
 
-    if(start.y == end.y)
-        return;
-    if( start.y >= (int)plotter->height() || end.y < 0)
+void Drawer::fillD(const ProjectedVertices& v, unsigned a, unsigned b,
+        unsigned c, const Color* colors, bool interpolate, Shader* sh,
+        bool overwrite, const TextureCorners* texture) {
+    ArrayCorners corners = {&v,{a,b,c},colors,interpolate};
+    fillCorners(corners,interpolate,sh,overwrite,texture);
+}
+
+// What is implemented here is a special case of
+// scan-line filling which works only for triangles.
+template<class Corners>
+void Drawer::fillCorners(const Corners& c, bool interpolate,
+        Shader* sh, bool overwrite, const TextureCorners* texture) {
+
+    // We need to sort the corners according to their
+    // y-coordinates, as initAscending() does
+    int s, m, e;
+    if (c.y(0)<=c.y(1) && c.y(0)<=c.y(2)) {
+        s = 0;
+        m = c.y(1)<=c.y(2) ? 1 : 2;
+        e = 3-m;
+    } else if (c.y(1)<=c.y(0) && c.y(1)<=c.y(2)) {
+        s = 1;
+        m = c.y(0)<=c.y(2) ? 0 : 2;
+        e = 2-m;
+    } else {
+        s = 2;
+        m = c.y(0)<=c.y(1) ? 0 : 1;
+        e = 1-m;
+    }
+    int startY = c.y(s), midY = c.y(m), endY = c.y(e);
+
+    if( startY > m_clip.y1 || endY < m_clip.y0)
         return;
     // THe negative region is backside of the camera
     // or away from the far point
-    if(start.d<=0 || end.d<=0 || mid.d<=0)
+    if(c.d(s)<=0 || c.d(e)<=0 || c.d(m)<=0)
         return;
 
-    Linspace x1(start.x,mid.x, start.y, mid.y);
-    Linspace x2(start.x,end.x, start.y, end.y);
-    Linspace x3(mid.x,end.x, mid.y, end.y);
-
-    Linspace d1(start.d,mid.d, start.y , mid.y);
-    Linspace d2(start.d,end.d, start.y, end.y);
-    Linspace d3(mid.d,end.d, mid.y, end.y);
-
-    LinspaceF ax(start.real.x,mid.real.x,start.y,mid.y);
-    LinspaceF ay(start.real.y,mid.real.y,start.y,mid.y);
-    LinspaceF az(start.real.z,mid.real.z,start.y,mid.y);
+    // Triangles of no area, flat ones included, would at most draw
+    // a line of pixels
+    long long area = (long long)(c.x(1)-c.x(0))*(c.y(2)-c.y(0)) -
+        (long long)(c.x(2)-c.x(0))*(c.y(1)-c.y(0));
+    if (area == 0) {
+        m_degenerate++;
+        return;
+    }
+    // Pixel centres are at whole co-ordinates, a triangle whose box
+    // has none inside it in x or in y covers none of them
+    float minX = Math::min(c.fx(0),Math::min(c.fx(1),c.fx(2)));
+    float maxX = Math::max(c.fx(0),Math::max(c.fx(1),c.fx(2)));
+    float minY = Math::min(c.fy(0),Math::min(c.fy(1),c.fy(2)));
+    float maxY = Math::max(c.fy(0),Math::max(c.fy(1),c.fy(2)));
+    if (std::ceil(minX) > maxX || std::ceil(minY) > maxY) {
+        m_micro++;
+        return;
+    }
 
-    LinspaceF bx(start.real.x,end.real.x,start.y,end.y);
-    LinspaceF by(start.real.y,end.real.y,start.y,end.y);
-    LinspaceF bz(start.real.z,end.real.z,start.y,end.y);
+    // The texture's planes through the corners, the area isn't zero
+    TexturePlanes planes;
+    if (texture) {
+        planes.texture = texture->texture;
+        planes.x0 = c.x(0);
+        planes.y0 = c.y(0);
+        planes.depthScale = texture->texture->hasDepth() ?
+            texture->depthScale : 0;
+        float ex1 = c.x(1)-c.x(0), ey1 = c.y(1)-c.y(0);
+        float ex2 = c.x(2)-c.x(0), ey2 = c.y(2)-c.y(0);
+        float inverse = 1/(float)area;
+        float f[3][3];
+        for (int k=0; k<3; k++) {
+            f[0][k] = texture->u[k]*texture->q[k];
+            f[1][k] = texture->v[k]*texture->q[k];
+            f[2][k] = texture->q[k];
+        }
+        float* plane[] = {planes.u,planes.v,planes.q};
+        for (int p=0; p<3; p++) {
+            float e1 = f[p][1]-f[p][0], e2 = f[p][2]-f[p][0];
+            plane[p][0] = f[p][0];
+            plane[p][1] = (e1*ey2 - e2*ey1)*inverse;
+            plane[p][2] = (e2*ex1 - e1*ex2)*inverse;
+        }
+    }
+    const TexturePlanes* textured = texture ? &planes : NULL;
 
-    LinspaceF cx(mid.real.x,end.real.x,mid.y,end.y);
-    LinspaceF cy(mid.real.y,end.real.y,mid.y,end.y);
-    LinspaceF cz(mid.real.z,end.real.z,mid.y,end.y);
+    int width = Math::max(c.x(0),Math::max(c.x(1),c.x(2))) -
+        Math::min(c.x(0),Math::min(c.x(1),c.x(2)));
+    if (width < smallTriangle && endY-startY < smallTriangle) {
+        m_small++;
+        fillSmall(c,s,m,e,interpolate,sh,overwrite,textured);
+        return;
+    }
 
-    Lincolor c1(start.color,mid.color,start.y,mid.y);
-    Lincolor c2(start.color,end.color,start.y,end.y);
-    Lincolor c3(mid.color,end.color,mid.y,end.y);
+    // The world positions are taken to the shadow buffer at the
+    // corners only, the rows interpolate them there. The map is
+    // linear until the divide, so the ends of a row are what
+    // projecting its world ends would give.
+    int corner[] = {s,m,e};
+    float h[3][4];
+    const Matrix<float>& shadow_xForm = sh->shadowMat();
+    for (int k=0; k<3; k++) {
+        float p[] = {c.rx(corner[k]),c.ry(corner[k]),c.rz(corner[k]),1};
+        for (int r=0; r<4; r++)
+            h[k][r] = shadow_xForm(r,0)*p[0] + shadow_xForm(r,1)*p[1] +
+                shadow_xForm(r,2)*p[2] + shadow_xForm(r,3)*p[3];
+    }
+    int y[] = {startY,midY,endY};
+
+    // Point of edge a-b at row i, projected
+    auto along = [&](int a, int b, int i) {
+        float t = y[b]==y[a] ? 0 : (float)(i-y[a])/(y[b]-y[a]);
+        Vector v = {h[a][0]+(h[b][0]-h[a][0])*t,
+            h[a][1]+(h[b][1]-h[a][1])*t,
+            h[a][2]+(h[b][2]-h[a][2])*t,
+            h[a][3]+(h[b][3]-h[a][3])*t};
+        v.projectionNormalize();
+        return v;
+    };
+
+    Linspace x1(c.x(s),c.x(m), startY, midY);
+    Linspace x2(c.x(s),c.x(e), startY, endY);
+    Linspace x3(c.x(m),c.x(e), midY, endY);
+
+    Linspace d1(c.d(s),c.d(m), startY , midY);
+    Linspace d2(c.d(s),c.d(e), startY, endY);
+    Linspace d3(c.d(m),c.d(e), midY, endY);
+
+    Lincolor c1(c.color(s),c.color(m),startY,midY);
+    Lincolor c2(c.color(s),c.color(e),startY,endY);
+    Lincolor c3(c.color(m),c.color(e),midY,endY);
+    const Color& color = c.color(s);
 
     // Clipping
-    if(interpolate){
-        start.y = Math::min(mid.y,Math::max(start.y,0));
-        for(int i=start.y;i<Math::min((int)plotter->height(),
-                    mid.y);i++) {
-            Vector rva = {ax.at(i),ay.at(i),az.at(i),1};
-            Vector rvb = {bx.at(i),by.at(i),bz.at(i),1};
-            Pair<Vector> realvs = {rva,rvb};
-            hLineD(i,x1.at(i),d1.at(i),x2.at(i),d2.at(i),
-                    c1.at(i),c2.at(i),realvs,sh,overwrite);
-        }
-        // Clipping
-        mid.y = Math::max(mid.y,0);
-        for(int i=mid.y;i<=Math::min((int)plotter->
-                    height()-1,end.y);i++) {
-            Vector rvb = {bx.at(i),by.at(i),bz.at(i),1};
-            Vector rvc = {cx.at(i),cy.at(i),cz.at(i),1};
-            Pair<Vector> realvs = {rvb,rvc};
-            hLineD(i, x2.at(i), d2.at(i), x3.at(i), d3.at(i),
-                    c2.at(i), c3.at(i), realvs,sh, overwrite);
-        }
+    int first = Math::max(startY,m_clip.y0);
+    int last = Math::min(endY,m_clip.y1);
+    for (int i=first; i<=last; i++) {
+        // Rows above the middle corner are between edges s-m and
+        // s-e, the others between s-e and m-e
+        bool upper = i<midY;
+        int xa = upper ? x1.at(i) : x2.at(i);
+        int xb = upper ? x2.at(i) : x3.at(i);
+        if (Math::min(xa,xb) > m_clip.x1 || Math::max(xa,xb) < m_clip.x0)
+            continue;
+        Vector sa = upper ? along(0,1,i) : along(0,2,i);
+        Vector sb = upper ? along(0,2,i) : along(1,2,i);
+        int da = upper ? d1.at(i) : d2.at(i);
+        int db = upper ? d2.at(i) : d3.at(i);
+        if (interpolate)
+            span(i,xa,da,xb,db,upper ? c1.at(i) : c2.at(i),
+                    upper ? c2.at(i) : c3.at(i),true,sa,sb,sh,overwrite,
+                    textured);
+        else
+            span(i,xa,da,xb,db,color,color,false,sa,sb,sh,overwrite,
+                    textured);
+    }
+}
 
-    } else {
-        start.y = Math::min(mid.y,Math::max(start.y,0));
-        for(int i=start.y;i<Math::min((int)plotter->height(),
-                    mid.y);i++) {
-            Vector rva = {ax.at(i),ay.at(i),az.at(i),1};
-            Vector rvb = {bx.at(i),by.at(i),bz.at(i),1};
-            Pair<Vector> realvs = {rva,rvb};
-            hLineD(i,x1.at(i),d1.at(i),x2.at(i),d2.at(i),
-                    start.color,realvs,sh,overwrite);
-        }
-        // Clipping
-        mid.y = Math::max(mid.y,0);
-        for(int i=mid.y;i<=Math::min((int)plotter->height()-1,
-                    end.y);i++) {
-            Vector rvb = {bx.at(i),by.at(i),bz.at(i),1};
-            Vector rvc = {cx.at(i),cy.at(i),cz.at(i),1};
-            Pair<Vector> realvs = {rvb,rvc};
-            hLineD(i, x2.at(i), d2.at(i), x3.at(i), d3.at(i),
-                    start.color, realvs,sh, overwrite);
-        }
+// A small triangle has few rows of few pixels, spans already step
+// the shadow co-ordinate linearly along x, so here it is stepped
+// linearly along y too: the corners are projected once and the
+// co-ordinate of every row end is read off the plane through them,
+// with no divide per row. Depth and color come from the corners the
+// same way.
+template<class Corners>
+void Drawer::fillSmall(const Corners& c, int s, int m, int e,
+        bool interpolate, Shader* sh, bool overwrite,
+        const TexturePlanes* textured) {
+    Vector p[3];
+    int corner[] = {s,m,e};
+    const Matrix<float>& shadow_xForm = sh->shadowMat();
+    for (int k=0; k<3; k++) {
+        int j = corner[k];
+        p[k] = Vector(c.rx(j),c.ry(j),c.rz(j),1);
+        p[k] = p[k] * shadow_xForm;
+        p[k].projectionNormalize();
+    }
+
+    // Gradients of the plane in x and y, the area isn't zero here
+    int x0 = c.x(s), y0 = c.y(s);
+    int ex1 = c.x(m)-x0, ey1 = c.y(m)-y0;
+    int ex2 = c.x(e)-x0, ey2 = c.y(e)-y0;
+    float area = (float)ex1*ey2 - (float)ex2*ey1;
+    Vector e1 = p[1]-p[0], e2 = p[2]-p[0];
+    Vector gx = (e1*(float)ey2 - e2*(float)ey1)/area;
+    Vector gy = (e2*(float)ex1 - e1*(float)ex2)/area;
+
+    int startY = y0, midY = c.y(m), endY = c.y(e);
+    Linspace x1(x0,c.x(m),startY,midY);
+    Linspace x2(x0,c.x(e),startY,endY);
+    Linspace x3(c.x(m),c.x(e),midY,endY);
+    Linspace d1(c.d(s),c.d(m),startY,midY);
+    Linspace d2(c.d(s),c.d(e),startY,endY);
+    Linspace d3(c.d(m),c.d(e),midY,endY);
+    Lincolor c1(c.color(s),c.color(m),startY,midY);
+    Lincolor c2(c.color(s),c.color(e),startY,endY);
+    Lincolor c3(c.color(m),c.color(e),midY,endY);
+    const Color& color = c.color(s);
+
+    int first = Math::max(startY,m_clip.y0);
+    int last = Math::min(endY,m_clip.y1);
+    for (int i=first; i<=last; i++) {
+        bool upper = i<midY;
+        int xa = upper ? x1.at(i) : x2.at(i);
+        int xb = upper ? x2.at(i) : x3.at(i);
+        if (Math::min(xa,xb) > m_clip.x1 || Math::max(xa,xb) < m_clip.x0)
+            continue;
+        Vector row = p[0] + gy*(float)(i-y0);
+        Vector sa = row + gx*(float)(xa-x0);
+        Vector sb = row + gx*(float)(xb-x0);
+        int da = upper ? d1.at(i) : d2.at(i);
+        int db = upper ? d2.at(i) : d3.at(i);
+        if (interpolate)
+            span(i,xa,da,xb,db,upper ? c1.at(i) : c2.at(i),
+                    upper ? c2.at(i) : c3.at(i),true,sa,sb,sh,overwrite,
+                    textured);
+        else
+            span(i,xa,da,xb,db,color,color,false,sa,sb,sh,overwrite,
+                    textured);
     }
 }
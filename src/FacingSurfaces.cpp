@@ -0,0 +1,47 @@
+#include "FacingSurfaces.h"
+#include "Object.h"
+
+void FacingSurfaces::cull(const ProjectedVertices& v,
+        const std::vector<Surface>& surfaces,
+        const std::vector<unsigned>* subset, bool test, bool keepBack) {
+    unsigned count = subset ? subset->size() : surfaces.size();
+    bits.assign((surfaces.size()+31)/32,test ? 0 : ~0u);
+    list.resize(count);
+    if (!test) {
+        for (unsigned n=0; n<count; n++)
+            list[n] = subset ? (*subset)[n] : n;
+        return;
+    }
+
+    const float* sx = v.sx.data();
+    const float* sy = v.sy.data();
+    unsigned kept = 0;
+    for (unsigned n=0; n<count; n+=batch) {
+        unsigned lanes = count-n < batch ? count-n : batch;
+        // Gather the corners first so that the areas are taken
+        // with straight arithmetic over the lanes
+        unsigned index[batch];
+        float x0[batch], y0[batch], x1[batch], y1[batch];
+        float x2[batch], y2[batch];
+        for (unsigned l=0; l<batch; l++) {
+            index[l] = subset ? (*subset)[n+(l<lanes ? l : 0)] :
+                n+(l<lanes ? l : 0);
+            const Surface& s = surfaces[index[l]];
+            x0[l] = sx[s.x]; y0[l] = sy[s.x];
+            x1[l] = sx[s.y]; y1[l] = sy[s.y];
+            x2[l] = sx[s.z]; y2[l] = sy[s.z];
+        }
+        unsigned facing[batch];
+        for (unsigned l=0; l<batch; l++)
+            facing[l] = (x1[l]-x0[l])*(y2[l]-y1[l]) -
+                (y1[l]-y0[l])*(x2[l]-x1[l]) < 0;
+
+        // Compacted without branching on the result
+        for (unsigned l=0; l<lanes; l++) {
+            bits[index[l]>>5] |= facing[l]<<(index[l]&31);
+            list[kept] = index[l];
+            kept += facing[l] | keepBack;
+        }
+    }
+    list.resize(kept);
+}
@@ -0,0 +1,282 @@
+#include <cmath>
+#include "Impostor.h"
+
+Impostor::Impostor(Object* mesh, unsigned size, unsigned azimuths,
+        unsigned elevations) :
+    mp_mesh(mesh),
+    m_size(size),
+    m_azimuths(azimuths),
+    m_elevations(elevations),
+    m_views(azimuths*elevations)
+{
+    // The mesh is pictured in model co-ordinates
+    if (!size || !azimuths || !elevations)
+        throw ex::InitFailure();
+    const Bounds& b = mesh->modelBounds();
+    m_center = Vector(b.center.x,b.center.y,b.center.z,1);
+    m_radius = Math::max(b.radius,1e-6f);
+    // Texture co-ordinates wrap, an eighth of the picture at every side
+    // is left empty so that filtering doesn't bring in the other side
+    m_extent = m_radius*4/3;
+}
+
+// The elevations are spread evenly, none of them straight up or down,
+// so that the top of a picture is always the side nearest the y axis
+void Impostor::axes(unsigned v, Vector& toViewer, Vector& right,
+        Vector& up) const {
+    unsigned a = v%m_azimuths, e = v/m_azimuths;
+    float azimuth = 2*M_PI*a/m_azimuths;
+    float elevation = M_PI*((e+0.5f)/m_elevations - 0.5f);
+    toViewer = Vector(std::cos(elevation)*std::cos(azimuth),
+            std::sin(elevation),std::cos(elevation)*std::sin(azimuth),0);
+    up = (Vector(0,1,0,0) - toViewer*toViewer.y).normalized();
+    up.w = 0;
+    // As TfMatrix::lookAt() takes the side of a camera looking back
+    // along toViewer
+    right = (up*toViewer).normalized();
+    right.w = 0;
+}
+
+// The direction is taken to model co-ordinates by the inverse of the
+// linear part of the instance, whose rows are the cross products of
+// its columns over the determinant
+unsigned Impostor::view(const Instance& instance, const Vector& eye) const {
+    const float* t = instance.transform;
+    Vector columns[3];
+    for (int c=0; c<3; c++)
+        columns[c] = Vector(t[c],t[4+c],t[8+c],0);
+    float center[3];
+    for (int r=0; r<3; r++)
+        center[r] = t[r*4]*m_center.x + t[r*4+1]*m_center.y +
+            t[r*4+2]*m_center.z + t[r*4+3];
+    Vector toEye(eye.x-center[0],eye.y-center[1],eye.z-center[2],0);
+    float det = columns[0]%(columns[1]*columns[2]);
+    Vector dir((columns[1]*columns[2])%toEye,
+            (columns[2]*columns[0])%toEye,
+            (columns[0]*columns[1])%toEye,0);
+    if (det < 0)
+        dir = -dir;
+    float length = dir.magnitude();
+    if (length == 0)
+        return 0;
+    dir = dir/length;
+
+    float elevation = std::asin(Math::max(-1.0f,Math::min(dir.y,1.0f)));
+    float azimuth = std::atan2(dir.z,dir.x);
+    int e = std::floor((elevation/M_PI + 0.5f)*m_elevations);
+    int a = Math::round(azimuth/(2*M_PI)*m_azimuths);
+    e = Math::max(0,Math::min(e,(int)m_elevations-1));
+    a = ((a%(int)m_azimuths) + m_azimuths)%m_azimuths;
+    return e*m_azimuths + a;
+}
+
+Matrix<float> Impostor::captureTransform(unsigned v,
+        const Matrix<float>& model) const {
+    Vector toViewer, right, up;
+    axes(v,toViewer,right,up);
+    float half = m_size*0.5f;
+    float s = half/m_extent;
+    Matrix<float> picture({4,4});
+    picture.initialize(
+            right.x*s,  right.y*s,  right.z*s,  half - (right%m_center)*s,
+            -up.x*s,    -up.y*s,    -up.z*s,    half + (up%m_center)*s,
+            toViewer.x/m_radius, toViewer.y/m_radius, toViewer.z/m_radius,
+                -(toViewer%m_center)/m_radius,
+            0,          0,          0,          1
+            );
+    return picture*model.inverse();
+}
+
+// The surfaces left facing are scan converted at the texel centres,
+// the nearest kept. Empty texels then take the colors of the texels
+// next to them, so that filtering at the edges doesn't blend in black.
+void Impostor::capture(unsigned v) {
+    if (v>=m_views.size())
+        throw ex::OutOfBounds();
+    const ProjectedVertices& p = mp_mesh->projected();
+    const FacingSurfaces& facing = mp_mesh->facing();
+    bool gouraud = mp_mesh->getShading()==Shading::gouraud;
+    unsigned n = m_size*m_size;
+    std::vector<Color> colors(n,Color({0,0,0,0}));
+    std::vector<float> depth(n,-2);
+
+    for (unsigned k=0; k<facing.list.size(); k++) {
+        unsigned i = facing.list[k];
+        const Surface& s = mp_mesh->getSurface(i);
+        unsigned corner[] = {s.x,s.y,s.z};
+        float x[3], y[3], z[3];
+        Color c[3];
+        for (int h=0; h<3; h++) {
+            x[h] = p.sx[corner[h]];
+            y[h] = p.sy[corner[h]];
+            z[h] = p.sz[corner[h]];
+            c[h] = mp_mesh->getColor(gouraud ? i*3+h : i);
+        }
+        float area = (x[1]-x[0])*(y[2]-y[0]) - (x[2]-x[0])*(y[1]-y[0]);
+        if (area == 0)
+            continue;
+        int x0 = Math::max(0,(int)std::floor(
+                    Math::min(x[0],Math::min(x[1],x[2]))));
+        int x1 = Math::min((int)m_size-1,(int)std::ceil(
+                    Math::max(x[0],Math::max(x[1],x[2]))));
+        int y0 = Math::max(0,(int)std::floor(
+                    Math::min(y[0],Math::min(y[1],y[2]))));
+        int y1 = Math::min((int)m_size-1,(int)std::ceil(
+                    Math::max(y[0],Math::max(y[1],y[2]))));
+        for (int ty=y0; ty<=y1; ty++)
+            for (int tx=x0; tx<=x1; tx++) {
+                float px = tx+0.5f, py = ty+0.5f;
+                // Weights of the corners, all of one sign inside
+                float w[3];
+                for (int h=0; h<3; h++) {
+                    int a = (h+1)%3, b = (h+2)%3;
+                    w[h] = ((x[b]-x[a])*(py-y[a]) -
+                            (px-x[a])*(y[b]-y[a]))/area;
+                }
+                if (w[0]<0 || w[1]<0 || w[2]<0)
+                    continue;
+                float d = w[0]*z[0] + w[1]*z[1] + w[2]*z[2];
+                unsigned at = ty*m_size+tx;
+                if (d <= depth[at])
+                    continue;
+                depth[at] = d;
+                colors[at] = {
+                    (uint8_t)(w[0]*c[0].blue+w[1]*c[1].blue+w[2]*c[2].blue),
+                    (uint8_t)(w[0]*c[0].green+w[1]*c[1].green+
+                            w[2]*c[2].green),
+                    (uint8_t)(w[0]*c[0].red+w[1]*c[1].red+w[2]*c[2].red),
+                    255};
+            }
+    }
+
+    // The covered texels and one more around them, which filtering
+    // reaches into
+    View& view = m_views[v];
+    view.x0 = view.y0 = m_size;
+    view.x1 = view.y1 = 0;
+    for (unsigned i=0; i<n; i++) {
+        if (!colors[i].alpha) {
+            depth[i] = 0;
+            continue;
+        }
+        unsigned tx = i%m_size, ty = i/m_size;
+        view.x0 = Math::min(view.x0,tx>0 ? tx-1 : 0);
+        view.y0 = Math::min(view.y0,ty>0 ? ty-1 : 0);
+        view.x1 = Math::max(view.x1,Math::min(tx+2,m_size));
+        view.y1 = Math::max(view.y1,Math::min(ty+2,m_size));
+    }
+    for (int pass=0; pass<2; pass++) {
+        std::vector<Color> grown(colors);
+        for (int ty=0; ty<(int)m_size; ty++)
+            for (int tx=0; tx<(int)m_size; tx++) {
+                unsigned at = ty*m_size+tx;
+                if (colors[at].alpha || colors[at].red ||
+                        colors[at].green || colors[at].blue)
+                    continue;
+                unsigned b = 0, g = 0, r = 0, count = 0;
+                int nx[] = {tx-1,tx+1,tx,tx}, ny[] = {ty,ty,ty-1,ty+1};
+                for (int k=0; k<4; k++) {
+                    if (nx[k]<0 || ny[k]<0 || nx[k]>=(int)m_size ||
+                            ny[k]>=(int)m_size)
+                        continue;
+                    const Color& o = colors[ny[k]*m_size+nx[k]];
+                    if (!o.alpha && !o.red && !o.green && !o.blue)
+                        continue;
+                    b += o.blue; g += o.green; r += o.red;
+                    count++;
+                }
+                if (count)
+                    grown[at] = {(uint8_t)(b/count),(uint8_t)(g/count),
+                        (uint8_t)(r/count),0};
+            }
+        colors.swap(grown);
+    }
+    view.picture.reset(new Texture(m_size,m_size,colors.data(),
+                depth.data()));
+}
+
+void Impostor::invalidate() {
+    for (unsigned v=0; v<m_views.size(); v++)
+        m_views[v].picture.reset();
+}
+
+bool Impostor::quad(unsigned v, const Instance& instance,
+        const Matrix<float>& transformation,
+        CommandBuffer::Command triangles[2]) const {
+    if (v>=m_views.size() || !m_views[v].picture)
+        return false;
+    const View& view = m_views[v];
+    // Nothing of the mesh faces this way
+    if (view.x0>=view.x1 || view.y0>=view.y1)
+        return false;
+    Vector toViewer, right, up;
+    axes(v,toViewer,right,up);
+    float m[16];
+    for (unsigned e=0; e<16; e++)
+        m[e] = transformation(e);
+    const float* t = instance.transform;
+
+    // Model co-ordinates to the world and on to the device
+    auto place = [t](const Vector& a, float* world) {
+        for (int r=0; r<3; r++)
+            world[r] = t[r*4]*a.x + t[r*4+1]*a.y + t[r*4+2]*a.z + t[r*4+3];
+    };
+    auto project = [&m](const float* world, float* out) {
+        for (int r=0; r<4; r++)
+            out[r] = m[r*4]*world[0] + m[r*4+1]*world[1] +
+                m[r*4+2]*world[2] + m[r*4+3];
+        return out[3] > 0;
+    };
+
+    // The corners of the covered texels clockwise from the top left
+    float u[] = {(float)view.x0,(float)view.x1,(float)view.x1,
+        (float)view.x0};
+    float tv[] = {(float)view.y0,(float)view.y0,(float)view.y1,
+        (float)view.y1};
+    float world[4][3], x[4], y[4], q[4];
+    int32_t d[4];
+    for (int c=0; c<4; c++) {
+        u[c] /= m_size;
+        tv[c] /= m_size;
+        Vector corner = m_center + right*((2*u[c]-1)*m_extent) +
+            up*((1-2*tv[c])*m_extent);
+        float h[4];
+        place(corner,world[c]);
+        if (!project(world[c],h))
+            return false;
+        q[c] = 1/h[3];
+        x[c] = h[0]*q[c];
+        y[c] = h[1]*q[c];
+        d[c] = Math::round(h[2]*q[c]);
+    }
+
+    // The screen depth of a texel depth of 1, a radius toward the viewer
+    float center[3], front[3], hc[4], hf[4];
+    place(m_center,center);
+    place(m_center + toViewer*m_radius,front);
+    if (!project(center,hc) || !project(front,hf))
+        return false;
+    float depthScale = hf[2]/hf[3] - hc[2]/hc[3];
+
+    int index[2][3] = {{0,1,2},{0,2,3}};
+    for (int k=0; k<2; k++) {
+        CommandBuffer::Command& cmd = triangles[k];
+        for (int h=0; h<3; h++) {
+            int c = index[k][h];
+            cmd.x[h] = x[c];
+            cmd.y[h] = y[c];
+            cmd.d[h] = d[c];
+            cmd.color[h] = instance.tint;
+            for (int r=0; r<3; r++)
+                cmd.real[h][r] = world[c][r];
+            cmd.texture.u[h] = u[c];
+            cmd.texture.v[h] = tv[c];
+            cmd.texture.q[h] = q[c];
+        }
+        cmd.gouraud = false;
+        cmd.overwrite = true;
+        cmd.texture.texture = view.picture.get();
+        cmd.texture.depthScale = depthScale;
+    }
+    return true;
+}
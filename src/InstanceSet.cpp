@@ -0,0 +1,74 @@
+#include "InstanceSet.h"
+
+InstanceSet::InstanceSet(Object* mesh) :
+    mp_mesh(mesh),
+    m_bounds(mesh->modelBounds()),
+    m_version(0)
+{
+    if (mesh->node())
+        throw ex::InitFailure();
+    // The mesh keeps the node, moving it from instance to instance
+    // leaves the mesh's own version as it is
+    mesh->setNode(&m_node);
+}
+
+unsigned InstanceSet::add(const Matrix<float>& transform, Color tint) {
+    m_instances.push_back(Instance());
+    set(m_instances.size()-1,transform);
+    m_instances.back().tint = tint;
+    return m_instances.size()-1;
+}
+
+void InstanceSet::set(unsigned i, const Matrix<float>& transform) {
+    if (i>=m_instances.size())
+        throw ex::OutOfBounds();
+    if (transform.row()!=4 || transform.col()!=4)
+        throw ex::DimensionMismatch();
+    for (int r=0; r<3; r++)
+        for (int c=0; c<4; c++)
+            m_instances[i].transform[r*4+c] = transform(r,c);
+    m_version++;
+}
+
+void InstanceSet::setTint(unsigned i, Color tint) {
+    if (i>=m_instances.size())
+        throw ex::OutOfBounds();
+    m_instances[i].tint = tint;
+    m_version++;
+}
+
+Matrix<float> InstanceSet::transform(unsigned i) const {
+    const float* t = instance(i).transform;
+    Matrix<float> m({4,4});
+    m.initialize(
+            t[0],   t[1],   t[2],   t[3],
+            t[4],   t[5],   t[6],   t[7],
+            t[8],   t[9],   t[10],  t[11],
+            0,      0,      0,      1
+            );
+    return m;
+}
+
+// The box of the eight corners taken to the world
+void InstanceSet::box(unsigned i, Vector& min, Vector& max) const {
+    const float* t = instance(i).transform;
+    const Vector& lo = m_bounds.min;
+    const Vector& hi = m_bounds.max;
+    for (int c=0; c<8; c++) {
+        float p[] = {(c&1)?hi.x:lo.x, (c&2)?hi.y:lo.y, (c&4)?hi.z:lo.z};
+        float w[3];
+        for (int r=0; r<3; r++)
+            w[r] = t[r*4]*p[0] + t[r*4+1]*p[1] + t[r*4+2]*p[2] + t[r*4+3];
+        if (c==0) {
+            min = max = Vector(w[0],w[1],w[2],1);
+            continue;
+        }
+        min.x = Math::min(min.x,w[0]); max.x = Math::max(max.x,w[0]);
+        min.y = Math::min(min.y,w[1]); max.y = Math::max(max.y,w[1]);
+        min.z = Math::min(min.z,w[2]); max.z = Math::max(max.z,w[2]);
+    }
+}
+
+void InstanceSet::place(unsigned i) {
+    m_node.setLocal(transform(i));
+}
@@ -0,0 +1,74 @@
+#include "LODChain.h"
+#include "Simplifier.h"
+
+// Simplify the base, every level continuing from the one before
+LODChain::LODChain(Object* base, unsigned levels, unsigned minSurfaces) :
+    m_levels(1,base),
+    m_vertexOf(1),
+    m_baseVersion(base->modelVersion()),
+    m_current(0),
+    m_pixelsPerSurface(16),
+    m_hysteresis(0.15)
+{
+    Simplifier simplifier(base);
+    unsigned surfaces = base->surfaceCount();
+    for (unsigned l=0; l<levels; l++) {
+        unsigned target = surfaces/2;
+        if (target < minSurfaces)
+            break;
+        unsigned left = simplifier.simplify(target);
+        // Stuck, the remaining collapses would all flip surfaces
+        if (left*10 > surfaces*9)
+            break;
+        surfaces = left;
+        m_vertexOf.push_back(std::vector<unsigned>());
+        m_levels.push_back(simplifier.object(m_vertexOf.back()));
+    }
+}
+
+LODChain::~LODChain() {
+    for (unsigned l=1; l<m_levels.size(); l++)
+        delete m_levels[l];
+}
+
+// Copy the base's vertices and render state to the levels. A move of
+// the base's node needs nothing, the levels share the node.
+void LODChain::sync() {
+    Object* base = m_levels[0];
+    if (!changed())
+        return;
+    m_baseVersion = base->modelVersion();
+    for (unsigned l=1; l<m_levels.size(); l++) {
+        Object* obj = m_levels[l];
+        const std::vector<unsigned>& vertexOf = m_vertexOf[l];
+        for (unsigned i=0; i<vertexOf.size(); i++)
+            obj->setVertex(i,base->getModelVertex(vertexOf[i]));
+        obj->setMaterials(base->materials());
+        obj->setShading(base->getShading());
+        obj->backface(base->backface());
+        obj->bothsides(base->bothsides());
+        obj->setStatic(base->isStatic());
+        if (obj->node()!=base->node())
+            obj->setNode(base->node());
+    }
+}
+
+// The finest level with no more surfaces than the pixels it covers
+// allow
+unsigned LODChain::levelFor(float size) const {
+    float budget = size*size/m_pixelsPerSurface;
+    for (unsigned l=0; l<m_levels.size(); l++)
+        if (m_levels[l]->surfaceCount() <= budget)
+            return l;
+    return m_levels.size()-1;
+}
+
+// Keep the current level while the size is within the hysteresis
+// band around it
+Object* LODChain::select(float size) {
+    unsigned finer = levelFor(size*(1+m_hysteresis));
+    unsigned coarser = levelFor(size*(1-m_hysteresis));
+    if (m_current < finer || m_current > coarser)
+        m_current = levelFor(size);
+    return m_levels[m_current];
+}
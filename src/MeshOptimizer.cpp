@@ -0,0 +1,301 @@
+#include <algorithm>
+#include <cmath>
+#include "MeshOptimizer.h"
+
+namespace {
+
+// Weights of Forsyth's vertex score
+const float cacheDecayPower = 1.5;
+const float lastSurfaceScore = 0.75;
+const float valenceBoostScale = 2;
+const float valenceBoostPower = 0.5;
+
+// How much drawing a surface of a vertex now is worth, given its
+// place in the cache, -1 when outside it, and the number of its
+// surfaces not yet drawn. Vertices the last surface used score a
+// fixed amount so that strips don't just bounce between them, those
+// with few surfaces left are boosted so that they are finished off.
+float vertexScore(int position, unsigned valence) {
+    if (valence == 0)
+        return -1;
+    float score = 0;
+    if (position >= 0) {
+        if (position < 3)
+            score = lastSurfaceScore;
+        else
+            score = std::pow(1 - (float)(position-3)/
+                    (MeshOptimizer::cacheSize-3),cacheDecayPower);
+    }
+    return score + valenceBoostScale*
+        std::pow((float)valence,-valenceBoostPower);
+}
+
+}
+
+MeshOptimizer::MeshOptimizer(Object* obj) :
+    m_welded(0),
+    m_weldedNormals(0),
+    m_degenerate(0),
+    m_unused(0)
+{
+    Matrix<float>& vertices = obj->vmatrix();
+    Matrix<float>& normals = obj->vnmatrix();
+    Matrix<float>& texcoords = obj->vtmatrix();
+    unsigned vcount = vertices.col(), ncount = normals.col();
+    unsigned tcount = texcoords.col();
+    m_acmrBefore = acmr(obj->surfaces(),vcount);
+
+    std::vector<unsigned> vremap, nremap, tremap;
+    m_welded = weld(vertices,vremap);
+    m_weldedNormals = weld(normals,nremap);
+    weld(texcoords,tremap);
+
+    // The surfaces are taken in runs of one material
+    obj->sortByMaterial();
+    std::vector<Surface> surfaces;
+    surfaces.reserve(obj->surfaceCount());
+    for (unsigned i=0; i<obj->surfaceCount(); i++) {
+        Surface s = obj->getSurface(i);
+        s.x = vremap[s.x]; s.y = vremap[s.y]; s.z = vremap[s.z];
+        if (s.vertexNormals) {
+            s.nx = nremap[s.nx]; s.ny = nremap[s.ny]; s.nz = nremap[s.nz];
+        }
+        if (s.textured) {
+            s.tx = tremap[s.tx]; s.ty = tremap[s.ty]; s.tz = tremap[s.tz];
+        }
+        if (s.x==s.y || s.y==s.z || s.z==s.x) {
+            m_degenerate++;
+            continue;
+        }
+        Vector a = obj->getModelVertex(s.x);
+        Vector cross = (obj->getModelVertex(s.y)-a)*
+            (obj->getModelVertex(s.z)-a);
+        if (cross%cross == 0) {
+            m_degenerate++;
+            continue;
+        }
+        surfaces.push_back(s);
+    }
+
+    // Surfaces are reordered within their material, so that the runs
+    // of one material stay whole
+    std::vector<unsigned> drawOrder;
+    drawOrder.reserve(surfaces.size());
+    for (unsigned b=0, e=0; b<surfaces.size(); b=e) {
+        while (e<surfaces.size() &&
+                surfaces[e].material==surfaces[b].material)
+            e++;
+        std::vector<Surface> run(surfaces.begin()+b,surfaces.begin()+e);
+        std::vector<unsigned> runOrder = order(run,vcount);
+        for (unsigned k=0; k<runOrder.size(); k++)
+            drawOrder.push_back(b+runOrder[k]);
+    }
+
+    // Vertices and normals are numbered in the order the reordered
+    // surfaces first use them, then the ends of edges
+    std::vector<unsigned> vnew(vcount,~0u), nnew(ncount,~0u);
+    std::vector<unsigned> tnew(tcount,~0u);
+    unsigned vused = 0, nused = 0, tused = 0;
+    std::vector<Surface> sorted;
+    sorted.reserve(surfaces.size());
+    for (unsigned k=0; k<drawOrder.size(); k++) {
+        Surface s = surfaces[drawOrder[k]];
+        unsigned* v[] = {&s.x,&s.y,&s.z};
+        unsigned* n[] = {&s.nx,&s.ny,&s.nz};
+        unsigned* t[] = {&s.tx,&s.ty,&s.tz};
+        for (int c=0; c<3; c++) {
+            if (vnew[*v[c]] == ~0u)
+                vnew[*v[c]] = vused++;
+            *v[c] = vnew[*v[c]];
+            if (s.vertexNormals) {
+                if (nnew[*n[c]] == ~0u)
+                    nnew[*n[c]] = nused++;
+                *n[c] = nnew[*n[c]];
+            }
+            if (s.textured) {
+                if (tnew[*t[c]] == ~0u)
+                    tnew[*t[c]] = tused++;
+                *t[c] = tnew[*t[c]];
+            }
+        }
+        sorted.push_back(s);
+    }
+    for (unsigned i=0; i<obj->edgeCount(); i++) {
+        Edge& e = obj->getEdge(i);
+        unsigned* v[] = {&e.x,&e.y};
+        for (int c=0; c<2; c++) {
+            unsigned w = vremap[*v[c]];
+            if (vnew[w] == ~0u)
+                vnew[w] = vused++;
+            *v[c] = vnew[w];
+        }
+    }
+    m_unused = vcount - m_welded - vused;
+
+    Matrix<float> newVertices({4,vused});
+    for (unsigned i=0; i<vcount; i++)
+        if (vnew[i] != ~0u)
+            for (unsigned r=0; r<4; r++)
+                newVertices(r,vnew[i]) = vertices(r,i);
+    Matrix<float> newNormals({4,nused});
+    for (unsigned i=0; i<ncount; i++)
+        if (nnew[i] != ~0u)
+            for (unsigned r=0; r<4; r++)
+                newNormals(r,nnew[i]) = normals(r,i);
+
+    Matrix<float> newTexcoords({2,tused});
+    for (unsigned i=0; i<tcount; i++)
+        if (tnew[i] != ~0u)
+            for (unsigned r=0; r<2; r++)
+                newTexcoords(r,tnew[i]) = texcoords(r,i);
+
+    vertices = newVertices;
+    normals = newNormals;
+    texcoords = newTexcoords;
+    obj->setSurfaces(sorted);
+    m_acmrAfter = acmr(sorted,vused);
+}
+
+// Equal vertices sort next to each other, the lowest index first
+unsigned MeshOptimizer::weld(const Matrix<float>& m,
+        std::vector<unsigned>& remap) {
+    unsigned n = m.col();
+    auto same = [&](unsigned a, unsigned b) {
+        for (unsigned r=0; r<m.row(); r++)
+            if (m(r,a) != m(r,b))
+                return false;
+        return true;
+    };
+    std::vector<unsigned> sorted(n);
+    for (unsigned i=0; i<n; i++)
+        sorted[i] = i;
+    std::sort(sorted.begin(),sorted.end(),[&](unsigned a, unsigned b) {
+        for (unsigned r=0; r<m.row(); r++)
+            if (m(r,a) != m(r,b))
+                return m(r,a) < m(r,b);
+        return a < b;
+    });
+
+    remap.resize(n);
+    unsigned welded = 0, first = 0;
+    for (unsigned k=0; k<n; k++) {
+        unsigned i = sorted[k];
+        if (k>0 && same(first,i))
+            welded++;
+        else
+            first = i;
+        remap[i] = first;
+    }
+    return welded;
+}
+
+// Greedily draw next the surface scoring highest among those of the
+// vertices in a simulated LRU cache, adding up the scores of its
+// vertices. When none is left there, the first surface not drawn is
+// taken, which keeps the whole linear in the surfaces.
+std::vector<unsigned> MeshOptimizer::order(
+        const std::vector<Surface>& surfaces, unsigned vertices) {
+    unsigned count = surfaces.size();
+
+    // Surfaces around every vertex, those not drawn yet are kept in
+    // front, "valence" of them
+    std::vector<unsigned> valence(vertices,0), start(vertices+1,0);
+    for (unsigned f=0; f<count; f++) {
+        valence[surfaces[f].x]++;
+        valence[surfaces[f].y]++;
+        valence[surfaces[f].z]++;
+    }
+    for (unsigned v=0; v<vertices; v++)
+        start[v+1] = start[v]+valence[v];
+    std::vector<unsigned> around(start[vertices]);
+    std::vector<unsigned> filled(start.begin(),start.end()-1);
+    for (unsigned f=0; f<count; f++) {
+        around[filled[surfaces[f].x]++] = f;
+        around[filled[surfaces[f].y]++] = f;
+        around[filled[surfaces[f].z]++] = f;
+    }
+
+    std::vector<int> position(vertices,-1);
+    std::vector<float> score(vertices);
+    for (unsigned v=0; v<vertices; v++)
+        score[v] = vertexScore(-1,valence[v]);
+    std::vector<float> surfaceScore(count);
+    for (unsigned f=0; f<count; f++)
+        surfaceScore[f] = score[surfaces[f].x]+score[surfaces[f].y]+
+            score[surfaces[f].z];
+
+    // Most recently used first
+    std::vector<unsigned> cache, next;
+    std::vector<bool> drawn(count,false);
+    std::vector<unsigned> result;
+    result.reserve(count);
+    unsigned scan = 0;
+    int best = -1;
+    while (result.size() < count) {
+        if (best < 0) {
+            while (drawn[scan])
+                scan++;
+            best = scan;
+        }
+        drawn[best] = true;
+        result.push_back(best);
+
+        const Surface& s = surfaces[best];
+        unsigned v[] = {s.x,s.y,s.z};
+        for (int c=0; c<3; c++) {
+            unsigned* list = &around[start[v[c]]];
+            for (unsigned k=0; k<valence[v[c]]; k++)
+                if (list[k] == (unsigned)best) {
+                    std::swap(list[k],list[valence[v[c]]-1]);
+                    break;
+                }
+            valence[v[c]]--;
+        }
+
+        next.assign(v,v+3);
+        for (unsigned k=0; k<cache.size(); k++)
+            if (cache[k]!=v[0] && cache[k]!=v[1] && cache[k]!=v[2])
+                next.push_back(cache[k]);
+        cache.swap(next);
+
+        // Rescore the vertices in the cache and those just pushed out
+        // of it, and the surfaces around them not drawn yet
+        best = -1;
+        float bestScore = -1;
+        for (unsigned k=0; k<cache.size(); k++) {
+            unsigned w = cache[k];
+            position[w] = k<cacheSize ? k : -1;
+            float updated = vertexScore(position[w],valence[w]);
+            float delta = updated-score[w];
+            score[w] = updated;
+            for (unsigned j=0; j<valence[w]; j++) {
+                unsigned f = around[start[w]+j];
+                surfaceScore[f] += delta;
+                if (k<cacheSize && surfaceScore[f] > bestScore) {
+                    bestScore = surfaceScore[f];
+                    best = f;
+                }
+            }
+        }
+        if (cache.size() > cacheSize)
+            cache.resize(cacheSize);
+    }
+    return result;
+}
+
+float MeshOptimizer::acmr(const std::vector<Surface>& surfaces,
+        unsigned vertices, unsigned cache) {
+    if (surfaces.empty())
+        return 0;
+    // A vertex is in the cache while fewer than "cache" others missed
+    // after it did
+    std::vector<unsigned> entered(vertices,0);
+    unsigned misses = 0;
+    for (unsigned f=0; f<surfaces.size(); f++) {
+        unsigned v[] = {surfaces[f].x,surfaces[f].y,surfaces[f].z};
+        for (int c=0; c<3; c++)
+            if (entered[v[c]]==0 || misses-entered[v[c]] >= cache)
+                entered[v[c]] = ++misses;
+    }
+    return (float)misses/surfaces.size();
+}
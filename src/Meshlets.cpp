@@ -0,0 +1,193 @@
+#include <cmath>
+#include <algorithm>
+#include "Meshlets.h"
+
+// Clusters are grown from the first surface left, over surfaces
+// sharing a vertex, breadth first
+Meshlets::Meshlets(Object* obj, unsigned maxSurfaces, float maxAngle) :
+    mp_object(obj)
+{
+    unsigned count = obj->surfaceCount();
+    unsigned vertices = obj->vertexCount();
+
+    // Unit normals in model co-ordinates, on the side a surface is
+    // drawn from, zero for degenerate surfaces which never face
+    // anywhere
+    std::vector<Vector> normals(count);
+    for (unsigned i=0; i<count; i++) {
+        const Surface& s = obj->getSurface(i);
+        Vector a = obj->getModelVertex(s.x);
+        Vector b = obj->getModelVertex(s.y);
+        Vector c = obj->getModelVertex(s.z);
+        Vector n = (b-a)*(c-b);
+        float m = n.magnitude();
+        normals[i] = m > 0 ? n/m : Vector(0,0,0,0);
+    }
+
+    // The surfaces around every vertex
+    std::vector<unsigned> first(vertices+1,0), around(3*count);
+    for (unsigned i=0; i<count; i++) {
+        const Surface& s = obj->getSurface(i);
+        first[s.x+1]++;
+        first[s.y+1]++;
+        first[s.z+1]++;
+    }
+    for (unsigned v=0; v<vertices; v++)
+        first[v+1] += first[v];
+    std::vector<unsigned> fill(first.begin(),first.end()-1);
+    for (unsigned i=0; i<count; i++) {
+        const Surface& s = obj->getSurface(i);
+        around[fill[s.x]++] = i;
+        around[fill[s.y]++] = i;
+        around[fill[s.z]++] = i;
+    }
+
+    float limit = std::cos(maxAngle*M_PI/180);
+    std::vector<bool> taken(count,false);
+    // The last cluster a vertex was added to
+    std::vector<unsigned> owner(vertices,~0u);
+    std::vector<unsigned> queue;
+    for (unsigned seed=0; seed<count; seed++) {
+        if (taken[seed])
+            continue;
+        Cluster c;
+        c.firstSurface = m_surfaces.size();
+        c.firstVertex = m_vertices.size();
+        c.surfaceCount = 0;
+        unsigned id = m_clusters.size();
+        // Direction of the first surface that has one
+        Vector axis(0,0,0,0);
+
+        queue.assign(1,seed);
+        for (unsigned head=0; head<queue.size() &&
+                c.surfaceCount<maxSurfaces; head++) {
+            unsigned i = queue[head];
+            const Vector& n = normals[i];
+            bool flat = n.x==0 && n.y==0 && n.z==0;
+            bool free = axis.x==0 && axis.y==0 && axis.z==0;
+            if (taken[i] || (!flat && !free && n%axis < limit))
+                continue;
+            if (free && !flat)
+                axis = n;
+            taken[i] = true;
+            m_surfaces.push_back(i);
+            c.surfaceCount++;
+
+            const Surface& s = obj->getSurface(i);
+            unsigned corners[] = {s.x,s.y,s.z};
+            for (int k=0; k<3; k++) {
+                unsigned v = corners[k];
+                if (owner[v]!=id) {
+                    owner[v] = id;
+                    m_vertices.push_back(v);
+                }
+                for (unsigned a=first[v]; a<first[v+1]; a++)
+                    if (!taken[around[a]])
+                        queue.push_back(around[a]);
+            }
+        }
+        c.vertexCount = m_vertices.size()-c.firstVertex;
+        bound(c,normals);
+        m_clusters.push_back(c);
+    }
+}
+
+void Meshlets::bound(Cluster& c, const std::vector<Vector>& normals) {
+    Vector min = mp_object->getModelVertex(m_vertices[c.firstVertex]);
+    Vector max = min;
+    for (unsigned n=1; n<c.vertexCount; n++) {
+        Vector p = mp_object->getModelVertex(m_vertices[c.firstVertex+n]);
+        min.x = Math::min(min.x,p.x); max.x = Math::max(max.x,p.x);
+        min.y = Math::min(min.y,p.y); max.y = Math::max(max.y,p.y);
+        min.z = Math::min(min.z,p.z); max.z = Math::max(max.z,p.z);
+    }
+    c.center = (min+max)/2;
+    c.center.w = 1;
+    c.radius = 0;
+    for (unsigned n=0; n<c.vertexCount; n++) {
+        Vector p = mp_object->getModelVertex(m_vertices[c.firstVertex+n]);
+        c.radius = Math::max(c.radius,(p-c.center).magnitude());
+    }
+
+    // The cone is around the mean normal and opens to the normal
+    // farthest from it
+    Vector sum(0,0,0,0);
+    for (unsigned n=0; n<c.surfaceCount; n++)
+        sum = sum+normals[m_surfaces[c.firstSurface+n]];
+    c.axis = Vector(0,0,0,0);
+    c.cutoff = 2;
+    float length = sum.magnitude();
+    if (length == 0)
+        return;
+    c.axis = sum/length;
+    float nearest = 1;
+    for (unsigned n=0; n<c.surfaceCount; n++) {
+        const Vector& normal = normals[m_surfaces[c.firstSurface+n]];
+        if (normal.x!=0 || normal.y!=0 || normal.z!=0)
+            nearest = Math::min(nearest,normal%c.axis);
+    }
+    // The sine of the cone's half angle
+    if (nearest > 0)
+        c.cutoff = std::sqrt(1-nearest*nearest);
+}
+
+unsigned Meshlets::cull(const Frustum& frustum, const Vector& eye,
+        bool backface, std::vector<unsigned>& surfaces,
+        std::vector<unsigned>& vertices) const {
+    surfaces.clear();
+    vertices.clear();
+
+    // Spheres and cones are taken to the world, the radius grows
+    // with the largest scale of the node
+    const Matrix<float>& m = mp_object->model();
+    bool placed = mp_object->node()!=NULL;
+    Matrix<float> normalMatrix = placed ?
+        m.inverse().transpose() : Matrix<float>({4,4});
+    float scale = 1;
+    if (placed)
+        for (int j=0; j<3; j++)
+            scale = Math::max(scale,std::sqrt(m(0,j)*m(0,j) +
+                        m(1,j)*m(1,j) + m(2,j)*m(2,j)));
+
+    unsigned culled = 0;
+    for (unsigned k=0; k<m_clusters.size(); k++) {
+        const Cluster& c = m_clusters[k];
+        Vector center = c.center;
+        Vector axis = c.axis;
+        float radius = c.radius;
+        if (placed) {
+            const Vector& p = c.center;
+            center = Vector(
+                    m(0,0)*p.x + m(0,1)*p.y + m(0,2)*p.z + m(0,3),
+                    m(1,0)*p.x + m(1,1)*p.y + m(1,2)*p.z + m(1,3),
+                    m(2,0)*p.x + m(2,1)*p.y + m(2,2)*p.z + m(2,3), 1);
+            const Matrix<float>& n = normalMatrix;
+            const Vector& a = c.axis;
+            axis = Vector(
+                    n(0,0)*a.x + n(0,1)*a.y + n(0,2)*a.z,
+                    n(1,0)*a.x + n(1,1)*a.y + n(1,2)*a.z,
+                    n(2,0)*a.x + n(2,1)*a.y + n(2,2)*a.z, 0);
+            float length = axis.magnitude();
+            if (length > 0)
+                axis = axis/length;
+            radius *= scale;
+        }
+
+        Vector view = center-eye;
+        if (!frustum.sees(center,radius) || (backface &&
+                    view%axis >= c.cutoff*view.magnitude()+radius)) {
+            culled++;
+            continue;
+        }
+        surfaces.insert(surfaces.end(),
+                m_surfaces.begin()+c.firstSurface,
+                m_surfaces.begin()+c.firstSurface+c.surfaceCount);
+        vertices.insert(vertices.end(),
+                m_vertices.begin()+c.firstVertex,
+                m_vertices.begin()+c.firstVertex+c.vertexCount);
+    }
+    // Surfaces are drawn in the object's order, equal depths are
+    // settled by which comes first
+    std::sort(surfaces.begin(),surfaces.end());
+    return culled;
+}
@@ -3,14 +3,22 @@
 Object::Object (unsigned vertex_count, const Material& m,
         Shading sh, bool backface, bool bothside):
     m_vertex({4,vertex_count}),
-    m_vertex_normal({4,vertex_count}),
     m_copy_vertex({4,vertex_count}),
-    m_material(m),
-    m_colors(NULL),
-    m_colors_count(0),
+    m_vertex_normal({4,vertex_count}),
+    m_texcoord({2,0}),
+    m_materials(1,m),
     m_shading(sh),
     m_backface(backface),
-    m_bothsides(bothside)
+    m_bothsides(bothside),
+    m_static(false),
+    mp_node(NULL),
+    mp_deformed(NULL),
+    mp_deformedNormals(NULL),
+    m_colors(NULL),
+    m_colors_count(0),
+    m_version(0),
+    m_modelBoundsVersion(~0u),
+    m_boundsVersion(~0u)
 {
     // Initialize the points
     for(int i=0;i < vertexCount();i++)
@@ -26,13 +34,22 @@ Object::Object (unsigned vertex_count, const Material& m,
 Object::Object(const std::string& filename,const Material& m,
         Shading sh, bool backface, bool bothside) :
     m_vertex({4,1}),
-    m_vertex_normal({4,1}),
     m_copy_vertex({4,1}),
-    m_material(m),
-    m_colors(NULL),
+    m_vertex_normal({4,1}),
+    m_texcoord({2,0}),
+    m_materials(1,m),
     m_shading(sh),
     m_backface(backface),
-    m_bothsides(bothside)
+    m_bothsides(bothside),
+    m_static(false),
+    mp_node(NULL),
+    mp_deformed(NULL),
+    mp_deformedNormals(NULL),
+    m_colors(NULL),
+    m_colors_count(0),
+    m_version(0),
+    m_modelBoundsVersion(~0u),
+    m_boundsVersion(~0u)
 {
     // Turn off backface detection if both sides need to be shaded
     if (m_bothsides)
@@ -50,6 +67,7 @@ Object::Object(const std::string& filename,const Material& m,
     unsigned vcount = 0;
     unsigned fcount = 0;
     unsigned vncount = 0;
+    unsigned vtcount = 0;
 
     while(!objfile.eof()){
         std::getline(objfile,line);
@@ -64,18 +82,28 @@ Object::Object(const std::string& filename,const Material& m,
             fcount++;
         else if (keyword=="vn")
             vncount++;
+        else if (keyword=="vt")
+            vtcount++;
     }
 
     // Loading surfaces
     m_surface.reserve(fcount);
     // Loading vertex normals
     m_vertex_normal.readjust({4,vncount});
+    // Loading texture co-ordinates
+    m_texcoord.readjust({2,vtcount});
     // Loading vertex
     m_vertex.readjust({4,vcount});
     resetCopy();
 
     unsigned vertex_count = 0;
     unsigned vertex_normal_count = 0;
+    unsigned texcoord_count = 0;
+
+    // Materials of the .mtl files named, and the one the surfaces
+    // read take
+    std::map<std::string,unsigned> materialIds;
+    unsigned currentMaterial = 0;
 
     // Read the file again
     objfile.clear();
@@ -101,6 +129,31 @@ Object::Object(const std::string& filename,const Material& m,
             setVertexNormal(vertex_normal_count,vtxpoint);
             vertex_normal_count++;
         }
+        else if (keyword=="vt") {
+            float u = 0, v = 0;
+            linestrm >> u >> v;
+            // v counts up from the bottom of the image in .obj files,
+            // and down from the top in a Texture
+            setTexcoord(texcoord_count,u,1-v);
+            texcoord_count++;
+        }
+
+        else if (keyword=="mtllib") {
+            // Named relative to the .obj file
+            std::string name;
+            linestrm >> name;
+            size_t slash = filename.find_last_of('/');
+            if (slash!=std::string::npos)
+                name = filename.substr(0,slash+1)+name;
+            loadMaterials(name,materialIds);
+        }
+        else if (keyword=="usemtl") {
+            // Unknown names take the object's material
+            std::string name;
+            linestrm >> name;
+            auto it = materialIds.find(name);
+            currentMaterial = it==materialIds.end() ? 0 : it->second;
+        }
 
         else if (keyword=="f") {
 
@@ -110,6 +163,7 @@ Object::Object(const std::string& filename,const Material& m,
             std::vector<unsigned> faceVn;
             std::vector<std::string> indices;
             bool noNormal = false;
+            bool noTexture = false;
 
             // Trimming from the left
             size_t space=line.find(' ');
@@ -127,6 +181,10 @@ Object::Object(const std::string& filename,const Material& m,
                 if (indices.size()>3)
                     throw ex::BadFileFormat();
                 faceV.push_back(std::stoi(indices[0])-1);
+                if (indices.size()>1 && indices[1].size()!=0)
+                    faceVt.push_back(std::stoi(indices[1])-1);
+                else
+                    noTexture = true;
                 if (indices.size()>2 && indices[2].size()!=0)
                     faceVn.push_back(std::stoi(indices[2])-1);
                 else {
@@ -140,22 +198,24 @@ Object::Object(const std::string& filename,const Material& m,
                 faceV.push_back(std::stoi(facepoint)-1);*/
             }
 
-            // Returns a list of Triplet-Pairs, of which the first
-            // is the vertex index triplet and the second is the
-            // vertext normal index triplet.
-            std::vector<Pair<Triplet<unsigned> > > tlst;
-            if (noNormal)
-                tlst = tesselate(faceV);
-            else
-                tlst = tesselate(faceV,faceVn);
+            // The triangles come as positions among the corners,
+            // which index the vertices, normals and texture
+            // co-ordinates alike
+            std::vector<Triplet<unsigned> > tlst =
+                tesselate(faceV.size());
             for (auto it=tlst.begin();it<tlst.end(); it++) {
-                Surface* surf;
-                if (noNormal)
-                    surf = new Surface(it->x.x,it->x.y,it->x.z);
-                else
-                    surf = new Surface(it->x.x,it->x.y,it->x.z,
-                        it->y.x,it->y.y,it->y.z);
-                setSurface(*surf);
+                Surface surf = noNormal ?
+                    Surface(faceV[it->x],faceV[it->y],faceV[it->z]) :
+                    Surface(faceV[it->x],faceV[it->y],faceV[it->z],
+                        faceVn[it->x],faceVn[it->y],faceVn[it->z]);
+                if (!noTexture) {
+                    surf.textured = true;
+                    surf.tx = faceVt[it->x];
+                    surf.ty = faceVt[it->y];
+                    surf.tz = faceVt[it->z];
+                }
+                surf.material = currentMaterial;
+                setSurface(surf);
             }
         }
     }
@@ -163,48 +223,110 @@ Object::Object(const std::string& filename,const Material& m,
     // Initialize the normal to the surfaces
     //initNormal();
 
-    
+    if (m_materials.size() > 1)
+        sortByMaterial();
+}
+
+// Append the materials of an .mtl file, by name. What a material
+// doesn't give is taken from the object's.
+void Object::loadMaterials(const std::string& filename,
+        std::map<std::string,unsigned>& ids) {
+    // Without the file its names stay unknown, and the surfaces
+    // using them take the object's material
+    std::ifstream mtlfile(filename,std::ios::in);
+    if (!mtlfile) {
+        std::cerr<<"Warning: cannot open "<<filename
+            <<", using the object's material"<<std::endl;
+        return;
+    }
+
+    std::string line,keyword;
+    unsigned current = 0;
+    while (std::getline(mtlfile,line)) {
+        rtrim(line);
+        std::istringstream linestrm(line);
+        if (!(linestrm>>keyword))
+            continue;
+        if (keyword=="newmtl") {
+            std::string name;
+            linestrm >> name;
+            current = addMaterial(m_materials[0]);
+            ids[name] = current;
+            continue;
+        }
+        // Nothing is changed before the first material
+        if (current==0)
+            continue;
+
+        // Colors are given red first, Coeffecient keeps blue first
+        Material& m = m_materials[current];
+        float r,g,b;
+        if (keyword=="Ka" && linestrm>>r>>g>>b)
+            m.ka = Coeffecient(b,g,r);
+        else if (keyword=="Kd" && linestrm>>r>>g>>b)
+            m.kd = Coeffecient(b,g,r);
+        else if (keyword=="Ks" && linestrm>>r>>g>>b)
+            m.ks = Coeffecient(b,g,r);
+        else if (keyword=="Ns")
+            linestrm >> m.ns;
+        else if (keyword=="d")
+            linestrm >> m.opacity;
+        else if (keyword=="Tr" && linestrm>>r)
+            m.opacity = 1-r;
+        else if (keyword=="map_Kd") {
+            // The image is the last word, named relative to the .mtl
+            std::string name;
+            while (linestrm >> keyword)
+                name = keyword;
+            size_t slash = filename.find_last_of('/');
+            if (slash!=std::string::npos)
+                name = filename.substr(0,slash+1)+name;
+            m.texture = std::make_shared<Texture>(name);
+        }
+    }
+}
+
+// A counting sort, the materials are few
+void Object::sortByMaterial() {
+    std::vector<unsigned> start(m_materials.size()+1,0);
+    for (unsigned i=0; i<m_surface.size(); i++)
+        start[m_surface[i].material+1]++;
+    for (unsigned m=0; m<m_materials.size(); m++)
+        start[m+1] += start[m];
+    std::vector<unsigned> order(m_surface.size());
+    for (unsigned i=0; i<m_surface.size(); i++)
+        order[start[m_surface[i].material]++] = i;
+
+    std::vector<Surface> sorted;
+    sorted.reserve(m_surface.size());
+    for (unsigned k=0; k<order.size(); k++)
+        sorted.push_back(m_surface[order[k]]);
+    m_surface.swap(sorted);
+    m_version++;
 }
 
 // Tesselate a polygon to triangles
-std::vector<Pair<Triplet<unsigned> > > Object::tesselate(
-        std::vector<unsigned> faceV, std::vector<unsigned> faceVn) {
+std::vector<Triplet<unsigned> > Object::tesselate(unsigned corners) {
 
-    bool normal = (faceVn!=std::vector<unsigned>());
-    std::vector<Pair<Triplet<unsigned> > > tesselated;
+    std::vector<Triplet<unsigned> > tesselated;
 
-    if (faceV.size()<3) {
+    if (corners<3) {
         throw ex::InitFailure();
-    } else if (faceV.size()==3) {
-        Pair<Triplet<unsigned> >* pr;
-        if (normal)
-            pr = new Pair<Triplet<unsigned> >
-                ({faceV[0],faceV[1],faceV[2]},
-                {faceVn[0],faceVn[1],faceVn[2]});
-        else
-            pr = new Pair<Triplet<unsigned> >
-                ({faceV[0],faceV[1],faceV[2]},{0,0,0});
-        tesselated.push_back(*pr);
+    } else if (corners==3) {
+        tesselated.push_back({0,1,2});
         return tesselated;
     } else {
+        std::vector<unsigned> face(corners);
+        for (unsigned c=0; c<corners; c++)
+            face[c] = c;
         unsigned v1,v2,v3;
-        unsigned vn1,vn2,vn3;
-        while (faceV.size()) {
-            v1 = faceV.back(); faceV.pop_back();
-            v2 = faceV.back(); faceV.pop_back();
-            v3 = faceV.back(); faceV.pop_back();
-            if (normal) {
-                vn1 = faceVn.back(); faceVn.pop_back();
-                vn2 = faceVn.back(); faceVn.pop_back();
-                vn3 = faceVn.back(); faceVn.pop_back();
-                tesselated.push_back({{v3,v2,v1},{vn3,vn2,vn1}});
-            } else
-                tesselated.push_back({{v3,v2,v1},{0,0,0}});
-            if (faceV.size()) {
-                faceV.push_back(v3); faceV.push_back(v1);
-                if (normal) {
-                    faceVn.push_back(vn3); faceVn.push_back(vn1);
-                }
+        while (face.size()) {
+            v1 = face.back(); face.pop_back();
+            v2 = face.back(); face.pop_back();
+            v3 = face.back(); face.pop_back();
+            tesselated.push_back({v3,v2,v1});
+            if (face.size()) {
+                face.push_back(v3); face.push_back(v1);
             }
         }
         return tesselated;
@@ -225,8 +347,12 @@ void Object::initNormal() {
     m_vertex_normal.readjust({4,vertexCount()});
     m_vertex_normal.clear();
     for(auto i=0;i<m_surface.size();i++) {
-        Vector  normal = getSurfaceNormal(i);
+        // In model co-ordinates, like normals loaded from the file
         Surface& surf = getSurface(i);
+        Vector v1 = getModelVertex(surf.x);
+        Vector v2 = getModelVertex(surf.y);
+        Vector v3 = getModelVertex(surf.z);
+        Vector  normal = ((v2-v1)*(v3-v2)).normalized();
         surf.vertexNormals = true;
         surf.nx = surf.x; surf.ny = surf.y; surf.nz = surf.z;
         m_vertex_normal(0,surf.x) += normal.x;
@@ -256,3 +382,68 @@ void Object::initNormal() {
         m_vertex_normal(2,i) /= mag;
     }
 }
+
+// Axis aligned box of the vertices, and the sphere around its centre
+void Object::computeBounds() const {
+    m_modelBoundsVersion = m_version;
+    const Matrix<float>& vertex = modelVertices();
+    Bounds& b = m_modelBounds;
+    if (vertexCount()==0) {
+        b.min = b.max = b.center = {0,0,0,1};
+        b.radius = 0;
+        return;
+    }
+    float lo[3], hi[3];
+    for (int r=0; r<3; r++)
+        lo[r] = hi[r] = vertex(r,0);
+    for (unsigned i=1; i<vertexCount(); i++)
+        for (int r=0; r<3; r++) {
+            lo[r] = Math::min(lo[r],vertex(r,i));
+            hi[r] = Math::max(hi[r],vertex(r,i));
+        }
+    b.min = {lo[0],lo[1],lo[2],1};
+    b.max = {hi[0],hi[1],hi[2],1};
+    b.center = (b.min+b.max)/2;
+    b.center.w = 1;
+
+    // The box's half diagonal would do, but the farthest vertex from
+    // the centre gives a tighter sphere
+    float r2 = 0;
+    for (unsigned i=0; i<vertexCount(); i++) {
+        float dx = vertex(0,i)-b.center.x;
+        float dy = vertex(1,i)-b.center.y;
+        float dz = vertex(2,i)-b.center.z;
+        r2 = Math::max(r2,dx*dx+dy*dy+dz*dz);
+    }
+    b.radius = std::sqrt(r2);
+}
+
+// The centre of the model box is placed and its half extents spread
+// over the world axes by the absolute values of the linear part, the
+// box around the eight placed corners. The radius grows with the
+// largest scale of the node.
+void Object::placeBounds() const {
+    m_boundsVersion = version();
+    const Bounds& b = m_modelBounds;
+    const Matrix<float>& m = mp_node->world();
+    float center[] = {b.center.x,b.center.y,b.center.z};
+    float half[] = {(b.max.x-b.min.x)/2,(b.max.y-b.min.y)/2,
+        (b.max.z-b.min.z)/2};
+    float c[3], e[3];
+    for (int r=0; r<3; r++) {
+        c[r] = m(r,3);
+        e[r] = 0;
+        for (int j=0; j<3; j++) {
+            c[r] += m(r,j)*center[j];
+            e[r] += std::fabs(m(r,j))*half[j];
+        }
+    }
+    float scale = 0;
+    for (int j=0; j<3; j++)
+        scale = Math::max(scale,std::sqrt(m(0,j)*m(0,j) +
+                    m(1,j)*m(1,j) + m(2,j)*m(2,j)));
+    m_bounds.min = {c[0]-e[0],c[1]-e[1],c[2]-e[2],1};
+    m_bounds.max = {c[0]+e[0],c[1]+e[1],c[2]+e[2],1};
+    m_bounds.center = {c[0],c[1],c[2],1};
+    m_bounds.radius = b.radius*scale;
+}
@@ -0,0 +1,84 @@
+#include "OcclusionBuffer.h"
+
+// Draw a triangle with edge functions evaluated at pixel centres
+void OcclusionBuffer::rasterize(const float a[3], const float b[3],
+        const float c[3]) {
+    // Twice the signed area, triangles of either winding are drawn
+    float area = (b[0]-a[0])*(c[1]-a[1]) - (b[1]-a[1])*(c[0]-a[0]);
+    if (area == 0)
+        return;
+    const float* p[] = {a,b,c};
+    if (area < 0) {
+        swap(p[1],p[2]);
+        area = -area;
+    }
+
+    int x0 = Math::max(0,(int)std::floor(Math::min(Math::min(a[0],b[0]),
+                    c[0])));
+    int x1 = Math::min((int)m_width-1,(int)std::ceil(Math::max(
+                    Math::max(a[0],b[0]),c[0])));
+    int y0 = Math::max(0,(int)std::floor(Math::min(Math::min(a[1],b[1]),
+                    c[1])));
+    int y1 = Math::min((int)m_height-1,(int)std::ceil(Math::max(
+                    Math::max(a[1],b[1]),c[1])));
+    if (x0 > x1 || y0 > y1)
+        return;
+
+    // Edge i is opposite vertex i: e = A*x + B*y + C, positive inside
+    float A[3], B[3], C[3];
+    for (int i=0; i<3; i++) {
+        const float* s = p[(i+1)%3];
+        const float* t = p[(i+2)%3];
+        A[i] = s[1]-t[1];
+        B[i] = t[0]-s[0];
+        C[i] = s[0]*t[1] - s[1]*t[0];
+    }
+
+    // The depth plane, lowered by the most it changes within half a
+    // pixel so that it is never nearer than the triangle in the pixel
+    float dzdx = 0, dzdy = 0, z0 = 0;
+    for (int i=0; i<3; i++) {
+        dzdx += A[i]*p[i][2];
+        dzdy += B[i]*p[i][2];
+        z0 += C[i]*p[i][2];
+    }
+    dzdx /= area; dzdy /= area; z0 /= area;
+    z0 -= (std::fabs(dzdx)+std::fabs(dzdy))/2;
+
+    for (int y=y0; y<=y1; y++) {
+        float cy = y+0.5f;
+        float* row = &m_depth[y*m_width];
+        float e0 = A[0]*(x0+0.5f) + B[0]*cy + C[0];
+        float e1 = A[1]*(x0+0.5f) + B[1]*cy + C[1];
+        float e2 = A[2]*(x0+0.5f) + B[2]*cy + C[2];
+        float z = z0 + dzdx*(x0+0.5f) + dzdy*cy;
+        for (int x=x0; x<=x1; x++) {
+            int i = x-x0;
+            bool inside = e0+A[0]*i >= 0 && e1+A[1]*i >= 0 &&
+                e2+A[2]*i >= 0;
+            float d = z+dzdx*i;
+            row[x] = (inside && d > row[x]) ? d : row[x];
+        }
+    }
+}
+
+// Whether a rectangle is covered by something nearer than "depth"
+bool OcclusionBuffer::occluded(float fx0, float fy0, float fx1,
+        float fy1, float depth) const {
+    int x0 = Math::max(0,(int)std::floor(fx0));
+    int y0 = Math::max(0,(int)std::floor(fy0));
+    int x1 = Math::min((int)m_width-1,(int)std::floor(fx1));
+    int y1 = Math::min((int)m_height-1,(int)std::floor(fy1));
+    // Nothing to hide behind outside the buffer
+    if (x0 > x1 || y0 > y1)
+        return false;
+    for (int y=y0; y<=y1; y++) {
+        const float* row = &m_depth[y*m_width];
+        float farthest = row[x0];
+        for (int x=x0+1; x<=x1; x++)
+            farthest = Math::min(farthest,row[x]);
+        if (farthest <= depth)
+            return false;
+    }
+    return true;
+}
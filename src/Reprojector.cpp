@@ -0,0 +1,112 @@
+#include "Reprojector.h"
+#include "Drawer.h"
+
+Reprojector::Reprojector(unsigned refreshPeriod, unsigned maxReuse) :
+    m_reused(0), m_frame(0), m_refreshPeriod(refreshPeriod),
+    m_maxReuse(maxReuse)
+{
+}
+
+// Convert to double, the depth range needs the precision
+static Matrix<double> toDouble(const Matrix<float>& m) {
+    Matrix<double> d({m.row(),m.col()});
+    for (unsigned i=0; i<m.space(); i++)
+        d(i) = m(i);
+    return d;
+}
+
+unsigned Reprojector::reproject(Drawer* drawer,
+        const Matrix<float>& previous, const Matrix<float>& current,
+        Color clearColor) {
+    const int w = drawer->getWidth(), h = drawer->getHeight();
+    const unsigned pitch = drawer->getColorPitch();
+
+    // Keep the last frame aside, the drawer's buffers are the
+    // destination
+    m_color.resize(w*h);
+    m_depth.resize(w*h);
+    m_mask.assign(w*h,0);
+    uint32_t* color = drawer->getColorBuffer();
+    uint32_t* depth = drawer->getDepthBuffer();
+    for (int y=0; y<h; y++)
+        std::copy(color+y*pitch,color+y*pitch+w,&m_color[y*w]);
+    std::copy(depth,depth+w*h,m_depth.begin());
+    drawer->clear(clearColor);
+    // The clear color as stored in the color buffer
+    const uint32_t background = color[0];
+
+    // From the old device co-ordinates straight to the new ones
+    Matrix<double> t = toDouble(current)*toDouble(previous).inverse();
+    double m[16];
+    for (int i=0; i<16; i++)
+        m[i] = t(i);
+
+    unsigned reused = 0;
+    for (int x=0; x<w; x++) {
+        // The depth-buffer is stored column by column
+        const uint32_t* dcol = &m_depth[x*h];
+        for (int y=0; y<h; y++) {
+            // Nothing was drawn here
+            if (dcol[y]==0)
+                continue;
+            double d = dcol[y];
+            double nw = m[12]*x + m[13]*y + m[14]*d + m[15];
+            if (nw <= 0)
+                continue;
+            double nx = (m[0]*x + m[1]*y + m[2]*d + m[3])/nw;
+            double ny = (m[4]*x + m[5]*y + m[6]*d + m[7])/nw;
+            double nd = (m[8]*x + m[9]*y + m[10]*d + m[11])/nw;
+            int px = Math::round(nx), py = Math::round(ny);
+            if (px<0 || py<0 || px>=w || py>=h || nd<=0 ||
+                    nd>ScreenPoint::maxDepth)
+                continue;
+            // Nearest one wins
+            uint32_t de = nd;
+            if (de > depth[px*h+py]) {
+                depth[px*h+py] = de;
+                color[py*pitch+px] = m_color[y*w+x];
+                reused += !m_mask[py*w+px];
+                m_mask[py*w+px] = 1;
+            }
+        }
+    }
+
+    // Surfaces coming closer spread apart and leave cracks through
+    // which whatever was behind them is seen. A reused pixel farther
+    // than both its neighbours in a row or column is such a crack.
+    for (int x=1; x<w-1; x++) {
+        for (int y=1; y<h-1; y++) {
+            if (!m_mask[y*w+x])
+                continue;
+            uint32_t d = depth[x*h+y];
+            if ((depth[(x-1)*h+y] > d && depth[(x+1)*h+y] > d) ||
+                    (depth[x*h+y-1] > d && depth[x*h+y+1] > d))
+                m_mask[y*w+x] = 2;
+        }
+    }
+    for (int y=0; y<h; y++) {
+        for (int x=0; x<w; x++) {
+            if (m_mask[y*w+x]!=2)
+                continue;
+            reused--;
+            m_mask[y*w+x] = 0;
+            depth[x*h+y] = 0;
+            color[y*pitch+x] = background;
+        }
+    }
+
+    // Rotating refresh
+    if (m_refreshPeriod) {
+        for (int y=m_frame%m_refreshPeriod; y<h; y+=m_refreshPeriod) {
+            for (int x=0; x<w; x++) {
+                reused -= m_mask[y*w+x];
+                m_mask[y*w+x] = 0;
+                depth[x*h+y] = 0;
+                color[y*pitch+x] = background;
+            }
+        }
+    }
+    m_frame++;
+    m_reused++;
+    return reused;
+}
@@ -20,6 +20,99 @@ SDLPlotter::SDLPlotter(unsigned w, unsigned h)
     // Bytes Per Pixel MUST be 4
     if (screen->format->BytesPerPixel!=4)
         throw ex::InitFailure();
+
+    // Render straight to the window to begin with
+    m_pixels = (Uint32*)screen->pixels;
+    m_pitch = screen->pitch/4;
+}
+
+// Render at w x h pixels
+void SDLPlotter::setRenderSize(unsigned w, unsigned h) {
+    w = Math::max(1u,Math::min(w,(unsigned)screen->w));
+    h = Math::max(1u,Math::min(h,(unsigned)screen->h));
+    m_width = w;
+    m_height = h;
+
+    if (w==(unsigned)screen->w && h==(unsigned)screen->h) {
+        m_pixels = (Uint32*)screen->pixels;
+        m_pitch = screen->pitch/4;
+        m_target.clear();
+        return;
+    }
+
+    m_target.resize(w*h);
+    m_pixels = &m_target[0];
+    m_pitch = w;
+
+    // Precompute the horizontal filter taps, they are the same for
+    // every row. Pixel centers are aligned, weights are 8-bit.
+    m_colIndex.resize(screen->w);
+    m_colWeight.resize(screen->w);
+    for (int x=0; x<screen->w; x++) {
+        float sx = Math::max(0.0f,(x+0.5f)*w/screen->w-0.5f);
+        unsigned ix = Math::min((unsigned)sx,w-1);
+        m_colIndex[x] = ix;
+        m_colWeight[x] = (ix+1<w) ? (Uint32)((sx-ix)*256) : 0;
+    }
+}
+
+// Update only the given rectangle of the render target
+void SDLPlotter::update(const Rect& rect) {
+    Rect r = rect.intersect(Rect(0,0,m_width-1,m_height-1));
+    if (r.empty())
+        return;
+    if (scaled()) {
+        // Map to window pixels, one pixel of margin covers the
+        // reach of the filter
+        r = Rect(r.x0*screen->w/m_width-1, r.y0*screen->h/m_height-1,
+                (r.x1+1)*screen->w/m_width+1,
+                (r.y1+1)*screen->h/m_height+1)
+            .intersect(Rect(0,0,screen->w-1,screen->h-1));
+        upscale(r.x0,r.y0,r.x1,r.y1);
+    }
+    SDL_Rect sr = {r.x0, r.y0, r.width(), r.height()};
+    SDL_UpdateWindowSurfaceRects(window,&sr,1);
+}
+
+// Bilinear upscale of the render target to the window surface.
+// Channels are filtered two at a time in 32 bit words, red and blue
+// in one and alpha and green in the other, so every pixel costs a
+// handful of integer multiplies.
+void SDLPlotter::upscale(unsigned x0, unsigned y0, unsigned x1,
+        unsigned y1) {
+    const unsigned wh = screen->h;
+    for (unsigned y=y0; y<=y1; y++) {
+        float sy = Math::max(0.0f,(y+0.5f)*m_height/wh-0.5f);
+        unsigned iy = Math::min((unsigned)sy,m_height-1);
+        Uint32 wy = (iy+1<m_height) ? (Uint32)((sy-iy)*256) : 0;
+        const Uint32* row0 = m_pixels + iy*m_pitch;
+        const Uint32* row1 = row0 + ((iy+1<m_height) ? m_pitch : 0);
+        Uint32* out = (Uint32*)((Uint8*)screen->pixels+y*screen->pitch);
+
+        for (unsigned x=x0; x<=x1; x++) {
+            unsigned ix = m_colIndex[x];
+            unsigned nx = ix + (m_colWeight[x]!=0);
+            Uint32 wx = m_colWeight[x];
+
+            Uint32 a = row0[ix], b = row0[nx];
+            Uint32 c = row1[ix], d = row1[nx];
+
+            // Red and blue
+            Uint32 rb0 = ((a&0xff00ff)*(256-wx)+(b&0xff00ff)*wx)>>8;
+            Uint32 rb1 = ((c&0xff00ff)*(256-wx)+(d&0xff00ff)*wx)>>8;
+            Uint32 rb = (((rb0&0xff00ff)*(256-wy)+
+                        (rb1&0xff00ff)*wy)>>8)&0xff00ff;
+            // Alpha and green
+            Uint32 ag0 = (((a>>8)&0xff00ff)*(256-wx)+
+                    ((b>>8)&0xff00ff)*wx)>>8;
+            Uint32 ag1 = (((c>>8)&0xff00ff)*(256-wx)+
+                    ((d>>8)&0xff00ff)*wx)>>8;
+            Uint32 ag = (((ag0&0xff00ff)*(256-wy)+
+                        (ag1&0xff00ff)*wy))&0xff00ff00;
+
+            out[x] = rb|ag;
+        }
+    }
 }
 
 // Deconstruct
@@ -0,0 +1,259 @@
+#include <future>
+#include <algorithm>
+#include "SceneBVH.h"
+#include "misc/Time.h"
+#include "common/sort.h"
+
+const unsigned SceneBVH::clusterThreshold;
+const unsigned SceneBVH::clusterSize;
+
+// Bring the entry of object k up to date
+bool SceneBVH::updateEntry(unsigned k) {
+    Object* obj = m_objects[k];
+    Entry& e = m_entries[k];
+    bool fresh = e.object!=obj || e.surfaces!=obj->surfaceCount();
+    e.object = obj;
+    e.modelVersion = obj->modelVersion();
+    e.surfaces = obj->surfaceCount();
+
+    if (obj->surfaceCount() <= clusterThreshold) {
+        e.triangles = BVH(clusterSize);
+        e.boxes.clear();
+        return fresh;
+    }
+
+    const Matrix<float>& vertex = obj->modelVertices();
+    e.boxes.resize(obj->surfaceCount());
+    for (unsigned i=0; i<obj->surfaceCount(); i++) {
+        const Surface& s = obj->getSurface(i);
+        Box box;
+        unsigned v[] = {s.x,s.y,s.z};
+        for (int c=0; c<3; c++)
+            box.include(vertex(0,v[c]),vertex(1,v[c]),vertex(2,v[c]));
+        e.boxes[i] = box;
+    }
+    fresh = fresh || e.triangles.empty();
+    if (fresh)
+        e.triangles.build(e.boxes);
+    else
+        e.triangles.refit(e.boxes);
+    return fresh;
+}
+
+// Rebuild what is new and refit what moved. An object whose node
+// alone moved has its box placed again, its triangles stay as they
+// are.
+void SceneBVH::update(const std::vector<Object*>& objects) {
+    Time timer(0);
+    timer.start();
+
+    // Another object in the same place, another level of detail of
+    // it say, is refitted like a moved one
+    bool rebuild = objects.size()!=m_objects.size();
+    m_objects = objects;
+    m_entries.resize(objects.size());
+    m_boxes.resize(objects.size());
+
+    // Objects that changed, large ones are done on threads of their
+    // own as they take the longest
+    std::vector<unsigned> changed;
+    for (unsigned k=0; k<m_objects.size(); k++)
+        if (m_entries[k].object!=m_objects[k] ||
+                m_entries[k].version!=m_objects[k]->version())
+            changed.push_back(k);
+    if (changed.empty() && !rebuild)
+        return;
+
+    // The bounds of an object are cached as they are first asked for.
+    // They are taken here, before any thread starts, so that the
+    // threads only read.
+    for (unsigned n=0; n<changed.size(); n++) {
+        unsigned k = changed[n];
+        const Bounds& b = m_objects[k]->bounds();
+        Box box;
+        box.include(b.min.x,b.min.y,b.min.z);
+        box.include(b.max.x,b.max.y,b.max.z);
+        m_boxes[k] = box;
+        m_entries[k].version = m_objects[k]->version();
+    }
+
+    bool built = rebuild;
+    std::vector<std::future<bool> > tasks;
+    for (unsigned n=0; n<changed.size(); n++) {
+        unsigned k = changed[n];
+        const Entry& e = m_entries[k];
+        if (e.object==m_objects[k] &&
+                e.modelVersion==m_objects[k]->modelVersion())
+            continue;
+        if (m_objects[k]->surfaceCount() > clusterThreshold)
+            tasks.push_back(std::async(std::launch::async,
+                        &SceneBVH::updateEntry,this,k));
+        else
+            built = updateEntry(k) || built;
+    }
+    for (unsigned n=0; n<tasks.size(); n++)
+        built = tasks[n].get() || built;
+
+    if (!rebuild && !m_top.empty()) {
+        m_top.refit(m_boxes);
+        rebuild = m_top.node(0).box.area() > 2*m_builtArea;
+    }
+    if (rebuild || m_top.empty()) {
+        m_top = BVH(2);
+        m_top.build(m_boxes);
+        m_builtArea = m_top.empty() ? 0 : m_top.node(0).box.area();
+        built = true;
+    }
+
+    if (built)
+        m_buildTime = timer.time();
+    else
+        m_refitTime = timer.time();
+}
+
+// The surfaces of a clustered object k that may be seen
+void SceneBVH::cullSurfaces(unsigned k, const Frustum& frustum,
+        std::vector<unsigned>& surfaces) const {
+    surfaces.clear();
+    const BVH& tree = m_entries[k].triangles;
+    const Object* obj = m_objects[k];
+    Frustum model = obj->node() ? frustum.toModel(obj->model()) : frustum;
+    tree.cull(model,[&](unsigned first, unsigned count, bool) {
+        for (unsigned i=first; i<first+count; i++)
+            surfaces.push_back(tree.item(i));
+    });
+    // Surfaces are drawn in the object's order, equal depths are
+    // settled by which comes first
+    std::sort(surfaces.begin(),surfaces.end());
+}
+
+// Clusters are keyed by the depth of the nearest corner of their box
+// and radix sorted; within a cluster the object's order is kept. The
+// boxes are in model co-ordinates: the depth of a model point p is
+// dir % (L*p + t) - dir % eye, L and t being the linear part and the
+// translation of the model matrix, so the direction is taken through
+// the transpose of L and the translation moves the offset.
+void SceneBVH::sortSurfaces(unsigned k, const Frustum& frustum,
+        const Vector& eye, const Vector& dir,
+        std::vector<unsigned>& surfaces) const {
+    const Entry& e = m_entries[k];
+    const BVH& tree = e.triangles;
+    const Object* obj = m_objects[k];
+    std::vector<unsigned> firsts, counts;
+    std::vector<uint32_t> keys;
+    std::vector<unsigned> order;
+    float d[] = {dir.x,dir.y,dir.z};
+    float offset = eye%dir;
+    Frustum model = frustum;
+    if (obj->node()) {
+        const Matrix<float>& m = obj->model();
+        float w[] = {dir.x,dir.y,dir.z};
+        for (int a=0; a<3; a++) {
+            d[a] = m(0,a)*w[0] + m(1,a)*w[1] + m(2,a)*w[2];
+            offset -= w[a]*m(a,3);
+        }
+        model = frustum.toModel(m);
+    }
+    tree.cull(model,[&](unsigned first, unsigned count, bool) {
+        Box box;
+        for (unsigned i=first; i<first+count; i++)
+            box.include(e.boxes[tree.item(i)]);
+        float depth = -offset;
+        for (int a=0; a<3; a++)
+            depth += d[a]*(d[a]>0 ? box.min[a] : box.max[a]);
+        order.push_back(firsts.size());
+        keys.push_back(depthKey(depth));
+        firsts.push_back(first);
+        counts.push_back(count);
+    });
+    radixSort(keys,order);
+
+    surfaces.clear();
+    for (unsigned n=0; n<order.size(); n++) {
+        unsigned first = firsts[order[n]], count = counts[order[n]];
+        unsigned at = surfaces.size();
+        for (unsigned i=first; i<first+count; i++)
+            surfaces.push_back(tree.item(i));
+        std::sort(surfaces.begin()+at,surfaces.end());
+    }
+}
+
+// Moller-Trumbore intersection of a ray with surface i of object k,
+// hit is updated if the surface is nearer
+bool SceneBVH::traceSurface(unsigned k, unsigned i,
+        const Vector& origin, const Vector& dir, Hit& hit) const {
+    Object* obj = m_objects[k];
+    const Surface& s = obj->getSurface(i);
+    const Matrix<float>& vertex = obj->modelVertices();
+    Vector a(vertex(0,s.x),vertex(1,s.x),vertex(2,s.x),1);
+    Vector ab = Vector(vertex(0,s.y),vertex(1,s.y),vertex(2,s.y),1)-a;
+    Vector ac = Vector(vertex(0,s.z),vertex(1,s.z),vertex(2,s.z),1)-a;
+
+    Vector p = dir*ac;
+    float det = ab%p;
+    if (std::fabs(det) < 1e-12f)
+        return false;
+    float inv = 1/det;
+    Vector ao = origin-a;
+    float u = (ao%p)*inv;
+    if (u < 0 || u > 1)
+        return false;
+    Vector q = ao*ab;
+    float v = (dir%q)*inv;
+    if (v < 0 || u+v > 1)
+        return false;
+    float t = (ac%q)*inv;
+    if (t < 0 || t >= hit.t)
+        return false;
+
+    hit.object = k;
+    hit.surface = i;
+    hit.t = t;
+    return true;
+}
+
+// Nearest hit along a ray, objects and clusters are taken nearest
+// first and those beyond the nearest hit so far are skipped. The ray
+// is taken to the model co-ordinates of every object, where its
+// surfaces are; the distance along it is the same there.
+bool SceneBVH::trace(const Vector& origin, const Vector& dir,
+        Hit& hit) const {
+    hit.t = 1e30f;
+    bool found = false;
+    m_top.trace(origin,dir,hit.t,[&](unsigned k, float) {
+        const Entry& e = m_entries[k];
+        const Object* obj = m_objects[k];
+        Vector o = origin, d = dir;
+        if (obj->node()) {
+            Matrix<float> inv = obj->model().inverse();
+            float p[] = {origin.x,origin.y,origin.z};
+            float v[] = {dir.x,dir.y,dir.z};
+            float mo[3], md[3];
+            for (int r=0; r<3; r++) {
+                mo[r] = inv(r,3);
+                md[r] = 0;
+                for (int c=0; c<3; c++) {
+                    mo[r] += inv(r,c)*p[c];
+                    md[r] += inv(r,c)*v[c];
+                }
+            }
+            o = Vector(mo[0],mo[1],mo[2],1);
+            d = Vector(md[0],md[1],md[2],0);
+        }
+        if (e.triangles.empty()) {
+            for (unsigned i=0; i<obj->surfaceCount(); i++)
+                found = traceSurface(k,i,o,d,hit) || found;
+        } else {
+            e.triangles.trace(o,d,hit.t,[&](unsigned i, float) {
+                found = traceSurface(k,i,o,d,hit) || found;
+                return hit.t;
+            });
+        }
+        return hit.t;
+    });
+    if (found) {
+        hit.point = origin+dir*hit.t;
+        hit.point.w = 1;
+    }
+    return found;
+}
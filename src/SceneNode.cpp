@@ -0,0 +1,61 @@
+#include <algorithm>
+#include "SceneNode.h"
+
+SceneNode::SceneNode(const Matrix<float>& local) :
+    mp_parent(NULL),
+    m_local(local),
+    m_world(local),
+    m_dirty(false),
+    m_version(0)
+{
+}
+
+SceneNode::~SceneNode() {
+    detach();
+    while (!m_children.empty())
+        m_children.back()->detach();
+}
+
+void SceneNode::attach(SceneNode* child) {
+    for (SceneNode* p=this; p; p=p->mp_parent)
+        if (p==child)
+            throw ex::InitFailure();
+    child->detach();
+    child->mp_parent = this;
+    m_children.push_back(child);
+    child->invalidate();
+}
+
+void SceneNode::detach() {
+    if (!mp_parent)
+        return;
+    std::vector<SceneNode*>& siblings = mp_parent->m_children;
+    siblings.erase(std::find(siblings.begin(),siblings.end(),this));
+    mp_parent = NULL;
+    invalidate();
+}
+
+void SceneNode::setLocal(const Matrix<float>& local) {
+    m_local = local;
+    invalidate();
+}
+
+void SceneNode::transform(const Matrix<float>& m) {
+    m_local /= m;
+    invalidate();
+}
+
+void SceneNode::invalidate() {
+    m_dirty = true;
+    m_version++;
+    for (unsigned i=0; i<m_children.size(); i++)
+        m_children[i]->invalidate();
+}
+
+const Matrix<float>& SceneNode::world() const {
+    if (m_dirty) {
+        m_world = mp_parent ? mp_parent->world()*m_local : m_local;
+        m_dirty = false;
+    }
+    return m_world;
+}
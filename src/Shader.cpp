@@ -1,237 +1,1174 @@
+#include <future>
+#include <thread>
 #include "Shader.h"
 #include "TfMatrix.h"
+#include "Frustum.h"
+#include "misc/Time.h"
+#include "common/sort.h"
 
-Shader::Shader(Drawer* drawer) : mp_drawer(drawer) {
+Shader::Shader(Drawer* drawer) : mp_drawer(drawer),
+    m_resolution(0), m_dynamicResolution(false), m_drawn(false),
+    m_occlusion(false), m_occlusionReuse(false), m_occluderSize(0.25),
+    m_frame(0), m_sortObjects(false), m_sortClusters(false),
+    mp_cells(NULL), m_recording(false), m_reprojection(false),
+    m_lastTransformation({4,4}), m_staticLayer(false),
+    m_layerValid(false) {
 }
 
-Shader::~Shader() {
+// Perspective projection, from camera co-ordinates to homogeneous
+// co-ordinates
+Matrix<float> Shader::projectionMatrix() const {
+    return TfMatrix::perspective(95,mp_drawer->getAspectRatio(),10000,5);
 }
 
-/* Draw a frame on the screen */
-void Shader::draw() {
+// Camera and perspective projection, from world co-ordinates to
+// homogeneous co-ordinates
+Matrix<float> Shader::clipMatrix() const {
+    return projectionMatrix()*
+        TfMatrix::lookAt(m_camera.vrp,m_camera.vpn,m_camera.vup);
+}
 
-    bool BACKFACEDETECTION, UNBOUNDED, GOURAUD;
+// Pixels across of a unit length at unit distance, from the
+// projection alone so that it doesn't change as the camera turns
+float Shader::pixelScale() const {
+    return projectionMatrix()(1,1)*mp_drawer->getHeight();
+}
+
+// Attach levels of detail to object k
+void Shader::setLOD(unsigned k, LODChain* chain) {
+    if (k>=m_objects.size())
+        throw ex::OutOfBounds();
+    m_lods.resize(m_objects.size(),NULL);
+    m_lods[k] = chain;
+    if (chain)
+        m_objects[k] = chain->base();
+}
+
+// Attach clusters to object k
+void Shader::setMeshlets(unsigned k, const Meshlets* meshlets) {
+    if (k>=m_objects.size())
+        throw ex::OutOfBounds();
+    m_meshlets.resize(m_objects.size(),NULL);
+    m_meshlets[k] = meshlets;
+    m_drawn = false;
+}
+
+// Attach a terrain to object k
+void Shader::setTerrain(unsigned k, Terrain* terrain) {
+    if (k>=m_objects.size())
+        throw ex::OutOfBounds();
+    m_terrains.resize(m_objects.size(),NULL);
+    m_terrains[k] = terrain;
+    if (terrain)
+        m_objects[k] = terrain->object();
+    m_drawn = false;
+}
+
+// Swap every object having levels of detail for the level fitting
+// the size of its bounding sphere on the screen
+void Shader::selectLevels() {
+    m_lods.resize(m_objects.size(),NULL);
+    for (unsigned k=0; k<m_objects.size(); k++) {
+        LODChain* chain = m_lods[k];
+        if (!chain)
+            continue;
+        chain->sync();
+        m_objects[k] = chain->select(screenSize(chain->base()->bounds()));
+    }
+
+    // Terrain patches by their distance from the camera
+    m_terrains.resize(m_objects.size(),NULL);
+    float scale = pixelScale();
+    for (unsigned k=0; k<m_objects.size(); k++)
+        if (m_terrains[k])
+            m_terrains[k]->select(m_camera.vrp,scale);
+}
+
+// Pixels across the bounding sphere on the render target
+float Shader::screenSize(const Bounds& b) const {
+    float scale = pixelScale();
+    float distance = Math::max((b.center-m_camera.vrp).magnitude(),
+            b.radius);
+    return 2*b.radius*scale/distance;
+}
+
+// Enable or disable occlusion culling
+void Shader::setOcclusion(bool enable, bool reuseVisible,
+        float occluderSize) {
+    m_occlusion = enable;
+    m_occlusionReuse = reuseVisible;
+    m_occluderSize = occluderSize;
+    m_occluded.assign(m_objects.size(),false);
+}
+
+// Draw front to back by view depth
+void Shader::setDepthSort(bool objects, bool clusters) {
+    m_sortObjects = objects;
+    m_sortClusters = clusters;
+}
+
+// Order the objects by the depth of their centres, radix sorted on
+// quantized keys; unsorted they are drawn as they were added
+void Shader::sortObjects() {
+    m_order.resize(m_objects.size());
+    for (unsigned k=0; k<m_objects.size(); k++)
+        m_order[k] = k;
+    if (!m_sortObjects)
+        return;
+    Vector dir = m_camera.vpn.normalized();
+    std::vector<uint32_t> keys(m_objects.size());
+    for (unsigned k=0; k<m_objects.size(); k++)
+        keys[k] = depthKey((m_objects[k]->bounds().center-m_camera.vrp)
+                %dir);
+    radixSort(keys,m_order);
+}
 
-    /*for (int i=0; i<200; i++) {
-        for (int j=0; j<150; j++) {
-            std::cout<<m_pointLights[0]->depthAt(i,j)<<"\t";
+// Draw the prepared occluders into the occlusion buffer, scaled
+// down from the render target
+void Shader::drawOccluders() {
+    m_occlusionBuffer.clear();
+    float sx = (float)m_occlusionBuffer.width()/mp_drawer->getWidth();
+    float sy = (float)m_occlusionBuffer.height()/mp_drawer->getHeight();
+    for (unsigned k=0; k<m_objects.size(); k++) {
+        if (!m_occluder[k])
+            continue;
+        Object* obj = m_objects[k];
+        const ProjectedVertices& v = obj->projected();
+        // Backfaces aren't drawn, so they don't hide anything
+        const std::vector<unsigned>& list = obj->facing().list;
+        for (unsigned n=0; n<list.size(); n++) {
+            const Surface& s = obj->getSurface(list[n]);
+            unsigned idx[] = {s.x,s.y,s.z};
+            float p[3][3];
+            for (int c=0; c<3; c++) {
+                p[c][0] = v.sx[idx[c]]*sx;
+                p[c][1] = v.sy[idx[c]]*sy;
+                p[c][2] = v.sz[idx[c]];
+            }
+            m_occlusionBuffer.rasterize(p[0],p[1],p[2]);
         }
-        std::cout<<std::endl;
     }
-    if (m_pointLights[0]->onShadow({0,0,0,1}))
-        std::cout<<"On Shadow"<<std::endl;
-    else
-        std::cout<<"nO Shadow"<<std::endl;
-    exit(0);*/
+}
 
+// Whether the box of object k is hidden behind the occluders. Objects
+// seen in the last frame may be taken as still seen, and tested only
+// every occlusionRetest'th frame.
+bool Shader::occluded(unsigned k, const Matrix<float>& transformation) {
+    if (m_occlusionReuse && !m_occluded[k] &&
+            (m_frame+k)%occlusionRetest!=0)
+        return false;
+    m_stats.occlusionTests++;
 
-    // Apply camera projection and perspective
-    // projection transformation
-    // Change homogeneous co-ordinate system
-    // to device co-ordinate system
-    Matrix<float>transformation =
+    const Bounds& b = m_objects[k]->bounds();
+    float sx = (float)m_occlusionBuffer.width()/mp_drawer->getWidth();
+    float sy = (float)m_occlusionBuffer.height()/mp_drawer->getHeight();
+    Rect area;
+    float nearest;
+    // A box reaching behind the camera is taken as seen
+    if (!project(b.min,b.max,transformation,area,nearest))
+        return false;
+    return m_occlusionBuffer.occluded(area.x0*sx,area.y0*sy,
+            (area.x1+1)*sx,(area.y1+1)*sy,nearest);
+}
+
+// Project the corners of a box
+bool Shader::project(const Vector& min, const Vector& max,
+        const Matrix<float>& transformation, Rect& area,
+        float& nearest) const {
+    area = Rect();
+    nearest = 0;
+    for (int c=0; c<8; c++) {
+        Vector corner((c&1)?max.x:min.x, (c&2)?max.y:min.y,
+                (c&4)?max.z:min.z, 1);
+        Vector p = corner*transformation;
+        if (p.w <= 0) {
+            area = mp_drawer->screenRect();
+            return false;
+        }
+        area.include(std::floor(p.x/p.w),std::floor(p.y/p.w));
+        nearest = Math::max(nearest,p.z/p.w);
+    }
+    return true;
+}
+
+// Shade and fill the instances seen in the dirty area, one after
+// another through their mesh
+void Shader::drawInstances(bool translucent,
+        const Matrix<float>& transformation, const Frustum& frustum,
+        const Rect& dirty) {
+    for (unsigned s=0; s<m_instanceSets.size(); s++) {
+        InstanceSet* set = m_instanceSets[s];
+        Object* mesh = set->mesh();
+        if (mesh->material().translucent()!=translucent)
+            continue;
+        if (translucent)
+            mp_drawer->setOpacity(mesh->material().opacity);
+        for (unsigned i=0; i<set->size(); i++) {
+            Vector min, max;
+            Rect area;
+            float nearest;
+            set->box(i,min,max);
+            if (!frustum.sees(min,max))
+                continue;
+            project(min,max,transformation,area,nearest);
+            if (!area.overlaps(dirty))
+                continue;
+            CommandBuffer::Command quad[2];
+            if (impostor(s,i,min,max,transformation,quad)) {
+                CommandBuffer::draw(quad[0],mp_drawer,this);
+                CommandBuffer::draw(quad[1],mp_drawer,this);
+                m_stats.impostors++;
+                continue;
+            }
+            set->place(i);
+            prepare(mesh,transformation);
+            tint(mesh,set->instance(i).tint);
+            fill(mesh);
+            m_stats.instances++;
+        }
+    }
+}
+
+// Attach an impostor to instance set s
+void Shader::setImpostor(unsigned s, Impostor* impostor, float size) {
+    if (s>=m_instanceSets.size())
+        throw ex::OutOfBounds();
+    if (impostor && impostor->mesh()!=m_instanceSets[s]->mesh())
+        throw ex::InitFailure();
+    m_impostors.resize(m_instanceSets.size(),NULL);
+    m_impostorSize.resize(m_instanceSets.size(),0);
+    m_impostors[s] = impostor;
+    m_impostorSize[s] = size;
+    m_drawn = false;
+}
+
+// The picture is taken with the mesh lit where the instance stands.
+// The quad's corners are moved toward the shadow casting light by the
+// radius for the shadow lookups, so that the mesh it stands for, whose
+// front toward the light is in the shadow buffer, doesn't shadow it.
+bool Shader::impostor(unsigned s, unsigned i, const Vector& min,
+        const Vector& max, const Matrix<float>& transformation,
+        CommandBuffer::Command quad[2]) {
+    Impostor* impostor = s<m_impostors.size() ? m_impostors[s] : NULL;
+    if (!impostor)
+        return false;
+    Bounds b;
+    b.center = (min+max)*0.5;
+    b.radius = (max-min).magnitude()*0.5;
+    if (screenSize(b) >= m_impostorSize[s])
+        return false;
+
+    InstanceSet* set = m_instanceSets[s];
+    unsigned v = impostor->view(set->instance(i),m_camera.vrp);
+    if (!impostor->captured(v)) {
+        set->place(i);
+        prepare(set->mesh(),impostor->captureTransform(v,
+                    set->transform(i)));
+        impostor->capture(v);
+        m_stats.impostorCaptures++;
+    }
+    if (!impostor->quad(v,set->instance(i),transformation,quad))
+        return false;
+
+    if (m_pointLights.empty() || !m_pointLights[0]->shadow_buffer)
+        return true;
+    Vector toLight = -m_pointLights[0]->directionAt(b.center).normalized()*
+        b.radius;
+    for (int k=0; k<2; k++)
+        for (int c=0; c<3; c++) {
+            quad[k].real[c][0] += toLight.x;
+            quad[k].real[c][1] += toLight.y;
+            quad[k].real[c][2] += toLight.z;
+        }
+    return true;
+}
+
+// Record or stop recording frames, the next frame prepares and
+// records everything
+void Shader::setRecording(bool enable) {
+    m_recording = enable;
+    m_drawn = false;
+}
+
+// Record the objects prepared this frame into their segments, spread
+// over threads, and when everything was prepared the instances too
+void Shader::record(const Matrix<float>& transformation,
+        const Frustum& frustum, bool everything) {
+    m_commands.resize(m_objects.size()+m_instanceSets.size());
+    m_commands.setTarget(mp_drawer->getWidth(),mp_drawer->getHeight());
+
+    unsigned surfaceCount = 0;
+    for (unsigned i=0; i<m_prepared.size(); i++)
+        surfaceCount += m_objects[m_prepared[i]]->surfaceCount();
+    unsigned workers = 1;
+    if (surfaceCount >= recordGrain)
+        workers = Math::max(1u,Math::min(
+                    std::thread::hardware_concurrency(),
+                    (unsigned)m_prepared.size()));
+    auto work = [this,workers](unsigned w) {
+        for (unsigned i=w; i<m_prepared.size(); i+=workers) {
+            unsigned k = m_prepared[i];
+            m_commands.clear(k);
+            if (!hidden(k))
+                m_commands.record(k,m_objects[k],m_area[k]);
+        }
+    };
+    std::vector<std::future<void> > jobs;
+    for (unsigned w=1; w<workers; w++)
+        jobs.push_back(std::async(std::launch::async,work,w));
+    work(0);
+    for (unsigned j=0; j<jobs.size(); j++)
+        jobs[j].get();
+
+    // The instances share their mesh, they are prepared and recorded
+    // one after another
+    if (!everything)
+        return;
+    m_stats.instances = 0;
+    m_stats.impostors = 0;
+    for (unsigned s=0; s<m_instanceSets.size(); s++) {
+        unsigned segment = m_objects.size()+s;
+        InstanceSet* set = m_instanceSets[s];
+        Object* mesh = set->mesh();
+        m_commands.clear(segment);
+        m_commands.setOpacity(segment,mesh->material().opacity);
+        for (unsigned i=0; i<set->size(); i++) {
+            Vector min, max;
+            Rect area;
+            float nearest;
+            set->box(i,min,max);
+            if (!frustum.sees(min,max))
+                continue;
+            project(min,max,transformation,area,nearest);
+            CommandBuffer::Command quad[2];
+            if (impostor(s,i,min,max,transformation,quad)) {
+                m_commands.record(segment,quad[0],area);
+                m_commands.record(segment,quad[1],area);
+                m_stats.impostors++;
+                continue;
+            }
+            set->place(i);
+            prepare(mesh,transformation);
+            tint(mesh,set->instance(i).tint);
+            m_commands.record(segment,mesh,area);
+            m_stats.instances++;
+        }
+    }
+}
+
+// Rasterize the recorded opaque or translucent segments over "dirty",
+// the objects in draw order, then the instance sets
+void Shader::execute(bool translucent, const Rect& dirty) {
+    for (unsigned n=0; n<m_commands.size(); n++) {
+        unsigned s = n;
+        if (n<m_objects.size() && !translucent)
+            s = m_order[n];
+        if ((m_commands.opacity(s)<1)!=translucent ||
+                !m_commands.area(s).overlaps(dirty))
+            continue;
+        if (translucent)
+            mp_drawer->setOpacity(m_commands.opacity(s));
+        m_commands.execute(s,mp_drawer,this);
+    }
+}
+
+// Rasterize the last recorded frame at w x h
+void Shader::replay(unsigned w, unsigned h) {
+    if (!m_recording || !m_drawn)
+        throw ex::InitFailure();
+    mp_drawer->setRenderSize(w,h);
+    mp_drawer->clear(goodcolor);
+    // Recorded areas are at the recorded size
+    Rect all(-(1<<20),-(1<<20),1<<20,1<<20);
+    execute(false,all);
+    execute(true,all);
+    mp_drawer->setOpacity(1);
+    mp_drawer->resolve();
+    m_reprojector.invalidate();
+    mp_drawer->update();
+}
+
+// Multiply the lit colors of an object by "tint"
+void Shader::tint(Object* obj, Color tint) {
+    if (tint.red==255 && tint.green==255 && tint.blue==255)
+        return;
+    unsigned count = obj->surfaceCount()*
+        (obj->getShading()==Shading::gouraud ? 3 : 1);
+    for (unsigned i=0; i<count; i++) {
+        Color& c = obj->getColor(i);
+        c.red = c.red*tint.red/255;
+        c.green = c.green*tint.green/255;
+        c.blue = c.blue*tint.blue/255;
+    }
+}
+
+// Objects that may cast shadows in the view of a light
+void Shader::shadowCasters(const Frustum& frustum,
+        std::vector<unsigned>& casters) {
+    casters.clear();
+    selectLevels();
+    m_bvh.update(m_objects);
+    m_bvh.cull(frustum,[&](unsigned k) { casters.push_back(k); });
+}
+
+// Nearest surface along a ray
+bool Shader::trace(const Vector& origin, const Vector& dir, Hit& hit) {
+    m_bvh.update(m_objects);
+    return m_bvh.trace(origin,dir,hit);
+}
+
+// The surface seen at pixel (x,y): the ray from the camera through
+// the pixel's centre, the pixel taken back to world co-ordinates
+bool Shader::pick(int x, int y, Hit& hit) {
+    Matrix<float> transformation =
         TfMatrix::toDevice(mp_drawer->getWidth(),
                 mp_drawer->getHeight(), ScreenPoint::maxDepth)
-        *TfMatrix::perspective(95,mp_drawer->getAspectRatio()
-                ,10000,5)
-        *TfMatrix::lookAt(m_camera.vrp,m_camera.vpn,m_camera.vup);
+        *clipMatrix();
+    Vector pixel(x+0.5f,y+0.5f,ScreenPoint::maxDepth/2.0f,1);
+    Vector world = pixel*transformation.inverse();
+    world /= world.w;
+    Vector dir = world-m_camera.vrp;
+    dir.w = 0;
+    return trace(m_camera.vrp,dir,hit);
+}
 
-    for (unsigned int k=0; k<m_objects.size(); k++) {
+// Enable or disable the temporal reprojection
+void Shader::setReprojection(bool enable, unsigned refreshPeriod,
+        unsigned maxReuse) {
+    m_reprojection = enable;
+    m_reprojector.refreshPeriod(refreshPeriod);
+    m_reprojector.maxReuse(maxReuse);
+}
+
+Shader::~Shader() {
+}
+
+// Enable or disable the dynamic resolution
+void Shader::setFrameBudget(uintmax_t micros, float minScale) {
+    m_dynamicResolution = micros!=0;
+    m_resolution = ResolutionController(micros,minScale);
+    applyRenderScale();
+}
+
+// Resize the render target to the controller's scale
+void Shader::applyRenderScale() {
+    float scale = m_dynamicResolution ? m_resolution.scale() : 1;
+    unsigned w = Math::round(mp_drawer->getWindowWidth()*scale);
+    unsigned h = Math::round(mp_drawer->getWindowHeight()*scale);
+    if ((int)w!=mp_drawer->getWidth() || (int)h!=mp_drawer->getHeight())
+        mp_drawer->setRenderSize(w,h);
+}
+
+// Exact comparison, any change at all must be noticed
+static bool same(const Vector& a, const Vector& b) {
+    return a.x==b.x && a.y==b.y && a.z==b.z && a.w==b.w;
+}
+
+static bool same(const Camera& a, const Camera& b) {
+    return same(a.vrp,b.vrp) && same(a.vpn,b.vpn) && same(a.vup,b.vup);
+}
+
+static bool same(const Coeffecient& a, const Coeffecient& b) {
+    return a.b==b.b && a.g==b.g && a.r==b.r;
+}
+
+// Whether the camera, the lights or the render target changed
+// since the last frame
+bool Shader::viewChanged(bool ignoreCamera) const {
+    return !m_drawn || (!ignoreCamera && !same(m_camera,m_last.camera)) ||
+        m_objects.size()!=m_last.versions.size() ||
+        mp_drawer->getWidth()!=m_last.width ||
+        mp_drawer->getHeight()!=m_last.height ||
+        (mp_cells && mp_cells->version()!=m_last.cellsVersion) ||
+        lightsChanged();
+}
+
+// Whether the lights differ from those of the last frame
+bool Shader::lightsChanged() const {
+    if (!m_drawn ||
+            !same(m_ambientLight.intensity,m_last.ambient.intensity) ||
+            m_pointLights.size()!=m_last.lights.size())
+        return true;
+    for (unsigned i=0; i<m_pointLights.size(); i++) {
+        const PointLight& l = *m_pointLights[i];
+        const LightState& ls = m_last.lights[i];
+        if (!same(l.cam,ls.cam) || !same(l.intensity,ls.intensity) ||
+                l.magic!=ls.magic || (l.shadow_buffer!=NULL)!=ls.shadow)
+            return true;
+    }
+    return false;
+}
+
+// Whether any object or instance changed since the last frame
+bool Shader::objectsChanged() const {
+    if (m_objects.size()!=m_last.versions.size() || instancesChanged())
+        return true;
+    for (unsigned k=0; k<m_objects.size(); k++)
+        if (m_objects[k]!=m_last.objects[k] ||
+                m_objects[k]->version()!=m_last.versions[k] ||
+                (m_lods[k] && m_lods[k]->changed()))
+            return true;
+    return false;
+}
+
+// Whether an instance was added or changed since the last frame
+bool Shader::instancesChanged() const {
+    if (m_instanceSets.size()!=m_last.instanceVersions.size())
+        return true;
+    for (unsigned s=0; s<m_instanceSets.size(); s++)
+        if (m_instanceSets[s]->version()!=m_last.instanceVersions[s])
+            return true;
+    return false;
+}
 
-        // Get the vertex copy matrix
-        // NOTE: getting a vertex matrix will reset the
-        // previous content of the copy vertex matrix
-        Matrix<float>& copyalias = m_objects[k]->vcmatrix();
-        copyalias /= transformation;
+// Whether the next frame would differ from the last one
+bool Shader::changed() const {
+    return viewChanged() || objectsChanged();
+}
+
+// Remember the view the frame was drawn from
+void Shader::rememberView() {
+    m_drawn = true;
+    m_last.camera = m_camera;
+    m_last.ambient = m_ambientLight;
+    m_last.width = mp_drawer->getWidth();
+    m_last.height = mp_drawer->getHeight();
+    m_last.cellsVersion = mp_cells ? mp_cells->version() : 0;
+    m_last.instanceVersions.resize(m_instanceSets.size());
+    for (unsigned s=0; s<m_instanceSets.size(); s++)
+        m_last.instanceVersions[s] = m_instanceSets[s]->version();
+    m_last.lights.resize(m_pointLights.size());
+    for (unsigned i=0; i<m_pointLights.size(); i++) {
+        m_last.lights[i].cam = m_pointLights[i]->cam;
+        m_last.lights[i].intensity = m_pointLights[i]->intensity;
+        m_last.lights[i].magic = m_pointLights[i]->magic;
+        m_last.lights[i].shadow = m_pointLights[i]->shadow_buffer!=NULL;
+    }
+}
+
+// Length of the diagonal of the box bounding all objects
+float Shader::sceneSize() const {
+    Vector smin, smax;
+    bool first = true;
+    for (unsigned k=0; k<m_objects.size(); k++) {
+        if (m_objects[k]->vertexCount()==0)
+            continue;
+        Vector vmin = m_objects[k]->bounds().min;
+        Vector vmax = m_objects[k]->bounds().max;
+        if (first) {
+            smin = vmin; smax = vmax; first = false;
+            continue;
+        }
+        smin = {Math::min(smin.x,vmin.x),Math::min(smin.y,vmin.y),
+            Math::min(smin.z,vmin.z),1};
+        smax = {Math::max(smax.x,vmax.x),Math::max(smax.y,vmax.y),
+            Math::max(smax.z,vmax.z),1};
+    }
+    return (smax-smin).magnitude();
+}
+
+// The screen area in which the shadows of an object may fall. The
+// corners of its bounding box are pushed away from every shadow
+// casting light by "reach", the size of the scene; the shadow lies
+// within the box and the pushed corners.
+Rect Shader::shadowArea(Object* obj, const Matrix<float>& transformation,
+        float reach) const {
+    Rect area;
+    if (obj->vertexCount()==0)
+        return area;
 
+    Vector omin = obj->bounds().min;
+    Vector omax = obj->bounds().max;
+
+    for (unsigned l=0; l<m_pointLights.size(); l++) {
+        if (m_pointLights[l]->shadow_buffer==NULL)
+            continue;
+        for (int c=0; c<8; c++) {
+            Vector corner((c&1)?omax.x:omin.x, (c&2)?omax.y:omin.y,
+                    (c&4)?omax.z:omin.z, 1);
+            Vector pushed = corner + m_pointLights[l]->
+                directionAt(corner).normalized()*reach;
+            pushed.w = 1;
+            Vector pts[] = {corner*transformation,
+                pushed*transformation};
+            for (int p=0; p<2; p++) {
+                if (pts[p].w <= 0)
+                    return mp_drawer->screenRect();
+                area.include(std::floor(pts[p].x/pts[p].w),
+                        std::floor(pts[p].y/pts[p].w));
+            }
+        }
+    }
+    if (!area.empty())
+        area = Rect(area.x0-1,area.y0-1,area.x1+1,area.y1+1);
+    return area;
+}
+
+// Transform the vertices of an object to the screen and
+// light its surfaces. Returns the screen area it covers.
+Rect Shader::prepare(Object* obj, const Matrix<float>& transformation,
+        const std::vector<unsigned>* surfaces,
+        const std::vector<unsigned>* vertices) {
+
+    // VERTEX stage
+    // Every vertex is taken from the model to the device, divided
+    // and rounded once, the triangles index into the result
+    // The model matrix is folded into the transformation, and the
+    // world position is taken in the same pass
+    // The screen area covered is gathered on the way, a vertex
+    // behind the camera may project anywhere
+    Rect area;
+    ProjectedVertices& out = obj->projected();
+    out.resize(obj->vertexCount());
+    if (!obj->vertexCount())
+        return area;
+    const Matrix<float>& vertex = obj->modelVertices();
+    const float* vx = &vertex(0,0);
+    const float* vy = &vertex(1,0);
+    const float* vz = &vertex(2,0);
+    const float* vw = &vertex(3,0);
+    const Matrix<float>& model = obj->model();
+    Matrix<float> full = transformation*model;
+    float t[16], m[12];
+    for (unsigned e=0; e<16; e++)
+        t[e] = full(e);
+    for (unsigned e=0; e<12; e++)
+        m[e] = model(e);
+    bool behind = false;
+    unsigned count = vertices ? vertices->size() : obj->vertexCount();
+    for (unsigned n=0; n<count; n++) {
+        unsigned i = vertices ? (*vertices)[n] : n;
+        float x = t[0]*vx[i] + t[1]*vy[i] + t[2]*vz[i] + t[3]*vw[i];
+        float y = t[4]*vx[i] + t[5]*vy[i] + t[6]*vz[i] + t[7]*vw[i];
+        float z = t[8]*vx[i] + t[9]*vy[i] + t[10]*vz[i] + t[11]*vw[i];
+        float w = t[12]*vx[i] + t[13]*vy[i] + t[14]*vz[i] + t[15]*vw[i];
+        out.wx[i] = m[0]*vx[i] + m[1]*vy[i] + m[2]*vz[i] + m[3]*vw[i];
+        out.wy[i] = m[4]*vx[i] + m[5]*vy[i] + m[6]*vz[i] + m[7]*vw[i];
+        out.wz[i] = m[8]*vx[i] + m[9]*vy[i] + m[10]*vz[i] + m[11]*vw[i];
+        if (w <= 0)
+            behind = true;
         // Perspective divide, homogenous co-ordinates
         // to normalized co-ordinate
-        // NOTE: this can be done later in life
-        for (unsigned i=0; i<m_objects[k]->vertexCount(); i++) {
-            copyalias(0,i) /= copyalias(3,i);
-            copyalias(1,i) /= copyalias(3,i);
-            copyalias(2,i) /= copyalias(3,i);
-            copyalias(3,i) = 1.0;
-        }
-
-        // SURFACE SHADER
-        BACKFACEDETECTION = m_objects[k]->backface();
-        UNBOUNDED = m_objects[k]->bothsides();
-        GOURAUD = m_objects[k]->getShading()==Shading::gouraud;
-
-        // Detect backfaces in normalized co-ordinates
-        if(BACKFACEDETECTION) {
-            for(int i=0;i<m_objects[k]->surfaceCount();i++) {
-                // This normal is a special kind of normal,
-                // it uses x and y of the projected matrix so as
-                // to get orthogonal projection system but original
-                // Z value for better depth calculation
-                Vector normal = m_objects[k]->
-                    getDistortedSurfaceNormal(i);
-
-                m_objects[k]->getSurface(i).visible=(normal.z<0);
-            }
+        x /= w;
+        y /= w;
+        z /= w;
+        out.sx[i] = x;
+        out.sy[i] = y;
+        out.sz[i] = z;
+        out.q[i] = 1/w;
+        out.x[i] = Math::round(x);
+        out.y[i] = Math::round(y);
+        out.d[i] = Math::round(z);
+        area.include(std::floor(x),std::floor(y));
+    }
+    if (behind)
+        area = mp_drawer->screenRect();
+    else if (!area.empty())
+        area = Rect(area.x0-1,area.y0-1,area.x1+1,area.y1+1);
+
+    // SURFACE SHADER
+    bool BACKFACEDETECTION, UNBOUNDED, GOURAUD;
+    BACKFACEDETECTION = obj->backface();
+    UNBOUNDED = obj->bothsides();
+    GOURAUD = obj->getShading()==Shading::gouraud;
+
+    // Detect backfaces in normalized co-ordinates
+    // Only the listed surfaces are tested, all of them without a
+    // list. Those left are lit and later rasterized, backfaces of
+    // unbounded objects are kept and lit from behind
+    FacingSurfaces& facing = obj->facing();
+    facing.cull(out,obj->surfaces(),surfaces,BACKFACEDETECTION,
+            UNBOUNDED);
+
+    if (GOURAUD) {
+        // VERTEX shader
+
+        // unsigned vnn =0;
+        if (!obj->getSurface(0).vertexNormals) {
+            obj->initNormal();
+            /*std::cout<<obj->vertexNormalCount()
+                <<std::endl;
+            std::cout<<obj->vertexCount()<<std::endl;*/
+            // vnn = obj->vcmatrix().col();
+            //std::cout<<vnn<<std::endl;
         }
 
-        if (GOURAUD) {
-            // VERTEX shader
+        // Vertex normals are in model co-ordinates, the inverse
+        // transpose of the model's linear part turns them to the
+        // world
+        bool placed = obj->node()!=NULL;
+        Matrix<float> normalMatrix = placed ?
+            obj->model().inverse().transpose() : Matrix<float>({4,4});
 
-            // unsigned vnn =0;
-            if (!m_objects[k]->getSurface(0).vertexNormals) {
-                m_objects[k]->initNormal();
-                /*std::cout<<m_objects[k]->vertexNormalCount()
-                    <<std::endl;
-                std::cout<<m_objects[k]->vertexCount()<<std::endl;*/
-                // vnn = m_objects[k]->vcmatrix().col();
-                //std::cout<<vnn<<std::endl;
-            }
+        obj->initColors(obj->surfaceCount()*3);
+        // Surfaces come grouped by material, what depends only on it
+        // is taken once a run
+        unsigned current = ~0u;
+        const Material* material = NULL;
+        Coeffecient ambient;
+        for(unsigned n=0;n<facing.list.size();n++) {
+            unsigned i = facing.list[n];
 
-            m_objects[k]->initColors(m_objects[k]->surfaceCount()*3);
-            for(auto i=0;i<m_objects[k]->surfaceCount();i++) {
-
-                // An object may have surfaces of
-                // different materials
-                const Material& material =
-                    m_objects[k]->material();
-
-                // The surface to be shaded
-                Surface surf = m_objects[k]->getSurface(i);
-
-                // Normals for lighting calculation
-                Vector normals[] = {
-                m_objects[k]->getVertexNormal(surf.nx),
-                m_objects[k]->getVertexNormal(surf.ny),
-                m_objects[k]->getVertexNormal(surf.nz)};
-                // Position for lighting calculation
-                Vector positions[] = {
-                    m_objects[k]->getVertex(surf.x),
-                    m_objects[k]->getVertex(surf.y),
-                    m_objects[k]->getVertex(surf.z)};
-
-                // If backfacedetection then continue
-                // if suitable
-                if (!UNBOUNDED && BACKFACEDETECTION &&
-                        !m_objects[k]->getSurface(i).visible)
-                    continue;
-
-                // Inverting the back surfaces for
-                // unbounded objects
-                else if (UNBOUNDED && !m_objects[k]->
-                        getSurface(i).visible) {
-                    for (int h=0; h<3; h++)
-                        normals[h] *=-1;
-                }
+            // The surface to be shaded
+            const Surface& surf = obj->getSurface(i);
 
+            // An object may have surfaces of
+            // different materials
+            if (surf.material != current) {
+                current = surf.material;
+                material = &obj->material(current);
+                ambient = m_ambientLight.intensity*material->ka;
+            }
 
+            // Normals for lighting calculation
+            Vector normals[] = {
+            obj->getVertexNormal(surf.nx),
+            obj->getVertexNormal(surf.ny),
+            obj->getVertexNormal(surf.nz)};
+            if (placed)
                 for (int h=0; h<3; h++) {
-                    // Ambient lighting
-                    Coeffecient intensity = m_ambientLight.intensity
-                        *material.ka;
-
-                    // Diffused and Specular lighting
-                    for(int x=0; x<m_pointLights.size(); x++)
-                        intensity += m_pointLights[x]->lightingAt(
-                                positions[h],normals[h],
-                                material,m_camera.vrp);
-
-                    // Automatic conversion from Coeffecient
-                    // to Color
-                    // The reflection surface can be seen as a
-                    // light source to camera
-                    m_objects[k]->getColor(i*3+h) = PointLight(
-                            {positions[h],{0,0,0,0},{0,0,0,0}},
-                            intensity).intensityAt(m_camera.vrp);
+                    Vector m = normals[h];
+                    normals[h] = Vector(
+                        normalMatrix(0,0)*m.x + normalMatrix(0,1)*m.y +
+                        normalMatrix(0,2)*m.z,
+                        normalMatrix(1,0)*m.x + normalMatrix(1,1)*m.y +
+                        normalMatrix(1,2)*m.z,
+                        normalMatrix(2,0)*m.x + normalMatrix(2,1)*m.y +
+                        normalMatrix(2,2)*m.z, 0).normalized();
                 }
+            // Position for lighting calculation, as placed by the
+            // vertex stage
+            Vector positions[] = {
+                Vector(out.wx[surf.x],out.wy[surf.x],out.wz[surf.x],1),
+                Vector(out.wx[surf.y],out.wy[surf.y],out.wz[surf.y],1),
+                Vector(out.wx[surf.z],out.wy[surf.z],out.wz[surf.z],1)};
+
+            // Inverting the back surfaces for
+            // unbounded objects
+            if (UNBOUNDED && !facing.facing(i)) {
+                for (int h=0; h<3; h++)
+                    normals[h] *=-1;
             }
-        } else {
-            // SURFACE shader
-            m_objects[k]->initColors(m_objects[k]->surfaceCount());
-            //colors =  new Color[obj.surfaceCount()];
-
-            for(auto i=0;i<m_objects[k]->surfaceCount();i++) {
-                // An object may have surfaces of
-                // different materials
-                const Material& material =
-                    m_objects[k]->material();
-                // Normal for lighting calculation
-                Vector normal =
-                    m_objects[k]->getSurfaceNormal(i);
-                // Position for lighting calculation
-                Vector position =  m_objects[k]->
-                    getSurfaceCentroid(i);
-
-                // If backfacedetection then continue
-                // if suitable
-                if (!UNBOUNDED && BACKFACEDETECTION &&
-                        !m_objects[k]->getSurface(i).visible)
-                    continue;
-
-                // Inverting the back surfaces for
-                // unbounded objects
-                else if (UNBOUNDED && !m_objects[k]->
-                        getSurface(i).visible)
-                    normal *= -1;
 
+
+            for (int h=0; h<3; h++) {
                 // Ambient lighting
-                Coeffecient intensity = m_ambientLight.intensity
-                    *material.ka;
+                Coeffecient intensity = ambient;
 
                 // Diffused and Specular lighting
-                for(int i=0; i<m_pointLights.size(); i++)
-                    intensity += m_pointLights[i]->lightingAt(
-                            position,normal,material,m_camera.vrp);
+                for(int x=0; x<m_pointLights.size(); x++)
+                    intensity += m_pointLights[x]->lightingAt(
+                            positions[h],normals[h],
+                            *material,m_camera.vrp);
 
                 // Automatic conversion from Coeffecient
                 // to Color
                 // The reflection surface can be seen as a
                 // light source to camera
-                m_objects[k]->getColor(i) = PointLight({position,
-                        {0,0,0,0},{0,0,0,0}},
+                obj->getColor(i*3+h) = PointLight(
+                        {positions[h],{0,0,0,0},{0,0,0,0}},
                         intensity).intensityAt(m_camera.vrp);
             }
         }
+    } else {
+        // SURFACE shader
+        obj->initColors(obj->surfaceCount());
+        //colors =  new Color[obj.surfaceCount()];
+
+        unsigned current = ~0u;
+        const Material* material = NULL;
+        Coeffecient ambient;
+        for(unsigned n=0;n<facing.list.size();n++) {
+            unsigned i = facing.list[n];
+            // An object may have surfaces of
+            // different materials
+            unsigned id = obj->getSurface(i).material;
+            if (id != current) {
+                current = id;
+                material = &obj->material(current);
+                ambient = m_ambientLight.intensity*material->ka;
+            }
+            // Normal and position for lighting calculation, from the
+            // corners as placed by the vertex stage
+            const Surface& surf = obj->getSurface(i);
+            Vector v1(out.wx[surf.x],out.wy[surf.x],out.wz[surf.x],1);
+            Vector v2(out.wx[surf.y],out.wy[surf.y],out.wz[surf.y],1);
+            Vector v3(out.wx[surf.z],out.wy[surf.z],out.wz[surf.z],1);
+            Vector normal = ((v2-v1)*(v3-v2)).normalized();
+            Vector position = (v1+v2+v3)/3;
+
+            // Inverting the back surfaces for
+            // unbounded objects
+            if (UNBOUNDED && !facing.facing(i))
+                normal *= -1;
+
+            // Ambient lighting
+            Coeffecient intensity = ambient;
+
+            // Diffused and Specular lighting
+            for(int i=0; i<m_pointLights.size(); i++)
+                intensity += m_pointLights[i]->lightingAt(
+                        position,normal,*material,m_camera.vrp);
+
+            // Automatic conversion from Coeffecient
+            // to Color
+            // The reflection surface can be seen as a
+            // light source to camera
+            obj->getColor(i) = PointLight({position,
+                    {0,0,0,0},{0,0,0,0}},
+                    intensity).intensityAt(m_camera.vrp);
+        }
     }
+    return area;
+}
 
-    // Clear framebuffer, we're about to plot
-    mp_drawer->clear(goodcolor);
+/* Draw a frame on the screen */
+void Shader::draw() {
 
-    // Fill the surfaces
-    for(int k=0;k<m_objects.size(); k++){
+    // Measure the frame for the resolution controller
+    Time frametime(0);
+    frametime.start();
 
-        BACKFACEDETECTION = m_objects[k]->backface();
-        UNBOUNDED = m_objects[k]->bothsides();
-        GOURAUD = m_objects[k]->getShading()==Shading::gouraud;
+    // Apply camera projection and perspective
+    // projection transformation
+    // Change homogeneous co-ordinate system
+    // to device co-ordinate system
+    Matrix<float> clip = clipMatrix();
+    Matrix<float>transformation =
+        TfMatrix::toDevice(mp_drawer->getWidth(),
+                mp_drawer->getHeight(), ScreenPoint::maxDepth)
+        *clip;
 
-        for (int i=0; i<m_objects[k]->surfaceCount(); i++) {
+    // Objects wholly outside the view volume are neither
+    // transformed, lit nor rasterized, and of large objects only the
+    // clusters of triangles inside are
+    Frustum frustum(clip);
+    selectLevels();
+    m_bvh.update(m_objects);
+    m_culled.assign(m_objects.size(),true);
+    m_bvh.cull(frustum,[&](unsigned k) { m_culled[k] = false; });
 
-            if (!UNBOUNDED && BACKFACEDETECTION &&
-                    !m_objects[k]->getSurface(i).visible)
+    // Objects in cells the camera's cell doesn't see into through
+    // any portal are culled as well
+    m_stats.visibleCells = 0;
+    if (mp_cells) {
+        mp_cells->update(clip,m_camera.vrp);
+        m_stats.visibleCells = mp_cells->visibleCount();
+        for (unsigned k=0; k<m_objects.size(); k++) {
+            if (m_culled[k])
                 continue;
+            const Bounds& b = m_objects[k]->bounds();
+            if (!mp_cells->visible(k,b.min,b.max))
+                m_culled[k] = true;
+        }
+    }
+
+    // A new view needs everything again, otherwise only the
+    // objects that changed are prepared, and the screen area they
+    // covered and cover now, shadows included, is redrawn.
+    bool everything = viewChanged() || instancesChanged();
+
+    // Impostors are pictures of lit meshes, new lights need new ones
+    m_stats.impostorCaptures = 0;
+    if (lightsChanged())
+        for (unsigned s=0; s<m_impostors.size(); s++)
+            if (m_impostors[s])
+                m_impostors[s]->invalidate();
+
+    // Large opaque objects wholly in front of the camera occlude the
+    // others. When one of them changes what it hides may change
+    // anywhere, so everything is tested and drawn again.
+    m_occluder.resize(m_objects.size(),false);
+    m_occluded.resize(m_objects.size(),false);
+    for (unsigned k=0; k<m_objects.size(); k++) {
+        const Bounds& b = m_objects[k]->bounds();
+        bool was = m_occluder[k];
+        m_occluder[k] = m_occlusion && !m_culled[k] &&
+            !m_objects[k]->material().translucent() &&
+            frustum.inFront(b.min,b.max) &&
+            screenSize(b) >= m_occluderSize*mp_drawer->getHeight();
+        if ((was || m_occluder[k]) && (k>=m_last.objects.size() ||
+                    m_objects[k]!=m_last.objects[k] ||
+                    m_objects[k]->version()!=m_last.versions[k]))
+            everything = true;
+    }
+    bool modified = everything;
+    // When only the camera moved the last frame can be reused
+    bool reproject = everything && m_reprojection && m_drawn &&
+        m_reprojector.available() && !viewChanged(true) &&
+        !objectsChanged();
+    m_last.versions.resize(m_objects.size(),0);
+    m_last.objects.resize(m_objects.size(),NULL);
+    m_area.resize(m_objects.size());
+    m_shadow.resize(m_objects.size());
+    m_footprint.resize(m_objects.size());
+    m_inLayer.resize(m_objects.size(),false);
+    m_surfaces.resize(m_objects.size());
+    m_allSurfaces.resize(m_objects.size(),true);
+    m_meshlets.resize(m_objects.size(),NULL);
+    m_vertices.resize(m_objects.size());
+    if (everything)
+        m_layerValid = false;
+
+    // Occluders are prepared first, then drawn into the occlusion
+    // buffer before the other objects are tested against it
+    Rect dirty;
+    float reach = -1;
+    bool occludersDrawn = false;
+    m_prepared.clear();
+    m_stats.occlusionTests = 0;
+    m_stats.culledMeshlets = 0;
+    m_stats.culledPatches = 0;
+    for (unsigned pass=0; pass<2; pass++)
+    for (unsigned int k=0; k<m_objects.size(); k++) {
+        if (m_occluder[k] != (pass==0))
+            continue;
+        bool moved = m_objects[k]!=m_last.objects[k] ||
+            m_objects[k]->version()!=m_last.versions[k];
+        if (!everything && !moved)
+            continue;
+        if (pass==1 && m_occlusion && !m_culled[k] && !occludersDrawn) {
+            drawOccluders();
+            occludersDrawn = true;
+        }
+        modified = true;
+        // An object drawn into the layer, or one to be drawn into it
+        // now, changed
+        if (layered(k) || m_inLayer[k])
+            m_layerValid = false;
+        dirty = dirty.unite(m_footprint[k]);
+        const Bounds& b = m_objects[k]->bounds();
+        m_allSurfaces[k] = !m_bvh.clustered(k) ||
+            frustum.contains(b.min,b.max);
+        m_occluded[k] = pass==1 && m_occlusion && !m_culled[k] &&
+            occluded(k,transformation);
+        if (m_sortClusters && m_bvh.clustered(k))
+            m_allSurfaces[k] = false;
+        // Meshlets made for another level of detail, or before the
+        // surfaces changed, are of no use
+        const Meshlets* meshlets = m_meshlets[k];
+        if (meshlets && (meshlets->object()!=m_objects[k] ||
+                    !meshlets->valid()))
+            meshlets = NULL;
+        if (meshlets)
+            m_allSurfaces[k] = false;
+        Terrain* terrain = m_terrains[k];
+        if (terrain && terrain->object()!=m_objects[k])
+            terrain = NULL;
+        if (terrain)
+            m_allSurfaces[k] = false;
+        if (!hidden(k) && !m_allSurfaces[k]) {
+            if (terrain)
+                m_stats.culledPatches += terrain->cull(frustum,
+                        m_surfaces[k],m_vertices[k]);
+            else if (meshlets)
+                m_stats.culledMeshlets += meshlets->cull(frustum,
+                        m_camera.vrp,m_objects[k]->backface() &&
+                        !m_objects[k]->bothsides(),m_surfaces[k],
+                        m_vertices[k]);
+            else if (m_sortClusters)
+                m_bvh.sortSurfaces(k,frustum,m_camera.vrp,
+                        m_camera.vpn.normalized(),m_surfaces[k]);
+            else
+                m_bvh.cullSurfaces(k,frustum,m_surfaces[k]);
+        }
+        m_area[k] = hidden(k) ? Rect() :
+            prepare(m_objects[k],transformation,surfaces(k),
+                    meshlets || terrain ? &m_vertices[k] : NULL);
+        m_prepared.push_back(k);
+        if (reach < 0)
+            reach = sceneSize();
+        // Shadows of a culled object may still fall in view
+        m_shadow[k] = shadowArea(m_objects[k],transformation,reach);
+        m_footprint[k] = m_area[k].unite(m_shadow[k]);
+        dirty = dirty.unite(m_footprint[k]);
+        m_last.versions[k] = m_objects[k]->version();
+        m_last.objects[k] = m_objects[k];
+    }
+    rememberView();
+    m_frame++;
+    if (m_recording)
+        record(transformation,frustum,everything);
+    m_stats.objects = m_objects.size();
+    m_stats.culledObjects = 0;
+    m_stats.occludedObjects = 0;
+    m_stats.surfaces = 0;
+    for (unsigned k=0; k<m_objects.size(); k++) {
+        if (m_culled[k])
+            m_stats.culledObjects++;
+        else if (m_occluded[k])
+            m_stats.occludedObjects++;
+        else
+            m_stats.surfaces += surfaces(k) ? surfaces(k)->size() :
+                m_objects[k]->surfaceCount();
+    }
+
+    // Nothing changed, the last frame is still on the screen
+    m_stats.redrawnPixels = 0;
+    dirty = dirty.intersect(mp_drawer->screenRect());
+    if (!modified || (!everything && dirty.empty()))
+        return;
+
+    // Redrawing most of the screen in pieces isn't worth it, and a
+    // new static layer is drawn whole
+    Rect screen = mp_drawer->screenRect();
+    bool useLayer = m_staticLayer && !reproject && !m_recording;
+    if (everything || dirty.area()*2 > screen.area() ||
+            (useLayer && !m_layerValid))
+        dirty = screen;
+    bool partial = dirty.area() < screen.area();
 
-            int index = m_objects[k]->getSurface(i).x;
-            ScreenPoint a(m_objects[k]->getCopyVertex(index),
-                    m_objects[k]->getColor(GOURAUD?(i*3):i));
-            a.real = m_objects[k]->getVertex(index);
+    // Clear framebuffer, we're about to plot
+    mp_drawer->setClip(dirty);
+    m_stats.reusedPixels = 0;
+    m_stats.layeredObjects = 0;
+    if (reproject) {
+        // Start from the last frame seen from the new view, only the
+        // pixels it doesn't cover are shaded
+        m_stats.reusedPixels = m_reprojector.reproject(mp_drawer,
+                m_lastTransformation,transformation,goodcolor);
+        mp_drawer->setMask(m_reprojector.mask());
+    } else if (useLayer && m_layerValid) {
+        // The saved static objects take the place of a clear
+        mp_drawer->restoreLayer(dirty);
+        for (unsigned k=0; k<m_objects.size(); k++)
+            if (layered(k))
+                m_stats.layeredObjects++;
+    } else if (partial)
+        mp_drawer->clear(goodcolor,dirty);
+    else
+        mp_drawer->clear(goodcolor);
+    if (!reproject && !partial)
+        m_reprojector.invalidate();
 
-            index = m_objects[k]->getSurface(i).y;
-            ScreenPoint b(m_objects[k]->getCopyVertex(index),
-                    m_objects[k]->getColor(GOURAUD?(i*3+1):i));
-            b.real = m_objects[k]->getVertex(index);
+    sortObjects();
+    mp_drawer->resetShadedCount();
+    mp_drawer->resetTriangleCounts();
+    if (!m_recording) {
+        m_stats.instances = 0;
+        m_stats.impostors = 0;
+    }
+    if (useLayer) {
+        if (!m_layerValid) {
+            // The screen was just cleared, draw the static objects
+            // alone and save them
+            m_bakedShadow = Rect();
+            for (unsigned n=0; n<m_objects.size(); n++) {
+                unsigned k = m_order[n];
+                m_inLayer[k] = layered(k);
+                if (layered(k) && !hidden(k))
+                    fill(m_objects[k]);
+                else
+                    m_bakedShadow = m_bakedShadow.unite(m_shadow[k]);
+            }
+            mp_drawer->saveLayer();
+            m_layerValid = true;
+        }
 
-            index = m_objects[k]->getSurface(i).z;
-            ScreenPoint c(m_objects[k]->getCopyVertex(index),
-                    m_objects[k]->getColor(GOURAUD?(i*3+2):i));
-            c.real = m_objects[k]->getVertex(index);
+        // Where moving objects cast shadows, now or when the layer
+        // was drawn, the static objects are drawn again
+        Rect shaded = m_bakedShadow;
+        for (unsigned k=0; k<m_objects.size(); k++)
+            if (!layered(k))
+                shaded = shaded.unite(m_shadow[k]);
+        shaded = shaded.intersect(dirty);
+        if (!shaded.empty() && m_stats.layeredObjects) {
+            mp_drawer->setClip(shaded);
+            mp_drawer->clear(goodcolor,shaded);
+            for (unsigned n=0; n<m_objects.size(); n++) {
+                unsigned k = m_order[n];
+                if (layered(k) && m_area[k].overlaps(shaded))
+                    fill(m_objects[k]);
+            }
+            mp_drawer->setClip(dirty);
+        }
+    }
 
-            // overwrite is enabled for
-            // non backface surfaces
-            mp_drawer->fillD(a,b,c,GOURAUD, this, m_objects[k]->
-                    getSurface(i).visible);
+    // Fill the opaque surfaces first so that translucent
+    // fragments can be depth tested against all of them
+    if (m_recording)
+        execute(false,dirty);
+    else {
+        for (unsigned n=0; n<m_objects.size(); n++) {
+            unsigned k = m_order[n];
+            if (!m_objects[k]->material().translucent() &&
+                    !(useLayer && layered(k)) &&
+                    m_area[k].overlaps(dirty))
+                fill(m_objects[k]);
         }
+        drawInstances(false,transformation,frustum,dirty);
     }
 
+    // Translucent surfaces are collected in the A-buffer and
+    // blended back to front afterwards
+    if (m_recording)
+        execute(true,dirty);
+    else {
+        for(unsigned k=0;k<m_objects.size(); k++) {
+            if (m_objects[k]->material().translucent() &&
+                    m_area[k].overlaps(dirty)) {
+                mp_drawer->setOpacity(m_objects[k]->material().opacity);
+                fill(m_objects[k]);
+            }
+        }
+        drawInstances(true,transformation,frustum,dirty);
+    }
+    mp_drawer->setOpacity(1);
+    mp_drawer->resolve();
+    mp_drawer->resetClip();
+    mp_drawer->setMask(NULL);
+    m_lastTransformation = transformation;
+
+    m_stats.shadedFragments = mp_drawer->shadedCount();
+    m_stats.degenerateTriangles = mp_drawer->degenerateCount();
+    m_stats.microTriangles = mp_drawer->microCount();
+    m_stats.smallTriangles = mp_drawer->smallCount();
+    m_stats.fragments = mp_drawer->abuffer().fragmentCount();
+    m_stats.droppedFragments = mp_drawer->abuffer().droppedCount();
+    m_stats.abufferBytes = mp_drawer->abuffer().memoryUsage();
+    m_stats.commands = m_commands.commandCount();
+    m_stats.commandBytes = m_commands.memoryUsage();
+    m_stats.renderWidth = mp_drawer->getWidth();
+    m_stats.renderHeight = mp_drawer->getHeight();
+    m_stats.bvhBuildMicros = m_bvh.buildTime();
+    m_stats.bvhRefitMicros = m_bvh.refitTime();
+    m_stats.redrawnPixels = dirty.area();
+
     // Update framebuffer
+    if (partial) {
+        mp_drawer->update(dirty);
+        return;
+    }
+
+    // The frame is shown, upscaled, before the render target is
+    // resized for the next. Only completely shaded frames tell how
+    // long a frame takes, the upscale included.
     mp_drawer->update();
+    if (m_dynamicResolution && !reproject) {
+        m_resolution.update(frametime.time());
+        applyRenderScale();
+    }
 }
 
+// Fill the surfaces prepare() left of an object
+void Shader::fill(Object* obj) {
+
+    bool GOURAUD = obj->getShading()==Shading::gouraud;
+    const ProjectedVertices& v = obj->projected();
+    const FacingSurfaces& facing = obj->facing();
+
+    TextureCorners texture;
+    for (unsigned n=0; n<facing.list.size(); n++) {
+        unsigned i = facing.list[n];
+        const Surface& surface = obj->getSurface(i);
+        bool textured = obj->textureCorners(i,texture);
 
+        // The corners are read from the vertex stage's output, the
+        // colors of gouraud surfaces follow each other
+        // overwrite is enabled for
+        // non backface surfaces
+        mp_drawer->fillD(v,surface.x,surface.y,surface.z,
+                &obj->getColor(GOURAUD?(i*3):i),GOURAUD,this,
+                facing.facing(i),textured ? &texture : NULL);
+    }
+}
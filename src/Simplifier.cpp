@@ -0,0 +1,273 @@
+#include <algorithm>
+#include <unordered_map>
+#include <stdint.h>
+#include "Simplifier.h"
+
+// Borders are held this many times harder than surfaces
+static const double borderWeight = 1000;
+
+// Start from all the surfaces of "source"
+Simplifier::Simplifier(Object* source) :
+    mp_source(source),
+    m_quadric(source->vertexCount()),
+    m_around(source->vertexCount()),
+    m_aliveCount(0),
+    m_target(source->vertexCount()),
+    m_stamp(source->vertexCount(),0)
+{
+    unsigned n = source->vertexCount();
+    for (unsigned i=0; i<n; i++)
+        m_target[i] = i;
+
+    // The plane of every surface, weighted by its area, goes to its
+    // three vertices. Edges are counted to find the borders, an edge
+    // of only one surface being one.
+    std::unordered_map<uint64_t,unsigned> edges;
+    std::vector<Vector> normals;
+    m_surface.reserve(source->surfaceCount());
+    m_texture.reserve(source->surfaceCount());
+    normals.reserve(source->surfaceCount());
+    for (unsigned i=0; i<source->surfaceCount(); i++) {
+        const Surface& s = source->getSurface(i);
+        Vector a = source->getModelVertex(s.x);
+        Vector cross = (source->getModelVertex(s.y)-a)*
+            (source->getModelVertex(s.z)-a);
+        double area = cross.magnitude()/2;
+        Vector normal = area > 0 ? cross.normalized() : cross;
+
+        unsigned f = m_surface.size();
+        m_surface.push_back(Triplet<unsigned>(s.x,s.y,s.z));
+        m_texture.push_back(s.textured ?
+                Triplet<unsigned>(s.tx,s.ty,s.tz) :
+                Triplet<unsigned>(0,0,0));
+        normals.push_back(normal);
+        unsigned v[] = {s.x,s.y,s.z};
+        for (int c=0; c<3; c++) {
+            m_around[v[c]].push_back(f);
+            unsigned p = v[c], q = v[(c+1)%3];
+            edges[(uint64_t)Math::min(p,q)*n+Math::max(p,q)]++;
+        }
+        if (area > 0) {
+            Quadric plane(normal.x,normal.y,normal.z,-(normal%a),area);
+            for (int c=0; c<3; c++)
+                m_quadric[v[c]] += plane;
+        }
+    }
+    m_alive.assign(m_surface.size(),true);
+    m_aliveCount = m_surface.size();
+
+    // A border edge adds the plane through it at right angles to its
+    // surface to both its ends
+    for (unsigned f=0; f<m_surface.size(); f++) {
+        const Triplet<unsigned>& s = m_surface[f];
+        unsigned v[] = {s.x,s.y,s.z};
+        for (int c=0; c<3; c++) {
+            unsigned p = v[c], q = v[(c+1)%3];
+            if (edges[(uint64_t)Math::min(p,q)*n+Math::max(p,q)]!=1)
+                continue;
+            Vector a = source->getModelVertex(p);
+            Vector edge = source->getModelVertex(q)-a;
+            Vector normal = edge*normals[f];
+            if (normal.magnitude() == 0)
+                continue;
+            normal.normalize();
+            Quadric plane(normal.x,normal.y,normal.z,-(normal%a),
+                    borderWeight*(edge%edge));
+            m_quadric[p] += plane;
+            m_quadric[q] += plane;
+        }
+    }
+
+    for (unsigned v=0; v<n; v++)
+        queueAround(v);
+}
+
+// The vertex v has collapsed into by now
+unsigned Simplifier::find(unsigned v) {
+    while (m_target[v]!=v) {
+        m_target[v] = m_target[m_target[v]];
+        v = m_target[v];
+    }
+    return v;
+}
+
+// The texture co-ordinate index of surface f's corner at vertex w
+unsigned& Simplifier::texture(unsigned f, unsigned w) {
+    const Triplet<unsigned>& s = m_surface[f];
+    Triplet<unsigned>& t = m_texture[f];
+    return s.x==w ? t.x : s.y==w ? t.y : t.z;
+}
+
+// Cost of collapsing u onto v, the error of v's position under the
+// planes of both
+double Simplifier::cost(unsigned u, unsigned v) const {
+    Quadric q = m_quadric[u];
+    q += m_quadric[v];
+    Vector p = mp_source->getModelVertex(v);
+    return q.error(p.x,p.y,p.z);
+}
+
+// Whether moving u onto v turns a surface of u over
+bool Simplifier::flips(unsigned u, unsigned v) {
+    Vector to = mp_source->getModelVertex(v);
+    for (unsigned i=0; i<m_around[u].size(); i++) {
+        unsigned f = m_around[u][i];
+        if (!m_alive[f])
+            continue;
+        const Triplet<unsigned>& s = m_surface[f];
+        if (s.x==v || s.y==v || s.z==v)
+            continue;
+        Vector p[] = {mp_source->getModelVertex(s.x),
+            mp_source->getModelVertex(s.y), mp_source->getModelVertex(s.z)};
+        Vector before = (p[1]-p[0])*(p[2]-p[0]);
+        unsigned idx[] = {s.x,s.y,s.z};
+        for (int c=0; c<3; c++)
+            if (idx[c]==u)
+                p[c] = to;
+        Vector after = (p[1]-p[0])*(p[2]-p[0]);
+        if (after%before <= 0)
+            return true;
+    }
+    return false;
+}
+
+// Queue the collapses both ways of the edges around v, dropping dead
+// surfaces from its list on the way
+void Simplifier::queueAround(unsigned v) {
+    std::vector<unsigned>& around = m_around[v];
+    unsigned kept = 0;
+    for (unsigned i=0; i<around.size(); i++) {
+        unsigned f = around[i];
+        if (!m_alive[f])
+            continue;
+        around[kept++] = f;
+        const Triplet<unsigned>& s = m_surface[f];
+        unsigned idx[] = {s.x,s.y,s.z};
+        for (int c=0; c<3; c++) {
+            unsigned w = idx[c];
+            if (w==v)
+                continue;
+            Candidate a = {cost(v,w),v,w,m_stamp[v],m_stamp[w]};
+            Candidate b = {cost(w,v),w,v,m_stamp[w],m_stamp[v]};
+            m_heap.push_back(a);
+            std::push_heap(m_heap.begin(),m_heap.end());
+            m_heap.push_back(b);
+            std::push_heap(m_heap.begin(),m_heap.end());
+        }
+    }
+    around.resize(kept);
+}
+
+// Collapse the cheapest edges until "surfaces" are left
+unsigned Simplifier::simplify(unsigned surfaces) {
+    while (m_aliveCount > surfaces && !m_heap.empty()) {
+        std::pop_heap(m_heap.begin(),m_heap.end());
+        Candidate c = m_heap.back();
+        m_heap.pop_back();
+
+        // Stale: an end collapsed, or its surroundings changed
+        unsigned u = c.u, v = c.v;
+        if (find(u)!=u || find(v)!=v || m_stamp[u]!=c.stampU ||
+                m_stamp[v]!=c.stampV)
+            continue;
+        if (flips(u,v))
+            continue;
+
+        // Surfaces having both ends vanish, the rest move to v
+        std::vector<unsigned> gone;
+        for (unsigned i=0; i<m_around[u].size(); i++) {
+            unsigned f = m_around[u][i];
+            if (!m_alive[f])
+                continue;
+            const Triplet<unsigned>& s = m_surface[f];
+            if (s.x==v || s.y==v || s.z==v) {
+                m_alive[f] = false;
+                m_aliveCount--;
+                gone.push_back(f);
+            }
+        }
+        for (unsigned i=0; i<m_around[u].size(); i++) {
+            unsigned f = m_around[u][i];
+            if (!m_alive[f])
+                continue;
+            // The corner takes the texture co-ordinate v has on a
+            // vanished surface, one that has the corner's at u when
+            // the edge runs along a seam
+            if (mp_source->getSurface(f).textured) {
+                unsigned& corner = texture(f,u);
+                int from = -1;
+                for (unsigned g=0; g<gone.size(); g++) {
+                    if (!mp_source->getSurface(gone[g]).textured)
+                        continue;
+                    bool same = texture(gone[g],u)==corner;
+                    if (from<0 || same)
+                        from = g;
+                    if (same)
+                        break;
+                }
+                if (from >= 0)
+                    corner = texture(gone[from],v);
+            }
+            Triplet<unsigned>& s = m_surface[f];
+            if (s.x==u) s.x = v;
+            if (s.y==u) s.y = v;
+            if (s.z==u) s.z = v;
+            m_around[v].push_back(f);
+        }
+        m_around[u].clear();
+        m_quadric[v] += m_quadric[u];
+        m_target[u] = v;
+
+        // Every edge around v costs differently now
+        m_stamp[v]++;
+        queueAround(v);
+    }
+    return m_aliveCount;
+}
+
+// The surfaces left as a new object
+Object* Simplifier::object(std::vector<unsigned>& vertexOf) const {
+    // Vertices still used, numbered in the source's order
+    std::vector<unsigned> index(mp_source->vertexCount(),~0u);
+    for (unsigned f=0; f<m_surface.size(); f++) {
+        if (!m_alive[f])
+            continue;
+        index[m_surface[f].x] = 0;
+        index[m_surface[f].y] = 0;
+        index[m_surface[f].z] = 0;
+    }
+    vertexOf.clear();
+    for (unsigned v=0; v<index.size(); v++) {
+        if (index[v]==0) {
+            index[v] = vertexOf.size();
+            vertexOf.push_back(v);
+        }
+    }
+
+    Object* obj = new Object(vertexOf.size(),mp_source->material(),
+            mp_source->getShading(),mp_source->backface(),
+            mp_source->bothsides());
+    obj->setMaterials(mp_source->materials());
+    // Corners index the source's texture co-ordinates, those of the
+    // vertices they collapsed onto
+    obj->vtmatrix() = mp_source->vtmatrix();
+    for (unsigned i=0; i<vertexOf.size(); i++)
+        obj->setVertex(i,mp_source->getModelVertex(vertexOf[i]));
+    // Surfaces keep the source's order, and so its runs of materials
+    for (unsigned f=0; f<m_surface.size(); f++) {
+        if (!m_alive[f])
+            continue;
+        Surface surface(index[m_surface[f].x],index[m_surface[f].y],
+                index[m_surface[f].z]);
+        const Surface& source = mp_source->getSurface(f);
+        surface.material = source.material;
+        surface.textured = source.textured;
+        surface.tx = m_texture[f].x;
+        surface.ty = m_texture[f].y;
+        surface.tz = m_texture[f].z;
+        obj->setSurface(surface);
+    }
+    obj->setStatic(mp_source->isStatic());
+    obj->setNode(mp_source->node());
+    return obj;
+}
@@ -0,0 +1,133 @@
+#include <map>
+#include <tuple>
+#include "StaticBatch.h"
+
+// Group the static objects by what they are drawn with and by chunk
+StaticBatch::StaticBatch(const std::vector<Object*>& objects,
+        float chunkSize) : m_merged(0) {
+    typedef std::tuple<unsigned,int,bool,bool,int,int,int> Key;
+    std::map<Key,std::vector<Object*> > groups;
+    std::vector<Key> keys(objects.size());
+    std::vector<bool> alone(objects.size(),false);
+    std::vector<Material> materials;
+
+    for (unsigned k=0; k<objects.size(); k++) {
+        Object* obj = objects[k];
+        if (!obj->isStatic() || obj->surfaceCount()==0) {
+            alone[k] = true;
+            continue;
+        }
+        unsigned m = 0;
+        while (m<materials.size() && !(materials[m]==obj->material()))
+            m++;
+        if (m==materials.size())
+            materials.push_back(obj->material());
+        const Vector& c = obj->bounds().center;
+        keys[k] = Key(m,(int)obj->getShading(),obj->backface(),
+                obj->bothsides(),(int)std::floor(c.x/chunkSize),
+                (int)std::floor(c.y/chunkSize),
+                (int)std::floor(c.z/chunkSize));
+        groups[keys[k]].push_back(obj);
+    }
+
+    // Objects not merged keep their order, a group of one gains
+    // nothing
+    for (unsigned k=0; k<objects.size(); k++)
+        if (alone[k] || groups[keys[k]].size()==1)
+            m_objects.push_back(objects[k]);
+
+    for (auto it=groups.begin(); it!=groups.end(); it++) {
+        if (it->second.size()<2)
+            continue;
+        m_batches.push_back(merge(it->second));
+        m_objects.push_back(m_batches.back());
+        m_merged += it->second.size();
+    }
+}
+
+StaticBatch::~StaticBatch() {
+    for (unsigned b=0; b<m_batches.size(); b++)
+        delete m_batches[b];
+}
+
+// Append the vertices, normals and surfaces of every source
+Object* StaticBatch::merge(const std::vector<Object*>& sources) {
+    Object* first = sources[0];
+    bool normals = first->getShading()==Shading::gouraud;
+    unsigned vertices = 0, vertexNormals = 0, texcoords = 0;
+    for (unsigned s=0; s<sources.size(); s++) {
+        // Gouraud shading needs vertex normals, as prepare() would
+        if (normals && !sources[s]->getSurface(0).vertexNormals)
+            sources[s]->initNormal();
+        vertices += sources[s]->vertexCount();
+        vertexNormals += sources[s]->vertexNormalCount();
+        texcoords += sources[s]->texcoordCount();
+    }
+
+    Object* obj = new Object(vertices,first->material(),
+            first->getShading(),first->backface(),first->bothsides());
+    if (normals)
+        obj->vnmatrix().readjust({4,vertexNormals});
+    obj->vtmatrix().readjust({2,texcoords});
+
+    unsigned vbase = 0, nbase = 0, tbase = 0;
+    for (unsigned s=0; s<sources.size(); s++) {
+        Object* src = sources[s];
+        for (unsigned i=0; i<src->vertexCount(); i++)
+            obj->setVertex(vbase+i,src->getVertex(i));
+
+        if (normals) {
+            // Normals are turned to the world with the inverse
+            // transpose of the model's linear part
+            Matrix<float> m = src->model().inverse().transpose();
+            for (unsigned i=0; i<src->vertexNormalCount(); i++) {
+                Vector n = src->getVertexNormal(i);
+                obj->setVertexNormal(nbase+i,Vector(
+                        m(0,0)*n.x + m(0,1)*n.y + m(0,2)*n.z,
+                        m(1,0)*n.x + m(1,1)*n.y + m(1,2)*n.z,
+                        m(2,0)*n.x + m(2,1)*n.y + m(2,2)*n.z,
+                        0).normalized());
+            }
+        }
+
+        for (unsigned i=0; i<src->texcoordCount(); i++) {
+            Pair<float> t = src->getTexcoord(i);
+            obj->setTexcoord(tbase+i,t.x,t.y);
+        }
+
+        // The batch holds every material of the sources once
+        std::vector<unsigned> materialOf(src->materialCount());
+        for (unsigned m=0; m<src->materialCount(); m++) {
+            const Material& material = src->material(m);
+            unsigned id = 0;
+            while (id<obj->materialCount() &&
+                    !(obj->material(id)==material))
+                id++;
+            materialOf[m] = id<obj->materialCount() ? id :
+                obj->addMaterial(material);
+        }
+
+        for (unsigned i=0; i<src->surfaceCount(); i++) {
+            const Surface& f = src->getSurface(i);
+            Surface surface = normals ?
+                Surface(vbase+f.x,vbase+f.y,vbase+f.z,
+                        nbase+f.nx,nbase+f.ny,nbase+f.nz) :
+                Surface(vbase+f.x,vbase+f.y,vbase+f.z);
+            surface.material = materialOf[f.material];
+            if (f.textured) {
+                surface.textured = true;
+                surface.tx = tbase+f.tx;
+                surface.ty = tbase+f.ty;
+                surface.tz = tbase+f.tz;
+            }
+            obj->setSurface(surface);
+        }
+        vbase += src->vertexCount();
+        nbase += src->vertexNormalCount();
+        tbase += src->texcoordCount();
+    }
+    if (obj->materialCount() > 1)
+        obj->sortByMaterial();
+    obj->setStatic(true);
+    return obj;
+}
@@ -0,0 +1,262 @@
+#include <cmath>
+#include "Terrain.h"
+
+Terrain::Terrain(const std::vector<float>& heights, unsigned width,
+        unsigned depth, float spacing, const Vector& origin,
+        const Material& m, Shading sh, unsigned patchSize) :
+    m_object(width*depth,m,sh,true,false),
+    m_width(width),
+    m_depth(depth),
+    m_patchSize(patchSize),
+    m_patchesX(0),
+    m_patchesZ(0),
+    m_levels(0),
+    m_tolerance(1)
+{
+    if (patchSize<2 || (patchSize & (patchSize-1)) || width<2 ||
+            depth<2 || (width-1)%patchSize || (depth-1)%patchSize ||
+            spacing<=0)
+        throw ex::InitFailure();
+    if (heights.size() != width*depth)
+        throw ex::DimensionMismatch();
+    m_patchesX = (width-1)/patchSize;
+    m_patchesZ = (depth-1)/patchSize;
+    // The coarsest level leaves two cells across a patch
+    while ((2u<<m_levels) <= patchSize)
+        m_levels++;
+
+    Matrix<float>& v = m_object.vmatrix();
+    for (unsigned z=0; z<depth; z++)
+        for (unsigned x=0; x<width; x++) {
+            unsigned i = vertex(x,z);
+            v(0,i) = origin.x + x*spacing;
+            v(1,i) = origin.y + heights[i];
+            v(2,i) = origin.z + z*spacing;
+        }
+    computeNormals(heights,spacing);
+
+    m_patches.resize(m_patchesX*m_patchesZ);
+    for (unsigned pz=0; pz<m_patchesZ; pz++)
+        for (unsigned px=0; px<m_patchesX; px++) {
+            Patch& p = m_patches[pz*m_patchesX+px];
+            unsigned x0 = px*patchSize, z0 = pz*patchSize;
+            float low = heights[vertex(x0,z0)], high = low;
+            for (unsigned z=z0; z<=z0+patchSize; z++)
+                for (unsigned x=x0; x<=x0+patchSize; x++) {
+                    low = Math::min(low,heights[vertex(x,z)]);
+                    high = Math::max(high,heights[vertex(x,z)]);
+                }
+            p.min = Vector(origin.x + x0*spacing,origin.y + low,
+                    origin.z + z0*spacing,1);
+            p.max = Vector(origin.x + (x0+patchSize)*spacing,
+                    origin.y + high,origin.z + (z0+patchSize)*spacing,1);
+            measure(p,x0,z0,heights);
+            p.level = 0;
+        }
+    build();
+}
+
+// The loop over the inside of a row is branch free and runs over
+// the rows of the normals as arrays, so the compiler vectorizes it.
+// The first and the last vertex of a row take one sided differences.
+void Terrain::computeNormals(const std::vector<float>& heights,
+        float spacing) {
+    Matrix<float>& n = m_object.vnmatrix();
+    float* nx = &n(0,0);
+    float* ny = &n(1,0);
+    float* nz = &n(2,0);
+    float* nw = &n(3,0);
+    const float* h = heights.data();
+    unsigned w = m_width;
+    for (unsigned z=0; z<m_depth; z++) {
+        unsigned above = Math::min(z+1,m_depth-1);
+        unsigned below = z>0 ? z-1 : 0;
+        const float* row = h + z*w;
+        const float* up = h + above*w;
+        const float* down = h + below*w;
+        float toZ = 1/((above-below)*spacing);
+        float toX = 1/(2*spacing);
+        float* rx = nx + z*w;
+        float* ry = ny + z*w;
+        float* rz = nz + z*w;
+        float* rw = nw + z*w;
+        for (unsigned x=1; x+1<w; x++) {
+            float gx = (row[x+1]-row[x-1])*toX;
+            float gz = (up[x]-down[x])*toZ;
+            float length = 1/std::sqrt(gx*gx + 1 + gz*gz);
+            rx[x] = -gx*length;
+            ry[x] = length;
+            rz[x] = -gz*length;
+            rw[x] = 0;
+        }
+        unsigned ends[] = {0,w-1};
+        for (int e=0; e<2; e++) {
+            unsigned x = ends[e];
+            unsigned right = Math::min(x+1,w-1), left = x>0 ? x-1 : 0;
+            float gx = (row[right]-row[left])/((right-left)*spacing);
+            float gz = (up[x]-down[x])*toZ;
+            float length = 1/std::sqrt(gx*gx + 1 + gz*gz);
+            rx[x] = -gx*length;
+            ry[x] = length;
+            rz[x] = -gz*length;
+            rw[x] = 0;
+        }
+    }
+}
+
+// A vertex left out at a level is measured against the height the
+// level's cell around it has there. Cells are split along the
+// diagonal from their lower corner, as triangulate() splits them.
+void Terrain::measure(Patch& p, unsigned x0, unsigned z0,
+        const std::vector<float>& heights) {
+    p.error.assign(m_levels,0);
+    for (unsigned l=1; l<m_levels; l++) {
+        unsigned s = 1<<l;
+        float error = p.error[l-1];
+        for (unsigned z=0; z<=m_patchSize; z++)
+            for (unsigned x=0; x<=m_patchSize; x++) {
+                unsigned cx = Math::min(x/s*s,m_patchSize-s);
+                unsigned cz = Math::min(z/s*s,m_patchSize-s);
+                float a = float(x-cx)/s, b = float(z-cz)/s;
+                float h00 = heights[vertex(x0+cx,z0+cz)];
+                float h10 = heights[vertex(x0+cx+s,z0+cz)];
+                float h01 = heights[vertex(x0+cx,z0+cz+s)];
+                float h11 = heights[vertex(x0+cx+s,z0+cz+s)];
+                float level = a>=b ? h00 + a*(h10-h00) + b*(h11-h10) :
+                    h00 + b*(h01-h00) + a*(h11-h01);
+                error = Math::max(error,
+                        std::fabs(heights[vertex(x0+x,z0+z)]-level));
+            }
+        p.error[l] = error;
+    }
+}
+
+// The cells inside the border ring of a patch are split in two. Each
+// side of the ring is a strip between the patch's edge, cut at the
+// step of the coarser of the patch and its neighbour there, and the
+// line a cell in, cut at the patch's own step. The strip is walked
+// along both at once, each triangle advancing on the one whose next
+// vertex comes first.
+void Terrain::triangulate(unsigned p, std::vector<Surface>& surfaces)
+        const {
+    unsigned px = p%m_patchesX, pz = p/m_patchesX;
+    unsigned x0 = px*m_patchSize, z0 = pz*m_patchSize;
+    unsigned size = m_patchSize;
+    unsigned s = 1<<m_patches[p].level;
+
+    // Surfaces face up, the cross product of their first two edges
+    // points along y
+    auto add = [&](unsigned ax, unsigned az, unsigned bx, unsigned bz,
+            unsigned cx, unsigned cz) {
+        float e1x = float(bx)-ax, e1z = float(bz)-az;
+        float e2x = float(cx)-bx, e2z = float(cz)-bz;
+        unsigned a = vertex(x0+ax,z0+az);
+        unsigned b = vertex(x0+bx,z0+bz);
+        unsigned c = vertex(x0+cx,z0+cz);
+        if (e1z*e2x - e1x*e2z < 0)
+            swap(b,c);
+        surfaces.push_back(Surface(a,b,c,a,b,c));
+    };
+
+    for (unsigned z=s; z+2*s<=size; z+=s)
+        for (unsigned x=s; x+2*s<=size; x+=s) {
+            add(x,z,x+s,z,x+s,z+s);
+            add(x,z,x+s,z+s,x,z+s);
+        }
+
+    // Neighbours below, right, above and left
+    int neighbours[] = {
+        pz>0 ? (int)p-(int)m_patchesX : -1,
+        px+1<m_patchesX ? (int)p+1 : -1,
+        pz+1<m_patchesZ ? (int)p+(int)m_patchesX : -1,
+        px>0 ? (int)p-1 : -1};
+    for (int side=0; side<4; side++) {
+        unsigned t = s;
+        if (neighbours[side] >= 0)
+            t = Math::max(t,1u<<m_patches[neighbours[side]].level);
+        // Position a along the side and d in from it, to the patch
+        auto at = [&](unsigned a, unsigned d, unsigned& x, unsigned& z) {
+            switch (side) {
+                case 0: x = a; z = d; break;
+                case 1: x = size-d; z = a; break;
+                case 2: x = a; z = size-d; break;
+                default: x = d; z = a; break;
+            }
+        };
+        unsigned outer = 0, inner = s;
+        while (outer<size || inner+s<=size-s) {
+            unsigned ax, az, bx, bz, cx, cz;
+            at(outer,0,ax,az);
+            at(inner,s,cx,cz);
+            if (inner+s>size-s || (outer<size && outer+t<=inner+s)) {
+                at(outer+t,0,bx,bz);
+                outer += t;
+            } else {
+                at(inner+s,s,bx,bz);
+                inner += s;
+            }
+            add(ax,az,bx,bz,cx,cz);
+        }
+    }
+}
+
+void Terrain::build() {
+    std::vector<Surface> surfaces;
+    for (unsigned p=0; p<m_patches.size(); p++) {
+        m_patches[p].firstSurface = surfaces.size();
+        triangulate(p,surfaces);
+        m_patches[p].surfaceCount = surfaces.size() -
+            m_patches[p].firstSurface;
+    }
+    m_object.setSurfaces(surfaces);
+}
+
+bool Terrain::select(const Vector& eye, float scale) {
+    bool changed = false;
+    for (unsigned p=0; p<m_patches.size(); p++) {
+        Patch& patch = m_patches[p];
+        // Distance to the nearest point of the patch's box
+        float dx = Math::max(0.0f,Math::max(patch.min.x-eye.x,
+                    eye.x-patch.max.x));
+        float dy = Math::max(0.0f,Math::max(patch.min.y-eye.y,
+                    eye.y-patch.max.y));
+        float dz = Math::max(0.0f,Math::max(patch.min.z-eye.z,
+                    eye.z-patch.max.z));
+        float distance = std::sqrt(dx*dx + dy*dy + dz*dz);
+        unsigned level = m_levels-1;
+        while (level>0 && patch.error[level]*scale > m_tolerance*distance)
+            level--;
+        if (level != patch.level) {
+            patch.level = level;
+            changed = true;
+        }
+    }
+    if (changed)
+        build();
+    return changed;
+}
+
+unsigned Terrain::cull(const Frustum& frustum,
+        std::vector<unsigned>& surfaces,
+        std::vector<unsigned>& vertices) const {
+    surfaces.clear();
+    vertices.clear();
+    unsigned culled = 0;
+    for (unsigned p=0; p<m_patches.size(); p++) {
+        const Patch& patch = m_patches[p];
+        if (!frustum.sees(patch.min,patch.max)) {
+            culled++;
+            continue;
+        }
+        for (unsigned i=0; i<patch.surfaceCount; i++)
+            surfaces.push_back(patch.firstSurface+i);
+        // The vertices of the patch's level, edges included
+        unsigned s = 1<<patch.level;
+        unsigned x0 = p%m_patchesX*m_patchSize;
+        unsigned z0 = p/m_patchesX*m_patchSize;
+        for (unsigned z=0; z<=m_patchSize; z+=s)
+            for (unsigned x=0; x<=m_patchSize; x+=s)
+                vertices.push_back(vertex(x0+x,z0+z));
+    }
+    return culled;
+}
@@ -0,0 +1,193 @@
+#include <fstream>
+#include <cmath>
+#include "Texture.h"
+#include "common/helper.h"
+
+// Load a binary .ppm (P6) image
+Texture::Texture(const std::string& filename) {
+    std::ifstream file(filename,std::ios::in|std::ios::binary);
+    if (!file)
+        throw ex::InitFailure();
+
+    // The header is the magic, width, height and maximum value,
+    // parted by whitespace and possibly comments
+    std::string magic;
+    unsigned header[3];
+    file >> magic;
+    if (magic != "P6")
+        throw ex::BadFileFormat();
+    for (int h=0; h<3; h++) {
+        file >> std::ws;
+        while (file.peek()=='#') {
+            file.ignore(1<<16,'\n');
+            file >> std::ws;
+        }
+        if (!(file >> header[h]))
+            throw ex::BadFileFormat();
+    }
+    file.get();
+    unsigned width = header[0], height = header[1], max = header[2];
+    if (!width || !height || !max || max>255)
+        throw ex::BadFileFormat();
+
+    std::vector<uint8_t> rgb(width*height*3);
+    if (!file.read((char*)rgb.data(),rgb.size()))
+        throw ex::BadFileFormat();
+    std::vector<Color> texels(width*height);
+    for (unsigned i=0; i<texels.size(); i++)
+        texels[i] = {(uint8_t)(rgb[i*3+2]*255/max),
+            (uint8_t)(rgb[i*3+1]*255/max),(uint8_t)(rgb[i*3]*255/max),
+            255};
+    build(width,height,texels);
+}
+
+Texture::Texture(unsigned width, unsigned height, const Color* texels,
+        const float* depth) {
+    if (!width || !height)
+        throw ex::InitFailure();
+    build(width,height,std::vector<Color>(texels,texels+width*height),
+            depth ? std::vector<float>(depth,depth+width*height) :
+            std::vector<float>());
+}
+
+void Texture::build(unsigned width, unsigned height,
+        const std::vector<Color>& texels, const std::vector<float>& depth) {
+    unsigned wb = 0, hb = 0;
+    while ((1u<<wb) < width)
+        wb++;
+    while ((1u<<hb) < height)
+        hb++;
+    if (wb>16 || hb>16)
+        throw ex::InitFailure();
+
+    // Resampled to powers of two by the nearest texel
+    unsigned w = 1u<<wb, h = 1u<<hb;
+    bool deep = !depth.empty();
+    std::vector<Color> level(w*h);
+    std::vector<float> levelDepth(deep ? w*h : 0);
+    for (unsigned y=0; y<h; y++)
+        for (unsigned x=0; x<w; x++) {
+            unsigned from = (y*height/h)*width + x*width/w;
+            level[y*w+x] = texels[from];
+            if (deep)
+                levelDepth[y*w+x] = Math::max(-1.0f,
+                        Math::min(depth[from],1.0f));
+        }
+
+    m_texels.reserve(w*h*4/3+1+Math::max(wb,hb));
+    while (true) {
+        m_offset.push_back(m_texels.size());
+        m_widthBits.push_back(wb);
+        m_heightBits.push_back(hb);
+        m_texels.resize(m_texels.size()+w*h);
+        if (deep)
+            m_depth.resize(m_texels.size());
+        Color* stored = &m_texels[m_offset.back()];
+        for (unsigned y=0; y<h; y++)
+            for (unsigned x=0; x<w; x++) {
+                unsigned at = morton(x,y,wb,hb);
+                stored[at] = level[y*w+x];
+                if (deep)
+                    m_depth[m_offset.back()+at] = (int8_t)Math::round(
+                            levelDepth[y*w+x]*127);
+            }
+        if (w==1 && h==1)
+            break;
+
+        // The next level averages 2x2 texels, 2x1 once a side is down
+        // to one. Colors and depths are weighted by alpha, so that
+        // empty texels don't darken the edges of what isn't empty.
+        unsigned nw = Math::max(w/2,1u), nh = Math::max(h/2,1u);
+        unsigned sx = w/nw, sy = h/nh;
+        std::vector<Color> next(nw*nh);
+        std::vector<float> nextDepth(deep ? nw*nh : 0);
+        for (unsigned y=0; y<nh; y++)
+            for (unsigned x=0; x<nw; x++) {
+                unsigned b = 0, g = 0, r = 0, a = 0;
+                unsigned ab = 0, ag = 0, ar = 0;
+                float d = 0;
+                for (unsigned j=0; j<sy; j++)
+                    for (unsigned i=0; i<sx; i++) {
+                        unsigned from = (y*sy+j)*w + x*sx+i;
+                        const Color& c = level[from];
+                        b += c.blue; g += c.green; r += c.red;
+                        a += c.alpha;
+                        ab += c.blue*c.alpha; ag += c.green*c.alpha;
+                        ar += c.red*c.alpha;
+                        if (deep)
+                            d += levelDepth[from]*c.alpha;
+                    }
+                unsigned n = sx*sy;
+                if (a) {
+                    b = ab/a; g = ag/a; r = ar/a;
+                } else {
+                    b /= n; g /= n; r /= n;
+                }
+                next[y*nw+x] = {(uint8_t)b,(uint8_t)g,(uint8_t)r,
+                    (uint8_t)(a/n)};
+                if (deep)
+                    nextDepth[y*nw+x] = a ? d/a : 0;
+            }
+        level.swap(next);
+        levelDepth.swap(nextDepth);
+        w = nw; h = nh;
+        wb -= wb ? 1 : 0;
+        hb -= hb ? 1 : 0;
+    }
+}
+
+// The arithmetic is done lane by lane over fixed size arrays so that
+// it vectorizes, only the texel loads are gathered one at a time
+void Texture::sample(const float* u, const float* v, const int* level,
+        Color* out, unsigned count, float* depth) const {
+    int x0[lanes], y0[lanes];
+    float fx[lanes], fy[lanes];
+    for (unsigned k=0; k<lanes; k++) {
+        unsigned l = level[k<count ? k : 0];
+        // Texel centres are at halves
+        float x = u[k<count ? k : 0]*(1u<<m_widthBits[l]) - 0.5f;
+        float y = v[k<count ? k : 0]*(1u<<m_heightBits[l]) - 0.5f;
+        float bx = std::floor(x), by = std::floor(y);
+        x0[k] = (int)bx; y0[k] = (int)by;
+        fx[k] = x-bx; fy[k] = y-by;
+    }
+
+    float t[4][lanes][4];
+    for (unsigned k=0; k<count; k++) {
+        const Color* c[] = {&texel(level[k],x0[k],y0[k]),
+            &texel(level[k],x0[k]+1,y0[k]),
+            &texel(level[k],x0[k],y0[k]+1),
+            &texel(level[k],x0[k]+1,y0[k]+1)};
+        for (int i=0; i<4; i++) {
+            t[i][k][0] = c[i]->blue;
+            t[i][k][1] = c[i]->green;
+            t[i][k][2] = c[i]->red;
+            t[i][k][3] = c[i]->alpha;
+        }
+    }
+    for (unsigned k=count; k<lanes; k++)
+        for (int i=0; i<4; i++)
+            t[i][k][0] = t[i][k][1] = t[i][k][2] = t[i][k][3] = 0;
+
+    float blended[lanes][4];
+    for (unsigned k=0; k<lanes; k++)
+        for (int ch=0; ch<4; ch++) {
+            float top = t[0][k][ch] + (t[1][k][ch]-t[0][k][ch])*fx[k];
+            float bottom = t[2][k][ch] + (t[3][k][ch]-t[2][k][ch])*fx[k];
+            blended[k][ch] = top + (bottom-top)*fy[k] + 0.5f;
+        }
+    for (unsigned k=0; k<count; k++)
+        out[k] = {(uint8_t)blended[k][0],(uint8_t)blended[k][1],
+            (uint8_t)blended[k][2],(uint8_t)blended[k][3]};
+
+    // Depths aren't filtered, a blend of two surfaces is at neither
+    if (!depth || m_depth.empty())
+        return;
+    for (unsigned k=0; k<count; k++) {
+        unsigned l = level[k];
+        unsigned wb = m_widthBits[l], hb = m_heightBits[l];
+        int x = x0[k] + (fx[k]>=0.5f), y = y0[k] + (fy[k]>=0.5f);
+        depth[k] = m_depth[m_offset[l] + morton(x&((1u<<wb)-1),
+                y&((1u<<hb)-1),wb,hb)]*(1/127.0f);
+    }
+}
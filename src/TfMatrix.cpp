@@ -61,6 +61,17 @@ Matrix<float> TfMatrix::perspective(float ang, float ratio, float f, float n){
     return transformation;
 }
 
+Matrix<float> TfMatrix::identity(){
+    Matrix<float> transformation({4,4});
+    transformation.initialize(
+            1,  0,  0,  0,
+            0,  1,  0,  0,
+            0,  0,  1,  0,
+            0,  0,  0,  1
+            );
+    return transformation;
+}
+
 Matrix<float> TfMatrix::shearing(float a, float b, float c, float d, float e, float f){
     Matrix<float> transformation({4,4});
     transformation.initialize(
@@ -0,0 +1,192 @@
+#include <cmath>
+#include <algorithm>
+#include <future>
+#include <thread>
+#include "VertexAnimation.h"
+
+const unsigned VertexAnimation::blockSize;
+const unsigned VertexAnimation::minRange;
+
+VertexAnimation::VertexAnimation(Object* obj) :
+    mp_object(obj),
+    m_count(obj->vertexCount()),
+    m_boneCount(0),
+    m_vertices(obj->baseVertices()),
+    m_normals(obj->baseNormals())
+{
+}
+
+VertexAnimation::~VertexAnimation() {
+    mp_object->setDeformation(NULL);
+}
+
+unsigned VertexAnimation::addTarget(const Matrix<float>& vertices) {
+    if (vertices.col()!=m_count || vertices.row()<3)
+        throw ex::DimensionMismatch();
+    const Matrix<float>& base = mp_object->baseVertices();
+    std::vector<float> offsets(3*m_count);
+    for (unsigned r=0; r<3; r++)
+        for (unsigned i=0; i<m_count; i++)
+            offsets[r*m_count+i] = vertices(r,i) - base(r,i);
+    m_targets.push_back(offsets);
+    m_weights.push_back(0);
+    return m_targets.size()-1;
+}
+
+void VertexAnimation::setWeight(unsigned target, float weight) {
+    if (target>=m_weights.size())
+        throw ex::OutOfBounds();
+    m_weights[target] = weight;
+}
+
+void VertexAnimation::setBones(unsigned count) {
+    m_boneCount = count;
+    m_bones.assign(4*m_count,0);
+    m_boneWeights.assign(4*m_count,0);
+    std::fill(m_boneWeights.begin(),m_boneWeights.begin()+m_count,1.0f);
+    m_poses.assign(12*count,0);
+    for (unsigned b=0; b<count; b++)
+        for (unsigned d=0; d<3; d++)
+            m_poses[(d*4+d)*count+b] = 1;
+}
+
+void VertexAnimation::setInfluences(unsigned v, const unsigned bones[4],
+        const float weights[4]) {
+    if (v>=m_count)
+        throw ex::OutOfBounds();
+    float sum = 0;
+    for (unsigned k=0; k<4; k++) {
+        if (bones[k]>=m_boneCount)
+            throw ex::OutOfBounds();
+        sum += weights[k];
+    }
+    if (sum <= 0)
+        throw ex::InitFailure();
+    for (unsigned k=0; k<4; k++) {
+        m_bones[k*m_count+v] = bones[k];
+        m_boneWeights[k*m_count+v] = weights[k]/sum;
+    }
+}
+
+void VertexAnimation::setPose(unsigned bone, const Matrix<float>& transform) {
+    if (bone>=m_boneCount)
+        throw ex::OutOfBounds();
+    for (unsigned e=0; e<12; e++)
+        m_poses[e*m_boneCount+bone] = transform(e/4,e%4);
+}
+
+bool VertexAnimation::normalsFollow() const {
+    if (mp_object->vertexNormalCount()!=m_count)
+        return false;
+    const std::vector<Surface>& surfaces = mp_object->surfaces();
+    for (unsigned i=0; i<surfaces.size(); i++) {
+        const Surface& s = surfaces[i];
+        if (!s.vertexNormals || s.nx!=s.x || s.ny!=s.y || s.nz!=s.z)
+            return false;
+    }
+    return true;
+}
+
+// A block of vertices is morphed row by row, each target adding its
+// weighted offsets. Then the matrices of the four influences are
+// gathered into a blended matrix per vertex, an array per element,
+// and the block is multiplied through them.
+void VertexAnimation::blend(unsigned first, unsigned last, bool normals) {
+    if (first >= last)
+        return;
+    const Matrix<float>& base = mp_object->baseVertices();
+    const Matrix<float>& baseNormals = mp_object->baseNormals();
+    float* out[] = {&m_vertices(0,0),&m_vertices(1,0),&m_vertices(2,0)};
+    float* nout[] = {&m_normals(0,0),&m_normals(1,0),&m_normals(2,0)};
+    float m[12][blockSize];
+
+    for (unsigned start=first; start<last; start+=blockSize) {
+        unsigned n = Math::min(blockSize,last-start);
+
+        for (unsigned r=0; r<3; r++) {
+            const float* from = &base(r,start);
+            float* to = out[r]+start;
+            for (unsigned i=0; i<n; i++)
+                to[i] = from[i];
+            for (unsigned t=0; t<m_targets.size(); t++) {
+                float w = m_weights[t];
+                if (w == 0)
+                    continue;
+                const float* offset = &m_targets[t][r*m_count+start];
+                for (unsigned i=0; i<n; i++)
+                    to[i] += w*offset[i];
+            }
+            if (normals) {
+                const float* nfrom = &baseNormals(r,start);
+                float* nto = nout[r]+start;
+                for (unsigned i=0; i<n; i++)
+                    nto[i] = nfrom[i];
+            }
+        }
+        if (!m_boneCount)
+            continue;
+
+        for (unsigned e=0; e<12; e++)
+            for (unsigned i=0; i<n; i++)
+                m[e][i] = 0;
+        for (unsigned k=0; k<4; k++) {
+            const unsigned* bone = &m_bones[k*m_count+start];
+            const float* weight = &m_boneWeights[k*m_count+start];
+            for (unsigned e=0; e<12; e++) {
+                const float* pose = &m_poses[e*m_boneCount];
+                for (unsigned i=0; i<n; i++)
+                    m[e][i] += weight[i]*pose[bone[i]];
+            }
+        }
+
+        float* x = out[0]+start;
+        float* y = out[1]+start;
+        float* z = out[2]+start;
+        for (unsigned i=0; i<n; i++) {
+            float px = x[i], py = y[i], pz = z[i];
+            x[i] = m[0][i]*px + m[1][i]*py + m[2][i]*pz + m[3][i];
+            y[i] = m[4][i]*px + m[5][i]*py + m[6][i]*pz + m[7][i];
+            z[i] = m[8][i]*px + m[9][i]*py + m[10][i]*pz + m[11][i];
+        }
+        if (!normals)
+            continue;
+        // Bones are taken to scale evenly, their linear part turns
+        // normals as it turns the surfaces
+        x = nout[0]+start;
+        y = nout[1]+start;
+        z = nout[2]+start;
+        for (unsigned i=0; i<n; i++) {
+            float nx = x[i], ny = y[i], nz = z[i];
+            float tx = m[0][i]*nx + m[1][i]*ny + m[2][i]*nz;
+            float ty = m[4][i]*nx + m[5][i]*ny + m[6][i]*nz;
+            float tz = m[8][i]*nx + m[9][i]*ny + m[10][i]*nz;
+            float length = std::sqrt(tx*tx + ty*ty + tz*tz);
+            float scale = length > 0 ? 1/length : 0;
+            x[i] = tx*scale;
+            y[i] = ty*scale;
+            z[i] = tz*scale;
+        }
+    }
+}
+
+void VertexAnimation::apply() {
+    if (mp_object->vertexCount()!=m_count)
+        throw ex::DimensionMismatch();
+    bool normals = m_boneCount && normalsFollow();
+    if (normals && m_normals.col()!=m_count)
+        m_normals = mp_object->baseNormals();
+
+    unsigned workers = Math::max(1u,Math::min(
+                std::thread::hardware_concurrency(),m_count/minRange));
+    unsigned range = (m_count+workers-1)/workers;
+    std::vector<std::future<void> > jobs;
+    for (unsigned w=1; w<workers; w++)
+        jobs.push_back(std::async(std::launch::async,
+                    &VertexAnimation::blend,this,w*range,
+                    Math::min((w+1)*range,m_count),normals));
+    blend(0,Math::min(range,m_count),normals);
+    for (unsigned j=0; j<jobs.size(); j++)
+        jobs[j].get();
+
+    mp_object->setDeformation(&m_vertices,normals ? &m_normals : NULL);
+}
@@ -0,0 +1,43 @@
+// Times the A-buffer resolve on a full screen of random translucent
+// fragments, a few layers deep
+#include <iostream>
+#include <cstdlib>
+#include <vector>
+
+#include "ABuffer.h"
+#include "misc/Time.h"
+
+const unsigned WIDTH = 600;
+const unsigned HEIGHT = 400;
+const unsigned REPEATS = 20;
+
+int main() {
+    srand(1);
+    Time timer(0);
+    const unsigned depths[] = {1,2,4,8};
+    for (unsigned layers : depths) {
+        ABuffer abuffer(WIDTH,HEIGHT,WIDTH*HEIGHT*layers);
+        // Three pixels in four get a fragment at every layer
+        for (unsigned l=0; l<layers; l++)
+            for (unsigned y=0; y<HEIGHT; y++)
+                for (unsigned x=0; x<WIDTH; x++)
+                    if (rand()%4)
+                        abuffer.insert(x,y,rand(),{(uint8_t)rand(),
+                            (uint8_t)rand(),(uint8_t)rand(),
+                            (uint8_t)rand()});
+
+        // The best of a few runs, blending over a constant color
+        std::vector<Color> out(abuffer.touchedCount());
+        uintmax_t best = ~uintmax_t(0);
+        for (unsigned r=0; r<REPEATS; r++) {
+            timer.start();
+            for (unsigned i=0; i<abuffer.touchedCount(); i++)
+                out[i] = abuffer.blend(i,{10,20,30,255});
+            best = Math::min(best,timer.time());
+        }
+        std::cout<<"layers "<<layers<<" pixels "<<abuffer.touchedCount()
+            <<" fragments "<<abuffer.fragmentCount()
+            <<" resolve "<<best<<"us"<<std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,57 @@
+// Times building the hierarchy over the triangles of a fixed scene
+// against refitting it after every triangle moved
+#include <iostream>
+#include <cmath>
+#include <vector>
+
+#include "BVH.h"
+#include "misc/Time.h"
+
+const unsigned REPEATS = 5;
+
+// Boxes of the two triangles of every cell of an n x n rippled grid,
+// the ripple shifted by "phase"
+static void grid(unsigned n, float phase, std::vector<Box>& boxes) {
+    boxes.assign(2*n*n,Box());
+    for (unsigned z=0; z<n; z++)
+        for (unsigned x=0; x<n; x++) {
+            float h[2][2];
+            for (int i=0; i<2; i++)
+                for (int j=0; j<2; j++)
+                    h[i][j] = std::sin((x+j)*0.1f+phase)
+                        *std::cos((z+i)*0.13f+phase);
+            Box& a = boxes[2*(z*n+x)];
+            Box& b = boxes[2*(z*n+x)+1];
+            a.include(x,h[0][0],z);
+            a.include(x+1,h[0][1],z);
+            a.include(x,h[1][0],z+1);
+            b.include(x+1,h[0][1],z);
+            b.include(x+1,h[1][1],z+1);
+            b.include(x,h[1][0],z+1);
+        }
+}
+
+int main() {
+    Time timer(0);
+    const unsigned sizes[] = {32,128,300};
+    for (unsigned n : sizes) {
+        std::vector<Box> still, moved;
+        grid(n,0,still);
+        grid(n,1,moved);
+
+        // The best of a few runs of each
+        BVH bvh;
+        uintmax_t build = ~uintmax_t(0), refit = ~uintmax_t(0);
+        for (unsigned r=0; r<REPEATS; r++) {
+            timer.start();
+            bvh.build(still);
+            build = Math::min(build,timer.time());
+            timer.start();
+            bvh.refit(moved);
+            refit = Math::min(refit,timer.time());
+        }
+        std::cout<<"triangles "<<still.size()<<" nodes "<<bvh.nodeCount()
+            <<" build "<<build<<"us refit "<<refit<<"us"<<std::endl;
+    }
+    return 0;
+}
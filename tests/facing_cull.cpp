@@ -0,0 +1,46 @@
+// Times the facing test over the projected triangles of a rippled grid
+// seen from above, the folds of which face away
+#include <iostream>
+#include <cmath>
+#include <vector>
+
+#include "Object.h"
+#include "FacingSurfaces.h"
+#include "misc/Time.h"
+
+const unsigned REPEATS = 20;
+
+int main() {
+    Time timer(0);
+    const unsigned sizes[] = {32,128,512};
+    for (unsigned n : sizes) {
+        // (n+1) x (n+1) vertices, the ripple folds the grid over so
+        // that its slopes alternate facing
+        ProjectedVertices v;
+        v.resize((n+1)*(n+1));
+        for (unsigned z=0; z<=n; z++)
+            for (unsigned x=0; x<=n; x++) {
+                v.sx[z*(n+1)+x] = x+3*std::sin(x*0.7f);
+                v.sy[z*(n+1)+x] = z;
+            }
+        std::vector<Surface> surfaces;
+        for (unsigned z=0; z<n; z++)
+            for (unsigned x=0; x<n; x++) {
+                unsigned i = z*(n+1)+x;
+                surfaces.push_back(Surface(i,i+1,i+n+1));
+                surfaces.push_back(Surface(i+1,i+n+2,i+n+1));
+            }
+
+        // The best of a few runs
+        FacingSurfaces facing;
+        uintmax_t best = ~uintmax_t(0);
+        for (unsigned r=0; r<REPEATS; r++) {
+            timer.start();
+            facing.cull(v,surfaces,NULL,true,false);
+            best = Math::min(best,timer.time());
+        }
+        std::cout<<"triangles "<<surfaces.size()<<" facing "
+            <<facing.list.size()<<" cull "<<best<<"us"<<std::endl;
+    }
+    return 0;
+}
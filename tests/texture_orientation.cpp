@@ -0,0 +1,68 @@
+// Loads a quad textured with a 2x2 image of four colors and checks
+// that its texture co-ordinates find each color where the .obj file
+// places it: v counts up from the bottom of the image
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "Object.h"
+#include "Texture.h"
+
+int main() {
+    char dir[] = "/tmp/orientationXXXXXX";
+    if (!mkdtemp(dir))
+        return 1;
+    std::string path(dir);
+
+    // Red, green on the top row, blue, white on the bottom one, the
+    // top row first as .ppm stores it
+    std::ofstream ppm(path+"/quad.ppm",std::ios::binary);
+    ppm<<"P6\n2 2\n255\n";
+    const unsigned char rgb[] = {255,0,0, 0,255,0, 0,0,255, 255,255,255};
+    ppm.write((const char*)rgb,sizeof(rgb));
+    ppm.close();
+
+    std::ofstream mtl(path+"/quad.mtl");
+    mtl<<"newmtl quad\nmap_Kd quad.ppm\n";
+    mtl.close();
+
+    // Texel centres at a quarter and three quarters across
+    std::ofstream obj(path+"/quad.obj");
+    obj<<"mtllib quad.mtl\n"
+        "v 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 1 0\n"
+        "vt 0.25 0.25\nvt 0.75 0.25\nvt 0.75 0.75\nvt 0.25 0.75\n"
+        "usemtl quad\nf 1/1 2/2 3/3\nf 1/1 3/3 4/4\n";
+    obj.close();
+
+    Material plain(Coeffecient(0.1,0.1,0.1),Coeffecient(0.5,0.5,0.5),
+            Coeffecient(0,0,0),1);
+    Object quad(path+"/quad.obj",plain,Shading::flat);
+    const Texture* texture = quad.material(1).texture.get();
+
+    // Blue bottom left, white bottom right, green top right and red
+    // top left, blue first
+    const Color expected[] = {{255,0,0,255},{255,255,255,255},
+        {0,255,0,255},{0,0,255,255}};
+    int failures = 0;
+    for (unsigned t=0; t<4; t++) {
+        float u = quad.vtmatrix()(0,t), v = quad.vtmatrix()(1,t);
+        int level = 0;
+        Color c;
+        texture->sample(&u,&v,&level,&c,1);
+        const Color& e = expected[t];
+        if (c.red!=e.red || c.green!=e.green || c.blue!=e.blue) {
+            std::cout<<"texcoord "<<t<<" samples ";
+            c.print();
+            failures++;
+        }
+    }
+
+    for (const char* name : {"/quad.obj","/quad.mtl","/quad.ppm"})
+        remove((path+name).c_str());
+    rmdir(dir);
+    std::cout<<"texture orientation "<<(failures ? "FAILED" : "ok")
+        <<std::endl;
+    return failures ? 1 : 0;
+}
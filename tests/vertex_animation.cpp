@@ -0,0 +1,50 @@
+// Times VertexAnimation::apply() on a grid of vertices with two morph
+// targets and four bones, every vertex following all four
+#include <iostream>
+#include <cmath>
+
+#include "Object.h"
+#include "VertexAnimation.h"
+#include "TfMatrix.h"
+#include "misc/Time.h"
+
+const unsigned REPEATS = 20;
+
+int main() {
+    Time timer(0);
+    Material plain(Coeffecient(0.1,0.1,0.1),Coeffecient(0.5,0.5,0.5),
+            Coeffecient(0,0,0),1);
+    const unsigned sizes[] = {4096,65536,262144};
+    for (unsigned count : sizes) {
+        Object mesh(count,plain,Shading::flat);
+        unsigned side = std::sqrt((float)count);
+        for (unsigned i=0; i<count; i++)
+            mesh.setVertex(i,Vector(i%side,0,i/side,1));
+
+        VertexAnimation anim(&mesh);
+        for (unsigned t=0; t<2; t++) {
+            Matrix<float> target = mesh.baseVertices();
+            for (unsigned i=0; i<count; i++)
+                target(1,i) = std::sin(i*0.01f*(t+1));
+            anim.setWeight(anim.addTarget(target),0.5);
+        }
+        anim.setBones(4);
+        for (unsigned i=0; i<count; i++) {
+            unsigned bones[] = {0,1,2,3};
+            float weights[] = {1,(float)(i%3),(float)(i%5),(float)(i%7)};
+            anim.setInfluences(i,bones,weights);
+        }
+        for (unsigned b=0; b<4; b++)
+            anim.setPose(b,TfMatrix::translation({(float)b,1,0,0}));
+
+        // The best of a few runs
+        uintmax_t best = ~uintmax_t(0);
+        for (unsigned r=0; r<REPEATS; r++) {
+            timer.start();
+            anim.apply();
+            best = Math::min(best,timer.time());
+        }
+        std::cout<<"vertices "<<count<<" apply "<<best<<"us"<<std::endl;
+    }
+    return 0;
+}